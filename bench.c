@@ -0,0 +1,254 @@
+#include "sieve.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#ifndef SIEVE_VERSION
+#define SIEVE_VERSION "unknown"              // make passes `git describe`
+#endif
+
+#define MAX_REPEATS  1000
+#define MAX_SEGMENTS 16
+
+// ============================================================================
+// BENCHMARK DRIVER
+// ============================================================================
+//
+// Sweeps n = 10^min .. 10^max over the count-only engines and a list of
+// segment sizes. Every point runs `warmup` untimed and `repeats` timed
+// calls; the report has the median and p95 wall time, numbers sieved per
+// second and TSC cycles per number (0 where no TSC is available). Rows are
+// CSV or JSON so two versions' runs can be diffed by a script.
+
+typedef enum { BENCH_CSV, BENCH_JSON } bench_format;
+
+typedef struct {
+    const char *name;
+    int engine;                              // sieve_engine, or -1 = parallel
+    int uses_segments;
+} bench_engine;
+
+static const bench_engine bench_engines[] = {
+    { "simple",    SIEVE_ENGINE_SIMPLE,    0 },
+    { "segmented", SIEVE_ENGINE_SEGMENTED, 1 },
+    { "bucket",    SIEVE_ENGINE_BUCKET,    1 },
+    { "wheel",     SIEVE_ENGINE_WHEEL,     1 },
+    { "lucy",      SIEVE_ENGINE_LUCY,      0 },
+    { "parallel",  -1,                     1 },
+    { "gpu",       SIEVE_ENGINE_GPU,       0 },
+};
+#define BENCH_ENGINE_COUNT (sizeof(bench_engines) / sizeof(bench_engines[0]))
+
+typedef struct {
+    double seconds;
+    double cycles;
+} bench_sample;
+
+static void print_usage(const char *program_name) {
+    fprintf(stderr, "Usage: %s [--min-exp k] [--max-exp k] [--warmup w] [--repeats r]\n", program_name);
+    fprintf(stderr, "          [--engines a,b,...] [--segments s,t,...] [--format csv|json]\n");
+    fprintf(stderr, "  --min-exp/--max-exp - Sweep n = 10^min .. 10^max (default 3 .. 9)\n");
+    fprintf(stderr, "  --warmup            - Untimed runs per point (default 1)\n");
+    fprintf(stderr, "  --repeats           - Timed runs per point (default 5)\n");
+    fprintf(stderr, "  --engines           - simple, segmented, bucket, wheel, lucy, parallel, gpu\n");
+    fprintf(stderr, "                        (default simple,segmented,wheel,parallel)\n");
+    fprintf(stderr, "  --segments          - Segment sizes in numbers (default: configured size)\n");
+    fprintf(stderr, "  --format            - csv (default) or json\n");
+}
+
+static double get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint64_t read_cycles(void) {
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static size_t run_once(const bench_engine *e, size_t n) {
+    if (e->engine < 0) {
+        return sieve_count_parallel(n, 0);
+    }
+    return sieve_with_engine(n, NULL, (sieve_engine)e->engine);
+}
+
+static int compare_samples(const void *a, const void *b) {
+    double x = ((const bench_sample *)a)->seconds;
+    double y = ((const bench_sample *)b)->seconds;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of samples sorted by time
+static const bench_sample *percentile(const bench_sample *sorted, int count, int pct) {
+    int rank = (pct * count + 99) / 100;
+    return &sorted[(rank > 0) ? rank - 1 : 0];
+}
+
+// Comma-separated engine names to a mask over bench_engines
+static int parse_engines(char *list, unsigned *mask) {
+    *mask = 0;
+    for (char *name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+        size_t i = 0;
+        while (i < BENCH_ENGINE_COUNT && strcmp(name, bench_engines[i].name) != 0) {
+            i++;
+        }
+        if (i == BENCH_ENGINE_COUNT) {
+            fprintf(stderr, "Error: Unknown engine '%s'.\n", name);
+            return 0;
+        }
+        *mask |= 1u << i;
+    }
+    return *mask != 0;
+}
+
+static int parse_segments(char *list, size_t *segments, int *count) {
+    *count = 0;
+    for (char *item = strtok(list, ","); item != NULL; item = strtok(NULL, ",")) {
+        char *endptr;
+        unsigned long long value = strtoull(item, &endptr, 10);
+        if (*endptr != '\0' || value == 0 || *count == MAX_SEGMENTS) {
+            fprintf(stderr, "Error: Invalid segment size list at '%s'.\n", item);
+            return 0;
+        }
+        segments[(*count)++] = (size_t)value;
+    }
+    return *count != 0;
+}
+
+static int parse_int(const char *text, int min, int max, int *value) {
+    char *endptr;
+    long v = strtol(text, &endptr, 10);
+    if (*endptr != '\0' || v < min || v > max) {
+        fprintf(stderr, "Error: Invalid value '%s'.\n", text);
+        return 0;
+    }
+    *value = (int)v;
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    int min_exp = 3, max_exp = 9, warmup = 1, repeats = 5;
+    unsigned engine_mask = (1u << 0) | (1u << 1) | (1u << 3) | (1u << 5);
+    size_t segments[MAX_SEGMENTS];
+    int segment_count = 0;
+    bench_format format = BENCH_CSV;
+
+    for (int argi = 1; argi < argc; argi += 2) {
+        const char *opt = argv[argi];
+        const char *val = (argi + 1 < argc) ? argv[argi + 1] : NULL;
+        int ok = (val != NULL);
+        if (ok && strcmp(opt, "--min-exp") == 0) {
+            ok = parse_int(val, 1, 19, &min_exp);
+        } else if (ok && strcmp(opt, "--max-exp") == 0) {
+            ok = parse_int(val, 1, 19, &max_exp);
+        } else if (ok && strcmp(opt, "--warmup") == 0) {
+            ok = parse_int(val, 0, MAX_REPEATS, &warmup);
+        } else if (ok && strcmp(opt, "--repeats") == 0) {
+            ok = parse_int(val, 1, MAX_REPEATS, &repeats);
+        } else if (ok && strcmp(opt, "--engines") == 0) {
+            ok = parse_engines(argv[argi + 1], &engine_mask);
+        } else if (ok && strcmp(opt, "--segments") == 0) {
+            ok = parse_segments(argv[argi + 1], segments, &segment_count);
+        } else if (ok && strcmp(opt, "--format") == 0) {
+            ok = 1;
+            if (strcmp(val, "csv") == 0) {
+                format = BENCH_CSV;
+            } else if (strcmp(val, "json") == 0) {
+                format = BENCH_JSON;
+            } else {
+                ok = 0;
+            }
+        } else {
+            ok = 0;
+        }
+        if (!ok) {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (min_exp > max_exp) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    sieve_config config = *sieve_get_config();
+    if (segment_count == 0) {
+        segments[segment_count++] = config.segment_size;
+    }
+
+    if (format == BENCH_CSV) {
+        printf("version,engine,segment_size,n,primes,repeats,median_s,p95_s,"
+               "numbers_per_s,cycles_per_number\n");
+    } else {
+        printf("{\"version\": \"%s\", \"isa\": \"%s\", \"l1d_cache\": %zu, \"l2_cache\": %zu, "
+               "\"results\": [", SIEVE_VERSION, sieve_kernel_isa(), config.l1d_cache, config.l2_cache);
+    }
+
+    bench_sample samples[MAX_REPEATS];
+    int first_row = 1;
+    for (size_t e = 0; e < BENCH_ENGINE_COUNT; e++) {
+        if (!(engine_mask & (1u << e))) {
+            continue;
+        }
+        const bench_engine *engine = &bench_engines[e];
+        int seg_runs = engine->uses_segments ? segment_count : 1;
+
+        for (int s = 0; s < seg_runs; s++) {
+            config.segment_size = engine->uses_segments ? segments[s] : segments[0];
+            sieve_set_config(&config);
+            size_t segment_size = sieve_get_config()->segment_size;  // After clamping
+
+            size_t n = 1;
+            for (int k = 0; k < min_exp; k++) n *= 10;
+            for (int k = min_exp; k <= max_exp; k++, n *= 10) {
+                size_t primes = 0;
+                for (int r = 0; r < warmup; r++) {
+                    primes = run_once(engine, n);
+                }
+                for (int r = 0; r < repeats; r++) {
+                    double t0 = get_time();
+                    uint64_t c0 = read_cycles();
+                    primes = run_once(engine, n);
+                    uint64_t c1 = read_cycles();
+                    samples[r].seconds = get_time() - t0;
+                    samples[r].cycles = (double)(c1 - c0);
+                }
+                qsort(samples, (size_t)repeats, sizeof(samples[0]), compare_samples);
+                const bench_sample *median = percentile(samples, repeats, 50);
+                const bench_sample *p95 = percentile(samples, repeats, 95);
+                double rate = (median->seconds > 0) ? (double)n / median->seconds : 0;
+                double cpn = median->cycles / (double)n;
+
+                if (format == BENCH_CSV) {
+                    printf("%s,%s,%zu,%zu,%zu,%d,%.9f,%.9f,%.6g,%.6g\n",
+                           SIEVE_VERSION, engine->name, segment_size, n, primes, repeats,
+                           median->seconds, p95->seconds, rate, cpn);
+                } else {
+                    printf("%s\n  {\"engine\": \"%s\", \"segment_size\": %zu, \"n\": %zu, "
+                           "\"primes\": %zu, \"repeats\": %d, \"median_s\": %.9f, "
+                           "\"p95_s\": %.9f, \"numbers_per_s\": %.6g, \"cycles_per_number\": %.6g}",
+                           first_row ? "" : ",", engine->name, segment_size, n, primes,
+                           repeats, median->seconds, p95->seconds, rate, cpn);
+                }
+                first_row = 0;
+                fflush(stdout);
+            }
+        }
+    }
+
+    if (format == BENCH_JSON) {
+        printf("\n]}\n");
+    }
+    return 0;
+}
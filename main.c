@@ -1,15 +1,126 @@
 #include "sieve.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
+
+#define CONFIG_FILE_NAME ".sieve.conf"   // Default config, in $HOME
+#define TUNE_SEGMENT_N   200000000       // Limit timed for each segment size
+#define TUNE_RUNS        3               // Best of this many runs per measurement
+#define CHECKPOINT_EVERY 60              // Default seconds between checkpoints
 
 static void print_usage(const char *program_name) {
-    fprintf(stderr, "Usage: %s <limit> [output_file]\n", program_name);
+    fprintf(stderr, "Usage: %s [-t threads] [-e engine] [-f format] [-c config] [--cache file] [--tuple d,...] [--stats] <limit> [output_file]\n", program_name);
+    fprintf(stderr, "       %s --checkpoint file [--every s] [--resume] [-f format] <limit> [output_file]\n", program_name);
+    fprintf(stderr, "       %s --shard i/N [--from lo] [--checkpoint file [--every s] [--resume]] <limit> <result_file>\n", program_name);
+    fprintf(stderr, "       %s --merge <result_file>...\n", program_name);
+    fprintf(stderr, "       %s --nth k [--cache file]\n", program_name);
+    fprintf(stderr, "       %s --factor [--from lo] <limit> [output_file]\n", program_name);
+    fprintf(stderr, "       %s --tune [-c config]\n", program_name);
     fprintf(stderr, "  limit        - Find all primes up to this number (inclusive)\n");
     fprintf(stderr, "  output_file  - Optional: Write primes to this file\n");
+    fprintf(stderr, "  -t threads   - Optional: Count with a parallel sieve (0 = all CPUs; not with -e)\n");
+    fprintf(stderr, "  -e engine    - Optional: auto, simple, segmented, bucket, wheel, lucy or gpu\n");
+    fprintf(stderr, "  -f format    - Optional: text, u32, u64, varint or bitmap (default: text)\n");
+    fprintf(stderr, "  -c config    - Optional: Tuning file (default: $SIEVE_CONFIG or ~/%s)\n", CONFIG_FILE_NAME);
+    fprintf(stderr, "  --cache file - Optional: Count from a prime table file, built up to limit if needed\n");
+    fprintf(stderr, "  --tuple d,.. - Optional: Count prime tuples p, p+d, ... (0,2 = twin primes)\n");
+    fprintf(stderr, "  --stats      - Optional: Per-phase time and hardware counters (make STATS=1)\n");
+    fprintf(stderr, "  --checkpoint - Save progress to this state file at segment boundaries (segmented engine,\n");
+    fprintf(stderr, "                 or the count of a --shard)\n");
+    fprintf(stderr, "  --every s    - Optional: Seconds between checkpoints (default: %d, 0 = every segment)\n", CHECKPOINT_EVERY);
+    fprintf(stderr, "  --resume     - Continue an interrupted --checkpoint run from its state file\n");
+    fprintf(stderr, "  --shard i/N  - Count shard i (0-based) of an N-way split of [lo, limit], balanced by\n");
+    fprintf(stderr, "                 estimated work, into a result file (kept if already complete)\n");
+    fprintf(stderr, "  --from lo    - Optional: Lower end of the range for --shard, --cache or --factor (default: 0)\n");
+    fprintf(stderr, "  --nth k      - Print the k-th prime, from the --cache table when it holds it\n");
+    fprintf(stderr, "  --factor     - Factor every number in [lo, limit], one 'n: p^e * q' line each\n");
+    fprintf(stderr, "  --merge      - Check that result files cover their range and add up the counts\n");
+    fprintf(stderr, "  --tune       - Calibrate segment size and thresholds, save to the tuning file\n");
     fprintf(stderr, "\nExample:\n");
     fprintf(stderr, "  %s 1000000\n", program_name);
     fprintf(stderr, "  %s 1000000 primes.txt\n", program_name);
+    fprintf(stderr, "  %s -t 0 10000000000\n", program_name);
+    fprintf(stderr, "  %s --checkpoint run.ck --resume 100000000000 primes.bin -f varint\n", program_name);
+    fprintf(stderr, "  %s --cache primes.cache --from 1000000 2000000\n", program_name);
+    fprintf(stderr, "  %s --tuple 0,2,6 100000000000\n", program_name);
+    fprintf(stderr, "  %s --shard 3/16 10000000000000 shard3.res\n", program_name);
+    fprintf(stderr, "  %s --shard 3/16 --checkpoint shard3.ck --resume 10000000000000 shard3.res\n", program_name);
+    fprintf(stderr, "  %s --factor --from 1000000000000 1000100000000 factors.txt\n", program_name);
+}
+
+static int parse_engine(const char *name, sieve_engine *engine) {
+    static const struct { const char *name; sieve_engine engine; } engines[] = {
+        { "auto",      SIEVE_ENGINE_AUTO },
+        { "simple",    SIEVE_ENGINE_SIMPLE },
+        { "segmented", SIEVE_ENGINE_SEGMENTED },
+        { "bucket",    SIEVE_ENGINE_BUCKET },
+        { "wheel",     SIEVE_ENGINE_WHEEL },
+        { "lucy",      SIEVE_ENGINE_LUCY },
+        { "gpu",       SIEVE_ENGINE_GPU },
+    };
+    for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+        if (strcmp(name, engines[i].name) == 0) {
+            *engine = engines[i].engine;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int parse_format(const char *name, sieve_format *format) {
+    static const struct { const char *name; sieve_format format; } formats[] = {
+        { "text",   SIEVE_FORMAT_TEXT },
+        { "u32",    SIEVE_FORMAT_U32 },
+        { "u64",    SIEVE_FORMAT_U64 },
+        { "varint", SIEVE_FORMAT_VARINT },
+        { "bitmap", SIEVE_FORMAT_BITMAP },
+    };
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        if (strcmp(name, formats[i].name) == 0) {
+            *format = formats[i].format;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Comma-separated tuple offsets, e.g. "0,2,6"
+static int parse_tuple(const char *text, unsigned *offsets, size_t *count) {
+    char list[256];
+    if ((size_t)snprintf(list, sizeof(list), "%s", text) >= sizeof(list)) {
+        return 0;
+    }
+    *count = 0;
+    for (char *item = strtok(list, ","); item != NULL; item = strtok(NULL, ",")) {
+        char *endptr;
+        unsigned long value = strtoul(item, &endptr, 10);
+        if (*endptr != '\0' || *count == SIEVE_TUPLE_MAX || value > SIEVE_TUPLE_MAX_SPAN
+                || value % 2 != 0 || (*count == 0) != (value == 0)
+                || (*count > 0 && value <= offsets[*count - 1])) {
+            return 0;  // Same rules as sieve_count_tuples()
+        }
+        offsets[(*count)++] = (unsigned)value;
+    }
+    return *count >= 2;
+}
+
+// "i/N" with i < N
+static int parse_shard(const char *text, uint32_t *index, uint32_t *count) {
+    char *endptr;
+    unsigned long i = strtoul(text, &endptr, 10);
+    if (endptr == text || *endptr != '/') {
+        return 0;
+    }
+    const char *rest = endptr + 1;
+    unsigned long n = strtoul(rest, &endptr, 10);
+    if (endptr == rest || *endptr != '\0' || n == 0 || n > UINT32_MAX || i >= n) {
+        return 0;
+    }
+    *index = (uint32_t)i;
+    *count = (uint32_t)n;
+    return 1;
 }
 
 // Get high-resolution time in seconds
@@ -19,29 +130,463 @@ static double get_time(void) {
     return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
 }
 
+static void print_counter(int64_t value) {
+    if (value < 0) {
+        printf(" %14s", "-");
+    } else {
+        printf(" %14lld", (long long)value);
+    }
+}
+
+// Per-phase table for --stats; '-' marks counters the kernel did not allow
+static void print_stats(void) {
+    sieve_phase_stats stats[SIEVE_PHASES];
+    sieve_stats_get(stats);
+    printf("\n%-13s %10s %8s %14s %14s %14s %14s\n", "Phase", "Time (ms)", "Calls",
+           "Instructions", "Branch misses", "L1d misses", "LLC misses");
+    for (unsigned p = 0; p < SIEVE_PHASES; p++) {
+        printf("%-13s %10.3f %8llu", sieve_phase_name((sieve_phase)p),
+               stats[p].seconds * 1e3, (unsigned long long)stats[p].calls);
+        print_counter(stats[p].instructions);
+        print_counter(stats[p].branch_misses);
+        print_counter(stats[p].l1d_misses);
+        print_counter(stats[p].llc_misses);
+        printf("\n");
+    }
+}
+
+// --shard: count one shard, or keep a complete result from an earlier run;
+// with a checkpoint path the count itself can be resumed
+static int run_shard(uint64_t lo, uint64_t hi, uint32_t index, uint32_t count,
+                     const char *result_file, const char *checkpoint_path,
+                     unsigned checkpoint_every, int resume) {
+    sieve_shard_result result;
+    uint64_t shard_lo, shard_hi;
+    if (sieve_shard_range(lo, hi, index, count, &shard_lo, &shard_hi) != 0) {
+        return 1;
+    }
+    printf("Shard %u/%u: [%llu, %llu]\n", index, count,
+           (unsigned long long)shard_lo, (unsigned long long)shard_hi);
+    
+    if (access(result_file, R_OK) == 0 && sieve_shard_read(result_file, &result) == 0 &&
+        result.index == index && result.count == count && result.lo == lo && result.hi == hi &&
+        result.shard_lo == shard_lo && result.shard_hi == shard_hi) {
+        printf("Primes found: %llu\n", (unsigned long long)result.prime_count);
+        printf("Result already complete: %s\n", result_file);
+        return 0;
+    }
+    
+    double start = get_time();
+    int status = (checkpoint_path != NULL)
+        ? sieve_shard_run_checkpointed(lo, hi, index, count, checkpoint_path, checkpoint_every,
+                                       resume, &result)
+        : sieve_shard_run(lo, hi, index, count, &result);
+    if (status != 0 || sieve_shard_write(result_file, &result) != 0) {
+        return 1;
+    }
+    printf("Primes found: %llu\n", (unsigned long long)result.prime_count);
+    printf("Time elapsed: %.6f seconds\n", get_time() - start);
+    printf("Result written to: %s\n", result_file);
+    return 0;
+}
+
+typedef struct {
+    FILE *out;                          // NULL: count only
+    uint64_t primes;
+    uint64_t factors;
+} factor_output;
+
+static void print_factors(uint64_t n, const sieve_factor *factors, size_t count, void *ctx) {
+    factor_output *fo = ctx;
+    fo->primes += (count == 1 && factors[0].exponent == 1);
+    fo->factors += count;
+    if (fo->out == NULL) {
+        return;
+    }
+    fprintf(fo->out, "%llu:", (unsigned long long)n);
+    for (size_t i = 0; i < count; i++) {
+        fprintf(fo->out, (i == 0) ? " %llu" : " * %llu", (unsigned long long)factors[i].prime);
+        if (factors[i].exponent > 1) {
+            fprintf(fo->out, "^%u", factors[i].exponent);
+        }
+    }
+    fputc('\n', fo->out);
+}
+
+// --factor: factor [lo, hi] and write one line per number, or just count
+static int run_factor(uint64_t lo, uint64_t hi, const char *output_file) {
+    factor_output fo = { .out = NULL, .primes = 0, .factors = 0 };
+    if (output_file != NULL && (fo.out = fopen(output_file, "w")) == NULL) {
+        fprintf(stderr, "Error: Could not open output file '%s'\n", output_file);
+        return 1;
+    }
+    double start = get_time();
+    uint64_t numbers = sieve_factor_range(lo, hi, print_factors, &fo);
+    if (fo.out != NULL && fclose(fo.out) != 0) {
+        fprintf(stderr, "Error: Writing '%s' failed\n", output_file);
+        return 1;
+    }
+    if (numbers == 0 && hi != 0) {
+        fprintf(stderr, "Error: Could not allocate the factor sieve tables\n");
+        return 1;
+    }
+    printf("Numbers factored: %llu\n", (unsigned long long)numbers);
+    printf("Primes found: %llu\n", (unsigned long long)fo.primes);
+    printf("Distinct prime factors: %llu\n", (unsigned long long)fo.factors);
+    printf("Time elapsed: %.6f seconds\n", get_time() - start);
+    if (output_file != NULL) {
+        printf("Factorizations written to: %s\n", output_file);
+    }
+    return 0;
+}
+
+// Default tuning file: $SIEVE_CONFIG, else ~/.sieve.conf
+static const char *default_config_path(char *buf, size_t size) {
+    const char *env = getenv("SIEVE_CONFIG");
+    if (env != NULL && env[0] != '\0') {
+        return env;
+    }
+    const char *home = getenv("HOME");
+    if (home == NULL || (size_t)snprintf(buf, size, "%s/%s", home, CONFIG_FILE_NAME) >= size) {
+        return NULL;
+    }
+    return buf;
+}
+
+// Best wall time of TUNE_RUNS count-only runs
+static double time_engine(size_t n, sieve_engine engine) {
+    double best = 0;
+    for (int run = 0; run < TUNE_RUNS; run++) {
+        double start = get_time();
+        sieve_with_engine(n, NULL, engine);
+        double elapsed = get_time() - start;
+        if (run == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+// Short calibration: segment bitmaps from 8KB up to the L2 size, then the
+// smallest power-of-two n at which the segmented sieve beats the simple one.
+// The bucket crossover (around 10^11) is too slow to measure here and keeps
+// its default.
+static void tune_config(sieve_config *config) {
+    size_t l2 = (config->l2_cache != 0) ? config->l2_cache : (1 << 20);
+    size_t best_size = config->segment_size;
+    double best_time = 0;
+    
+    sieve_with_engine(TUNE_SEGMENT_N, NULL, SIEVE_ENGINE_SEGMENTED);  // Warm up
+    for (size_t bitmap = 8192; bitmap <= l2; bitmap *= 2) {
+        config->segment_size = bitmap * 16;
+        sieve_set_config(config);
+        double t = time_engine(TUNE_SEGMENT_N, SIEVE_ENGINE_SEGMENTED);
+        printf("segment_size %10zu: %8.3f ms\n", config->segment_size, t * 1e3);
+        if (best_time == 0 || t < best_time) {
+            best_time = t;
+            best_size = config->segment_size;
+        }
+    }
+    config->segment_size = best_size;
+    sieve_set_config(config);
+    
+    size_t n = (size_t)1 << 10;
+    for (; n < ((size_t)1 << 28); n *= 2) {
+        double simple = time_engine(n, SIEVE_ENGINE_SIMPLE);
+        double segmented = time_engine(n, SIEVE_ENGINE_SEGMENTED);
+        printf("n %10zu: simple %8.3f ms, segmented %8.3f ms\n", n, simple * 1e3, segmented * 1e3);
+        if (segmented < simple) {
+            break;
+        }
+    }
+    config->simple_threshold = n;
+    sieve_set_config(config);
+}
+
 int main(int argc, char *argv[]) {
-    if (argc < 2 || argc > 3) {
+    char *endptr;
+    int parallel = 0;
+    size_t nthreads = 0;
+    sieve_engine engine = SIEVE_ENGINE_AUTO;
+    sieve_format format = SIEVE_FORMAT_TEXT;
+    const char *config_path = NULL;
+    const char *cache_path = NULL;
+    int tune = 0;
+    int merge = 0;
+    int factor = 0;
+    int shard = 0;
+    uint32_t shard_index = 0, shard_count = 0;
+    const char *from_text = NULL;
+    const char *nth_text = NULL;
+    int stats = 0;
+    unsigned tuple[SIEVE_TUPLE_MAX];
+    size_t tuple_size = 0;
+    const char *checkpoint_path = NULL;
+    unsigned checkpoint_every = CHECKPOINT_EVERY;
+    int resume = 0;
+    
+    // Parse options
+    int argi = 1;
+    while (argi < argc && argv[argi][0] == '-' && argv[argi][1] != '\0') {
+        if ((strcmp(argv[argi], "-t") == 0 || strcmp(argv[argi], "--threads") == 0) && argi + 1 < argc) {
+            long threads_long = strtol(argv[argi + 1], &endptr, 10);
+            if (*endptr != '\0' || threads_long < 0) {
+                fprintf(stderr, "Error: Invalid thread count '%s'.\n", argv[argi + 1]);
+                print_usage(argv[0]);
+                return 1;
+            }
+            parallel = 1;
+            nthreads = (size_t)threads_long;
+            argi += 2;
+        } else if ((strcmp(argv[argi], "-e") == 0 || strcmp(argv[argi], "--engine") == 0) && argi + 1 < argc) {
+            if (!parse_engine(argv[argi + 1], &engine)) {
+                fprintf(stderr, "Error: Unknown engine '%s'.\n", argv[argi + 1]);
+                print_usage(argv[0]);
+                return 1;
+            }
+            argi += 2;
+        } else if ((strcmp(argv[argi], "-f") == 0 || strcmp(argv[argi], "--format") == 0) && argi + 1 < argc) {
+            if (!parse_format(argv[argi + 1], &format)) {
+                fprintf(stderr, "Error: Unknown format '%s'.\n", argv[argi + 1]);
+                print_usage(argv[0]);
+                return 1;
+            }
+            argi += 2;
+        } else if ((strcmp(argv[argi], "-c") == 0 || strcmp(argv[argi], "--config") == 0) && argi + 1 < argc) {
+            config_path = argv[argi + 1];
+            argi += 2;
+        } else if (strcmp(argv[argi], "--cache") == 0 && argi + 1 < argc) {
+            cache_path = argv[argi + 1];
+            argi += 2;
+        } else if (strcmp(argv[argi], "--tuple") == 0 && argi + 1 < argc) {
+            if (!parse_tuple(argv[argi + 1], tuple, &tuple_size)) {
+                fprintf(stderr, "Error: Invalid tuple '%s'.\n", argv[argi + 1]);
+                print_usage(argv[0]);
+                return 1;
+            }
+            argi += 2;
+        } else if (strcmp(argv[argi], "--checkpoint") == 0 && argi + 1 < argc) {
+            checkpoint_path = argv[argi + 1];
+            argi += 2;
+        } else if (strcmp(argv[argi], "--every") == 0 && argi + 1 < argc) {
+            unsigned long every = strtoul(argv[argi + 1], &endptr, 10);
+            if (*endptr != '\0' || argv[argi + 1][0] == '-' || every > UINT32_MAX) {
+                fprintf(stderr, "Error: Invalid checkpoint interval '%s'.\n", argv[argi + 1]);
+                print_usage(argv[0]);
+                return 1;
+            }
+            checkpoint_every = (unsigned)every;
+            argi += 2;
+        } else if (strcmp(argv[argi], "--resume") == 0) {
+            resume = 1;
+            argi++;
+        } else if (strcmp(argv[argi], "--stats") == 0) {
+            stats = 1;
+            argi++;
+        } else if (strcmp(argv[argi], "--shard") == 0 && argi + 1 < argc) {
+            if (!parse_shard(argv[argi + 1], &shard_index, &shard_count)) {
+                fprintf(stderr, "Error: Invalid shard '%s' (expected i/N with i < N).\n", argv[argi + 1]);
+                print_usage(argv[0]);
+                return 1;
+            }
+            shard = 1;
+            argi += 2;
+        } else if (strcmp(argv[argi], "--from") == 0 && argi + 1 < argc) {
+            from_text = argv[argi + 1];
+            argi += 2;
+        } else if (strcmp(argv[argi], "--nth") == 0 && argi + 1 < argc) {
+            nth_text = argv[argi + 1];
+            argi += 2;
+        } else if (strcmp(argv[argi], "--factor") == 0) {
+            factor = 1;
+            argi++;
+        } else if (strcmp(argv[argi], "--merge") == 0) {
+            merge = 1;
+            argi++;
+        } else if (strcmp(argv[argi], "--tune") == 0) {
+            tune = 1;
+            argi++;
+        } else {
+            fprintf(stderr, "Error: Unknown option '%s'.\n", argv[argi]);
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    // Tuning file: an explicit -c must load; the default one is optional
+    char default_path[4096];
+    int explicit_config = (config_path != NULL);
+    if (!explicit_config) {
+        config_path = default_config_path(default_path, sizeof(default_path));
+    }
+    sieve_config config = *sieve_get_config();
+    
+    if (tune) {
+        if (argc - argi != 0 || config_path == NULL) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        tune_config(&config);
+        if (sieve_config_save(&config, config_path) != 0) {
+            return 1;
+        }
+        printf("segment_size = %zu, simple_threshold = %zu\n",
+               config.segment_size, config.simple_threshold);
+        printf("Tuning saved to: %s\n", config_path);
+        return 0;
+    }
+    
+    if (explicit_config || (config_path != NULL && access(config_path, R_OK) == 0)) {
+        if (sieve_config_load(&config, config_path) != 0) {
+            return 1;
+        }
+        sieve_set_config(&config);
+    }
+    
+    if (merge) {
+        uint64_t total;
+        if (argc - argi < 1) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        if (sieve_shard_merge((const char *const *)&argv[argi], (size_t)(argc - argi), &total) != 0) {
+            return 1;
+        }
+        printf("Primes found: %llu\n", (unsigned long long)total);
+        printf("Shards merged: %d\n", argc - argi);
+        return 0;
+    }
+    if (nth_text != NULL) {
+        unsigned long long k = strtoull(nth_text, &endptr, 10);
+        if (*endptr != '\0' || nth_text[0] == '-' || k == 0 || argc - argi != 0) {
+            fprintf(stderr, "Error: Invalid prime index '%s'.\n", nth_text);
+            print_usage(argv[0]);
+            return 1;
+        }
+        double start = get_time();
+        uint64_t prime = 0;
+        sieve_cache *cache = (cache_path != NULL) ? sieve_cache_open(cache_path) : NULL;
+        if (cache != NULL) {
+            prime = sieve_cache_nth_prime(cache, k);  // 0 past the table: compute it
+            sieve_cache_close(cache);
+        }
+        if (prime == 0) {
+            prime = nth_prime(k);
+        }
+        if (prime == 0) {
+            fprintf(stderr, "Error: Prime #%llu exceeds 2^64 - 1.\n", k);
+            return 1;
+        }
+        printf("Prime #%llu: %llu\n", k, (unsigned long long)prime);
+        printf("Time elapsed: %.6f seconds\n", get_time() - start);
+        return 0;
+    }
+    if (from_text != NULL && !shard && !factor && cache_path == NULL) {
+        fprintf(stderr, "Error: --from only applies to --shard, --cache and --factor.\n");
+        return 1;
+    }
+    if (checkpoint_path == NULL && (resume || checkpoint_every != CHECKPOINT_EVERY)) {
+        fprintf(stderr, "Error: --resume and --every need --checkpoint.\n");
+        return 1;
+    }
+    if (checkpoint_path != NULL && (parallel || cache_path != NULL || tuple_size != 0)) {
+        fprintf(stderr, "Error: --checkpoint runs the single-threaded segmented sieve only.\n");
+        return 1;
+    }
+    if (parallel && engine != SIEVE_ENGINE_AUTO) {
+        fprintf(stderr, "Error: -e picks a single-threaded engine; -t runs the parallel sieve only.\n");
+        return 1;
+    }
+    
+    if (argc - argi < 1 || argc - argi > 2) {
         print_usage(argv[0]);
         return 1;
     }
     
     // Parse limit argument
-    char *endptr;
-    long limit_long = strtol(argv[1], &endptr, 10);
+    long limit_long = strtol(argv[argi], &endptr, 10);
     
     if (*endptr != '\0' || limit_long < 0) {
-        fprintf(stderr, "Error: Invalid limit '%s'. Must be a non-negative integer.\n", argv[1]);
+        fprintf(stderr, "Error: Invalid limit '%s'. Must be a non-negative integer.\n", argv[argi]);
         print_usage(argv[0]);
         return 1;
     }
     
     size_t limit = (size_t)limit_long;
-    const char *output_file = (argc == 3) ? argv[2] : NULL;
+    const char *output_file = (argc - argi == 2) ? argv[argi + 1] : NULL;
+    
+    long long from = 0;
+    if (from_text != NULL) {
+        from = strtoll(from_text, &endptr, 10);
+        if (*endptr != '\0' || from < 0 || (unsigned long long)from > limit) {
+            fprintf(stderr, "Error: Invalid range start '%s'.\n", from_text);
+            return 1;
+        }
+    }
+    
+    if (shard) {
+        if (output_file == NULL) {
+            fprintf(stderr, "Error: --shard needs a result file.\n");
+            print_usage(argv[0]);
+            return 1;
+        }
+        return run_shard((uint64_t)from, limit, shard_index, shard_count, output_file,
+                         checkpoint_path, checkpoint_every, resume);
+    }
+    if (factor) {
+        return run_factor((uint64_t)from, limit, output_file);
+    }
+    
+    if (stats && sieve_stats_enable(1) != 0) {
+        fprintf(stderr, "Error: --stats needs a build with phase probes (make clean && make STATS=1).\n");
+        return 1;
+    }
     
     // Run sieve with high-resolution timing
     double start = get_time();
-    size_t prime_count = sieve_of_eratosthenes(limit, output_file);
+    size_t prime_count;
+    if (tuple_size != 0) {
+        if (output_file != NULL) {
+            fprintf(stderr, "Error: --tuple only counts; it writes no output file.\n");
+            return 1;
+        }
+        uint64_t tuples = sieve_count_tuples(0, limit, tuple, tuple_size);
+        printf("Tuples found: %llu\n", (unsigned long long)tuples);
+        printf("Time elapsed: %.6f seconds\n", get_time() - start);
+        return 0;
+    }
+    if (from_text != NULL && output_file != NULL) {
+        fprintf(stderr, "Error: --from with --cache only counts; it writes no output file.\n");
+        return 1;
+    }
+    if (cache_path != NULL && output_file == NULL) {
+        sieve_cache *cache = sieve_cache_open(cache_path);
+        if (cache == NULL || sieve_cache_limit(cache) < limit) {
+            sieve_cache_close(cache);
+            cache = (sieve_cache_build(limit, cache_path) == 0) ? sieve_cache_open(cache_path) : NULL;
+            if (cache == NULL) {
+                return 1;
+            }
+            printf("Cache built: %s\n", cache_path);
+        }
+        prime_count = (size_t)sieve_cache_count(cache, (uint64_t)from, limit);
+        sieve_cache_close(cache);
+    } else if (checkpoint_path != NULL) {
+        if (sieve_write_checkpointed(limit, output_file, format, checkpoint_path,
+                                     checkpoint_every, resume, &prime_count) != 0) {
+            return 1;
+        }
+    } else if (parallel && output_file != NULL) {
+        prime_count = sieve_write_parallel(limit, output_file, format, nthreads);
+    } else if (parallel) {
+        prime_count = sieve_count_parallel(limit, nthreads);
+    } else {
+        prime_count = sieve_write_primes(limit, output_file, format, engine);
+    }
     double end = get_time();
+    if (prime_count == SIEVE_ERROR) {
+        return 1;  // Already reported
+    }
     
     double elapsed_time = end - start;
     
@@ -58,6 +603,9 @@ int main(int argc, char *argv[]) {
     if (output_file != NULL) {
         printf("Primes written to: %s\n", output_file);
     }
+    if (stats) {
+        print_stats();
+    }
     
     return 0;
 }
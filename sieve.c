@@ -1,17 +1,20 @@
+#define _DEFAULT_SOURCE  // pwritev()
 #include "sieve.h"
+#include "sieve_internal.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <time.h>
-
-// BIT ARRAY MACROS for odd-only sieve
-// Bit index i represents odd number (2*i + 1)
-#define GET_BIT(arr, i)   ((arr)[(i) >> 3] & (1 << ((i) & 7)))
-#define CLEAR_BIT(arr, i) ((arr)[(i) >> 3] &= ~(1 << ((i) & 7)))
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
 // Simple sieve for small/medium n (odd-only + bit array)
-static size_t sieve_simple(size_t n, const char *output_file) {
+static size_t sieve_simple(size_t n, prime_writer *w) {
     if (n < 2) {
         return 0;  // No primes less than 2
     }
@@ -23,13 +26,21 @@ static size_t sieve_simple(size_t n, const char *output_file) {
     
     size_t bit_count = (n + 1) / 2;              // Number of odd numbers to track
     size_t byte_count = (bit_count + 7) / 8;     // Bytes needed for bits
-    uint8_t sieve[byte_count];                   // Still on stack (VLA)
+    sieve_arena *arena = arena_current();
+    arena_mark mark = arena_save(arena);
+    uint8_t *sieve = arena_alloc(arena, byte_count);
+    if (sieve == NULL) {
+        return SIEVE_ERROR;
+    }
+    STATS_BEGIN(SIEVE_PHASE_SEGMENT_INIT);
     memset(sieve, 0xFF, byte_count);             // Initialize all bits to 1 (prime)
     
     // Bit 0 represents 1, which is not prime
     CLEAR_BIT(sieve, 0);
+    STATS_END(SIEVE_PHASE_SEGMENT_INIT);
     
     // Sieve algorithm: only check odd numbers up to sqrt(n)
+    STATS_BEGIN(SIEVE_PHASE_MARK);
     // Bit index i represents odd number (2*i + 1)
     for (size_t i = 1; (2*i + 1) * (2*i + 1) <= n; i++) {
         if (GET_BIT(sieve, i)) {
@@ -43,44 +54,23 @@ static size_t sieve_simple(size_t n, const char *output_file) {
             }
         }
     }
-    
-    // Count primes and optionally write to file
-    size_t prime_count = 0;
-    FILE *fp = NULL;
-    
-    if (output_file != NULL) {
-        fp = fopen(output_file, "w");
-        if (fp == NULL) {
-            fprintf(stderr, "Error: Could not open output file '%s'\n", output_file);
-            // Continue without file output
-        }
-    }
+    STATS_END(SIEVE_PHASE_MARK);
     
     // Special case: 2 is the only even prime
-    if (n >= 2) {
-        prime_count = 1;
-        if (fp != NULL) {
-            fprintf(fp, "2\n");
-        }
-    }
-    
-    // Count/output odd primes
-    for (size_t i = 1; i < bit_count; i++) {
-        if (GET_BIT(sieve, i)) {
-            size_t prime = 2*i + 1;
-            if (prime <= n) {  // Boundary check for last byte
-                prime_count++;
-                if (fp != NULL) {
-                    fprintf(fp, "%zu\n", prime);
-                }
-            }
-        }
-    }
-    
-    if (fp != NULL) {
-        fclose(fp);
+    size_t prime_count = 1;
+    if (w != NULL) {
+        STATS_BEGIN(SIEVE_PHASE_OUTPUT);
+        prime_writer_put(w, 2);
+        prime_writer_put_segment(w, sieve, 1, bit_count);
+        STATS_END(SIEVE_PHASE_OUTPUT);
     }
     
+    // Count odd primes: vector popcount over the whole bitmap
+    // (bit 0, the number 1, is already cleared)
+    STATS_BEGIN(SIEVE_PHASE_COUNT);
+    prime_count += popcount_bits(sieve, bit_count);
+    STATS_END(SIEVE_PHASE_COUNT);
+    arena_restore(arena, mark);
     return prime_count;
 }
 
@@ -88,16 +78,19 @@ static size_t sieve_simple(size_t n, const char *output_file) {
 // SEGMENTED SIEVE for large n
 // ============================================================================
 
-#define SEGMENT_SIZE (256 * 1024)  // 256KB segments (cache-friendly)
-
 // Helper: Find base primes up to sqrt(n) using simple odd-only sieve
-static size_t find_base_primes(size_t limit, size_t *primes, size_t max_primes) {
+size_t find_base_primes(size_t limit, size_t *primes, size_t max_primes) {
     if (limit < 2) return 0;
     
     // Simple odd-only bit sieve for base primes
     size_t bit_count = (limit + 1) / 2;
     size_t byte_count = (bit_count + 7) / 8;
-    uint8_t sieve[byte_count];
+    sieve_arena *arena = arena_current();
+    arena_mark mark = arena_save(arena);
+    uint8_t *sieve = arena_alloc(arena, byte_count);
+    if (sieve == NULL) {
+        return SIEVE_ERROR;
+    }
     memset(sieve, 0xFF, byte_count);
     
     CLEAR_BIT(sieve, 0);  // 1 is not prime
@@ -131,45 +124,355 @@ static size_t find_base_primes(size_t limit, size_t *primes, size_t max_primes)
         }
     }
     
+    arena_restore(arena, mark);
     return count;
 }
 
-// Segmented sieve for large n
-static size_t sieve_segmented(size_t n, const char *output_file) {
-    if (n < 2) {
-        return 0;
+// Helper: base-prime table sized by max_prime_count(), taken from the arena
+size_t *arena_base_primes(sieve_arena *arena, size_t limit, size_t *count) {
+    STATS_BEGIN(SIEVE_PHASE_BASE_PRIMES);
+    size_t max_primes = max_prime_count(limit);
+    size_t *primes = arena_alloc(arena, max_primes * sizeof(size_t));
+    *count = (primes != NULL) ? find_base_primes(limit, primes, max_primes) : 0;
+    if (*count == SIEVE_ERROR) {
+        primes = NULL;                       // Table, but no bitmap to fill it from
+        *count = 0;
+    }
+    STATS_END(SIEVE_PHASE_BASE_PRIMES);
+    return primes;
+}
+
+// Helper: floor(sqrt(n)), exact even where double rounding is not
+size_t isqrt(size_t n) {
+    size_t r = (size_t)sqrt((double)n);
+    while (r > 0 && r > n / r) r--;               // r*r > n
+    while ((r + 1) <= n / (r + 1)) r++;           // (r+1)^2 <= n
+    return r;
+}
+
+// Helper: upper bound on pi(limit), used to size base-prime tables
+// (Rosser & Schoenfeld: pi(x) < 1.25506 x / ln x for x > 1)
+size_t max_prime_count(size_t limit) {
+    if (limit < 2) return 1;
+    return (size_t)(1.25506 * (double)limit / log((double)limit)) + 1;
+}
+
+// ============================================================================
+// PRE-SIEVE PATTERN: odd numbers with 3, 5, 7, 11 and 13 already removed
+// ============================================================================
+//
+// In the odd-only layout the multiples of 3*5*7*11*13 = 15015 repeat every
+// 15015 bits. Since gcd(8, 15015) = 1, a 15015-byte pattern holds 8 periods
+// and every bit phase starts at some byte, so initializing a segment is a
+// rotated memcpy instead of a memset followed by the five densest primes.
+
+#define PRESIEVE_MAX_PRIME 13
+#define PRESIEVE_PERIOD    15015           // Bits (and bytes) per pattern
+#define PRESIEVE_INV8      1877            // 8 * 1877 == 1 (mod 15015)
+
+static const uint8_t presieve_primes[] = { 3, 5, 7, 11, 13 };
+#define PRESIEVE_PRIME_COUNT (sizeof(presieve_primes) / sizeof(presieve_primes[0]))
+
+static uint8_t presieve_pattern[PRESIEVE_PERIOD];
+static pthread_once_t presieve_once = PTHREAD_ONCE_INIT;
+
+static void small_patterns_build(void);
+
+static void presieve_build(void) {
+    small_patterns_build();
+    memset(presieve_pattern, 0xFF, PRESIEVE_PERIOD);
+    
+    // Bit i represents odd number 2*i + 1, so odd multiples of p are p bits apart
+    for (size_t k = 0; k < PRESIEVE_PRIME_COUNT; k++) {
+        size_t p = presieve_primes[k];
+        for (size_t i = p / 2; i < PRESIEVE_PERIOD * 8; i += p) {
+            CLEAR_BIT(presieve_pattern, i);
+        }
+    }
+}
+
+// ---- Small-prime patterns: 17 .. 61 -----------------------------------------
+//
+// The small marking class. Primes up to 61 hit a 64-bit word at least once,
+// so crossing them off bit by bit is the costliest part of a segment. They
+// are paired so that each pair's multiples repeat every p*q bits; like the
+// main pattern, p*q bytes hold 8 periods starting at every bit phase. A
+// segment is ANDed with each rotated pair pattern: whole-word, branch-free
+// passes that the compiler vectorizes, with no per-multiple work at all.
+
+#define SMALL_MAX_PRIME    61
+#define SMALL_PATTERN_COUNT 6
+
+static const uint8_t small_pattern_primes[SMALL_PATTERN_COUNT][2] = {
+    { 17, 19 }, { 23, 29 }, { 31, 37 }, { 41, 43 }, { 47, 53 }, { 59, 61 }
+};
+
+typedef struct {
+    size_t period;                          // p*q bits (and bytes)
+    size_t inv8;                            // 8 * inv8 == 1 (mod period)
+    uint8_t *bytes;
+} small_pattern;
+
+static small_pattern small_patterns[SMALL_PATTERN_COUNT];
+static uint8_t small_pattern_storage[17*19 + 23*29 + 31*37 + 41*43 + 47*53 + 59*61];
+
+static void small_patterns_build(void) {
+    uint8_t *storage = small_pattern_storage;
+    for (size_t g = 0; g < SMALL_PATTERN_COUNT; g++) {
+        size_t p = small_pattern_primes[g][0];
+        size_t q = small_pattern_primes[g][1];
+        small_pattern *sp = &small_patterns[g];
+        sp->period = p * q;
+        sp->bytes = storage;
+        storage += sp->period;
+        
+        sp->inv8 = 1;
+        while ((8 * sp->inv8) % sp->period != 1) {
+            sp->inv8++;
+        }
+        memset(sp->bytes, 0xFF, sp->period);
+        for (size_t i = p / 2; i < sp->period * 8; i += p) {
+            CLEAR_BIT(sp->bytes, i);
+        }
+        for (size_t i = q / 2; i < sp->period * 8; i += q) {
+            CLEAR_BIT(sp->bytes, i);
+        }
+    }
+}
+
+// seg_sieve[0, byte_count) &= pattern rotated to bit phase `phase`
+static void pattern_and(uint8_t *restrict seg_sieve, const small_pattern *sp,
+                        size_t phase, size_t byte_count) {
+    size_t offset = (phase % sp->period) * sp->inv8 % sp->period;
+    for (size_t done = 0; done < byte_count; ) {
+        size_t chunk = sp->period - offset;
+        if (chunk > byte_count - done) {
+            chunk = byte_count - done;
+        }
+        const uint8_t *restrict src = sp->bytes + offset;
+        uint8_t *restrict dst = seg_sieve + done;
+        for (size_t i = 0; i < chunk; i++) {
+            dst[i] &= src[i];
+        }
+        done += chunk;
+        offset = 0;
     }
+}
+
+// Initialize odd_count bits for the odd numbers starting at first_odd, with
+// the multiples of every odd prime up to SMALL_MAX_PRIME already removed
+SIEVE_KERNEL
+static void presieve_fill(uint8_t *seg_sieve, uint64_t first_odd, size_t odd_count) {
+    pthread_once(&presieve_once, presieve_build);
     
-    // Phase 1: Find base primes up to sqrt(n)
-    size_t sqrt_n = (size_t)sqrt((double)n);
-    size_t max_base_primes = sqrt_n;  // Upper bound
-    size_t base_primes[max_base_primes];
-    size_t base_count = find_base_primes(sqrt_n, base_primes, max_base_primes);
+    // Byte k of the pattern starts at bit phase 8k mod 15015
+    size_t phase = (size_t)(((first_odd - 1) / 2) % PRESIEVE_PERIOD);
+    size_t offset = (phase * PRESIEVE_INV8) % PRESIEVE_PERIOD;
+    size_t byte_count = (odd_count + 7) / 8;
     
-    // Open output file if needed
-    FILE *fp = NULL;
-    if (output_file != NULL) {
-        fp = fopen(output_file, "w");
-        if (fp == NULL) {
-            fprintf(stderr, "Error: Could not open output file '%s'\n", output_file);
+    for (size_t filled = 0; filled < byte_count; ) {
+        size_t chunk = PRESIEVE_PERIOD - offset;
+        if (chunk > byte_count - filled) {
+            chunk = byte_count - filled;
         }
+        memcpy(seg_sieve + filled, presieve_pattern + offset, chunk);
+        filled += chunk;
+        offset = 0;
     }
     
-    size_t prime_count = 0;
+    for (size_t g = 0; g < SMALL_PATTERN_COUNT; g++) {
+        pattern_and(seg_sieve, &small_patterns[g], (size_t)((first_odd - 1) / 2), byte_count);
+    }
+    
+    // The patterns also removed the pre-sieved primes themselves
+    if (first_odd <= SMALL_MAX_PRIME) {
+        uint8_t removed[PRESIEVE_PRIME_COUNT + 2 * SMALL_PATTERN_COUNT];
+        memcpy(removed, presieve_primes, PRESIEVE_PRIME_COUNT);
+        memcpy(removed + PRESIEVE_PRIME_COUNT, small_pattern_primes, 2 * SMALL_PATTERN_COUNT);
+        for (size_t k = 0; k < sizeof(removed); k++) {
+            uint64_t p = removed[k];
+            if (p >= first_odd && (p - first_odd) / 2 < odd_count) {
+                SET_BIT(seg_sieve, (p - first_odd) / 2);
+            }
+        }
+    }
+}
+
+// Sieving state carried from one segment to the next (struct of arrays).
+// Bit i of a segment represents the odd number first_odd + 2*i, so
+// consecutive odd multiples of p are exactly p bits apart.
+typedef struct {
+    const size_t *primes;    // Odd base primes
+    uint64_t *next;          // Bit offset of each prime's next odd multiple,
+                             // relative to the start of the current segment
+    size_t count;
+} sieve_state;
+
+// Attach a state to the odd primes of a base-prime table, skipping 2 and
+// the primes that presieve_fill() already handles
+static void sieve_state_attach(sieve_state *st, const size_t *base_primes,
+                               size_t base_count, uint64_t *next) {
+    size_t skip = 0;
+    while (skip < base_count && base_primes[skip] <= SMALL_MAX_PRIME) {
+        skip++;
+    }
+    st->primes = base_primes + skip;
+    st->count = base_count - skip;
+    st->next = next;
+}
+
+// Position every prime at its first odd multiple >= max(first_odd, p*p).
+// This is the only place a division happens.
+static void sieve_state_init(sieve_state *st, size_t first_odd) {
+    for (size_t i = 0; i < st->count; i++) {
+        size_t p = st->primes[i];
+        
+        // Don't start before p*p (smaller multiples already marked by smaller
+        // primes). 128-bit math keeps this exact for first_odd near 2^64.
+        __uint128_t first_multiple = (__uint128_t)p * p;
+        if (first_multiple < first_odd) {
+            size_t r = first_odd % p;
+            first_multiple = (__uint128_t)first_odd + (r ? p - r : 0);
+            if (first_multiple % 2 == 0) {
+                first_multiple += p;
+            }
+        }
+        __uint128_t offset = (first_multiple - first_odd) / 2;
+        st->next[i] = (offset < UINT64_MAX) ? (uint64_t)offset : UINT64_MAX;
+    }
+}
+
+// ---- Marking kernels for the medium and large classes ----------------------
+//
+// Primes above SMALL_MAX_PRIME are sorted, so the state splits into two runs
+// and each run's kernel is picked once per segment, not per prime:
+//   medium (p < odd_count)    several hits per segment, 8 per iteration
+//   large  (p >= odd_count)   at most one hit per segment
+// The bucket sieve takes over large primes for very big n.
+//
+// After 8 hits a prime has advanced 8p bits = p bytes, so the byte offsets
+// and bit masks of the 8 hits depend only on p mod 8 and the start bit. The
+// 32 (p mod 8, start bit) combinations are generated as switch cases whose
+// offsets are k*(p/8) plus a constant and whose masks are immediates: the
+// unrolled loop does no shifting and checks its bound once per 8 hits.
+
+#define MARK_HIT(k, R, B) \
+    byte[(k) * q + (((B) + (k) * (R)) >> 3)] &= (uint8_t)~(1u << (((B) + (k) * (R)) & 7))
+
+#define MARK_CASE(R, B)                                                     \
+    case ((R) / 2) * 8 + (B):                                               \
+        for (; byte < unrolled_end; byte += p) {                            \
+            MARK_HIT(0, R, B); MARK_HIT(1, R, B); MARK_HIT(2, R, B);        \
+            MARK_HIT(3, R, B); MARK_HIT(4, R, B); MARK_HIT(5, R, B);        \
+            MARK_HIT(6, R, B); MARK_HIT(7, R, B);                           \
+        }                                                                   \
+        break;
+
+#define MARK_CASES(R) \
+    MARK_CASE(R, 0) MARK_CASE(R, 1) MARK_CASE(R, 2) MARK_CASE(R, 3) \
+    MARK_CASE(R, 4) MARK_CASE(R, 5) MARK_CASE(R, 6) MARK_CASE(R, 7)
+
+static void mark_medium(uint8_t *seg_sieve, size_t odd_count, size_t p, uint64_t *next) {
+    uint64_t j = *next;
+    if (j + 7 * p < odd_count) {
+        // Whole turns: the 8th hit of each lies inside the segment
+        uint64_t turns = (odd_count - 7 * p - j + 8 * p - 1) / (8 * p);
+        size_t q = p / 8;
+        uint8_t *byte = seg_sieve + j / 8;
+        uint8_t *unrolled_end = byte + turns * p;
+        switch ((p % 8 / 2) * 8 + j % 8) {
+            MARK_CASES(1) MARK_CASES(3) MARK_CASES(5) MARK_CASES(7)
+        }
+        j += turns * 8 * p;
+    }
+    for (; j < odd_count; j += p) {
+        CLEAR_BIT(seg_sieve, j);
+    }
+    *next = j;
+}
+
+// Cross off the multiples that fall in this segment; each next[] is left
+// pointing at the first multiple past the segment end
+SIEVE_KERNEL
+static void sieve_state_mark(sieve_state *st, uint8_t *seg_sieve, size_t odd_count) {
+    const size_t *primes = st->primes;
+    uint64_t *next = st->next;
+    
+    // Medium run: primes below odd_count
+    size_t lo = 0, hi = st->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (primes[mid] < odd_count) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for (size_t i = 0; i < lo; i++) {
+        mark_medium(seg_sieve, odd_count, primes[i], &next[i]);
+    }
     
-    // Output base primes (already found)
-    for (size_t i = 0; i < base_count; i++) {
-        prime_count++;
-        if (fp != NULL) {
-            fprintf(fp, "%zu\n", base_primes[i]);
+    for (size_t i = lo; i < st->count; i++) {
+        if (next[i] < odd_count) {
+            CLEAR_BIT(seg_sieve, next[i]);
+            next[i] += primes[i];
         }
     }
+}
+
+// Rebase offsets onto the following segment: a plain batch subtraction
+// with no loop-carried dependency, which the compiler vectorizes
+SIEVE_KERNEL
+static void sieve_state_advance(sieve_state *st, size_t odd_count) {
+    uint64_t *restrict next = st->next;
+    size_t count = st->count;
+    for (size_t i = 0; i < count; i++) {
+        next[i] -= odd_count;
+    }
+}
+
+// Count set bits (primes) in a segment of odd_count odd numbers
+static size_t count_segment(const uint8_t *seg_sieve, size_t odd_count) {
+    return popcount_bits(seg_sieve, odd_count);
+}
+
+// Segmented sieve of [1, n] over caller-provided tables: base_primes holds
+// exactly the primes up to sqrt(n), next_multiple has base_count + 1 slots
+// and seg_sieve holds segment_size / 2 bits. With a checkpoint, the run is
+// saved at segment boundaries and a state with next_low set resumes there.
+static size_t segmented_run(size_t n, prime_writer *w, const size_t *base_primes,
+                            size_t base_count, uint64_t *next_multiple,
+                            uint8_t *seg_sieve, size_t segment_size,
+                            segment_checkpoint *cp) {
+    size_t sqrt_n = isqrt(n);
+    sieve_state state;
+    sieve_state_attach(&state, base_primes, base_count, next_multiple);
     
-    // Phase 2: Process segments from sqrt(n)+1 to n
+    size_t prime_count = 0;
     size_t segment_low = sqrt_n + 1;
+    int resumed = (cp != NULL && cp->state.next_low > segment_low);
+    
+    // Output base primes (already found), unless they precede the resume point
+    if (resumed) {
+        segment_low = (size_t)cp->state.next_low;
+        prime_count = (size_t)cp->state.prime_count;
+    } else {
+        prime_count += base_count;
+    }
+    if (w != NULL && !resumed) {
+        STATS_BEGIN(SIEVE_PHASE_OUTPUT);
+        for (size_t i = 0; i < base_count; i++) {
+            prime_writer_put(w, base_primes[i]);
+        }
+        STATS_END(SIEVE_PHASE_OUTPUT);
+    }
+    
+    // Phase 2: Process segments from sqrt(n)+1 to n. Segments are
+    // contiguous, so the state only needs dividing into once.
+    sieve_state_init(&state, (segment_low % 2 == 0) ? segment_low + 1 : segment_low);
     
     while (segment_low <= n) {
-        size_t segment_high = segment_low + SEGMENT_SIZE - 1;
+        size_t segment_high = segment_low + segment_size - 1;
         if (segment_high > n) {
             segment_high = n;
         }
@@ -177,75 +480,1708 @@ static size_t sieve_segmented(size_t n, const char *output_file) {
         // Calculate first odd in segment and count
         size_t first_odd = (segment_low % 2 == 0) ? segment_low + 1 : segment_low;
         size_t last_odd = (segment_high % 2 == 0) ? segment_high - 1 : segment_high;
+        if (first_odd > last_odd) {
+            break;  // Final segment holds a single even number
+        }
         size_t odd_count = (last_odd - first_odd) / 2 + 1;
-        size_t byte_count = (odd_count + 7) / 8;
-        
-        uint8_t seg_sieve[byte_count];
-        memset(seg_sieve, 0xFF, byte_count);
         
-        // Mark composites using base primes
-        for (size_t i = 0; i < base_count; i++) {
-            size_t p = base_primes[i];
-            
-            if (p == 2) continue;  // We only store odds
-            
-            // Find first odd multiple of p in [first_odd, last_odd]
-            size_t first_multiple = ((first_odd + p - 1) / p) * p;
-            if (first_multiple % 2 == 0) {
-                first_multiple += p;
-            }
-            
-            // Don't start before p*p (smaller multiples already marked by smaller primes)
-            if (first_multiple < p * p) {
-                first_multiple = p * p;
-                if (first_multiple % 2 == 0) {
-                    first_multiple += p;
-                }
-            }
-            
-            // Mark all odd multiples in segment
-            for (size_t multiple = first_multiple; multiple <= last_odd; multiple += 2*p) {
-                if (multiple >= first_odd) {
-                    size_t local_idx = (multiple - first_odd) / 2;
-                    if (local_idx < odd_count) {
-                        CLEAR_BIT(seg_sieve, local_idx);
-                    }
-                }
-            }
-        }
+        STATS_BEGIN(SIEVE_PHASE_SEGMENT_INIT);
+        presieve_fill(seg_sieve, first_odd, odd_count);
+        STATS_END(SIEVE_PHASE_SEGMENT_INIT);
+        STATS_BEGIN(SIEVE_PHASE_MARK);
+        sieve_state_mark(&state, seg_sieve, odd_count);
+        sieve_state_advance(&state, odd_count);
+        STATS_END(SIEVE_PHASE_MARK);
         
         // Count and output primes in segment
-        for (size_t i = 0; i < odd_count; i++) {
-            if (GET_BIT(seg_sieve, i)) {
-                size_t prime = first_odd + 2*i;
-                prime_count++;
-                if (fp != NULL) {
-                    fprintf(fp, "%zu\n", prime);
-                }
-            }
+        STATS_BEGIN(SIEVE_PHASE_COUNT);
+        prime_count += count_segment(seg_sieve, odd_count);
+        STATS_END(SIEVE_PHASE_COUNT);
+        if (w != NULL) {
+            STATS_BEGIN(SIEVE_PHASE_OUTPUT);
+            prime_writer_put_segment(w, seg_sieve, first_odd, odd_count);
+            STATS_END(SIEVE_PHASE_OUTPUT);
         }
         
         segment_low = segment_high + 1;
+        if (cp != NULL && segment_low <= n) {
+            checkpoint_segment(cp, w, segment_low, prime_count);
+        }
+    }
+    
+    return prime_count;
+}
+
+// Segmented sieve for large n
+static size_t sieve_segmented(size_t n, prime_writer *w) {
+    if (n < 4) {
+        return sieve_simple(n, w);  // sqrt(n) < 2 leaves no base primes to start from
     }
     
-    if (fp != NULL) {
-        fclose(fp);
+    // Phase 1: Find base primes up to sqrt(n)
+    size_t segment_size = sieve_get_config()->segment_size;
+    size_t base_count;
+    sieve_arena *arena = arena_current();
+    arena_mark mark = arena_save(arena);
+    size_t *base_primes = arena_base_primes(arena, isqrt(n), &base_count);
+    uint64_t *next_multiple = arena_alloc(arena, (base_count + 1) * sizeof(uint64_t));
+    uint8_t *seg_sieve = arena_alloc(arena, (segment_size / 2 + 7) / 8);
+    if (base_primes == NULL || next_multiple == NULL || seg_sieve == NULL) {
+        arena_restore(arena, mark);
+        return SIEVE_ERROR;
     }
     
+    // Phase 2: Segments from sqrt(n)+1 to n
+    size_t prime_count = segmented_run(n, w, base_primes, base_count, next_multiple,
+                                       seg_sieve, segment_size, NULL);
+    arena_restore(arena, mark);
     return prime_count;
 }
 
 // ============================================================================
-// Main dispatcher
+// BUCKET SIEVE for very large n (Oliveira e Silva)
 // ============================================================================
+//
+// Once sqrt(n) is much larger than a segment, most base primes have at most
+// one multiple per segment, yet sieve_segmented() still visits every one of
+// them (with a division) in every segment. Here those large primes live in
+// a ring of per-segment buckets: each entry stores the prime and the offset
+// of its next multiple, and sits in the bucket of the segment that multiple
+// falls into. A segment only touches the entries in its own bucket.
+//
+// Segments are aligned to multiples of the (even) segment size starting at
+// 0, so bit b of segment k is the odd number k*segment_size + 2*b + 1.
 
-#define THRESHOLD 10000000  // 10 million
+#define BUCKET_CHUNK 1024                   // Entries per bucket chunk
+#define BUCKET_NONE  UINT32_MAX
 
-size_t sieve_of_eratosthenes(size_t n, const char *output_file) {
-    if (n < THRESHOLD) {
-        return sieve_simple(n, output_file);
-    } else {
-        return sieve_segmented(n, output_file);
+typedef struct {
+    uint32_t prime;
+    uint32_t offset;                        // Bit index inside the target segment
+} bucket_entry;
+
+typedef struct {
+    bucket_entry entries[BUCKET_CHUNK];
+    uint32_t count;
+    uint32_t next;                          // Next chunk in this bucket (or free list)
+} bucket_chunk;
+
+typedef struct {
+    bucket_chunk *chunks;                   // Shared chunk pool
+    uint32_t free_head;
+    uint32_t *heads;                        // First chunk of each bucket
+    size_t bucket_count;
+    size_t segment_bits;                    // Odd numbers per segment
+} bucket_ring;
+
+static void bucket_push(bucket_ring *ring, size_t bucket, uint32_t prime, uint32_t offset) {
+    uint32_t head = ring->heads[bucket];
+    
+    if (head == BUCKET_NONE || ring->chunks[head].count == BUCKET_CHUNK) {
+        // Start a new chunk from the free list
+        uint32_t fresh = ring->free_head;
+        ring->free_head = ring->chunks[fresh].next;
+        ring->chunks[fresh].count = 0;
+        ring->chunks[fresh].next = head;
+        ring->heads[bucket] = fresh;
+        head = fresh;
+    }
+    
+    bucket_chunk *chunk = &ring->chunks[head];
+    chunk->entries[chunk->count++] = (bucket_entry){ prime, offset };
+}
+
+// Cross off every bucketed multiple in segment k and re-file each prime
+// under the segment of its following multiple
+static void bucket_mark_segment(bucket_ring *ring, size_t segment, uint8_t *seg_sieve) {
+    size_t bucket = segment % ring->bucket_count;
+    uint32_t head = ring->heads[bucket];
+    ring->heads[bucket] = BUCKET_NONE;
+    
+    while (head != BUCKET_NONE) {
+        bucket_chunk *chunk = &ring->chunks[head];
+        
+        for (uint32_t e = 0; e < chunk->count; e++) {
+            uint32_t p = chunk->entries[e].prime;
+            uint64_t offset = chunk->entries[e].offset;
+            CLEAR_BIT(seg_sieve, offset);
+            
+            // Odd multiples of p are p bits apart; p >= segment_bits so
+            // the next one is always in a later segment
+            offset += p;
+            size_t ahead = (size_t)(offset / ring->segment_bits);
+            bucket_push(ring, (segment + ahead) % ring->bucket_count,
+                        p, (uint32_t)(offset % ring->segment_bits));
+        }
+        
+        // Return the drained chunk to the pool
+        uint32_t next = chunk->next;
+        chunk->next = ring->free_head;
+        ring->free_head = head;
+        head = next;
+    }
+}
+
+static size_t sieve_bucket(size_t n, prime_writer *w) {
+    if (n < 2) {
+        return 0;
+    }
+    
+    // Phase 1: Base primes up to sqrt(n), split into segment-sieved
+    // primes (several hits per segment) and bucketed primes (at most one)
+    size_t sqrt_n = isqrt(n);
+    size_t segment_size = sieve_get_config()->segment_size;
+    size_t segment_bits = segment_size / 2;
+    size_t base_count;
+    sieve_arena *arena = arena_current();
+    arena_mark mark = arena_save(arena);
+    size_t *base_primes = arena_base_primes(arena, sqrt_n, &base_count);
+    if (base_primes == NULL) {
+        arena_restore(arena, mark);
+        return SIEVE_ERROR;
+    }
+    
+    size_t small_count = 0;
+    while (small_count < base_count && base_primes[small_count] < segment_bits) {
+        small_count++;
+    }
+    size_t large_count = base_count - small_count;
+    
+    // Ring of buckets: a multiple is at most sqrt(n) bits past the current
+    // segment, so this many buckets never wrap onto a live one
+    size_t bucket_count = sqrt_n / segment_bits + 2;
+    size_t chunk_count = large_count / BUCKET_CHUNK + bucket_count + 2;
+    uint64_t *next_multiple = arena_alloc(arena, (small_count + 1) * sizeof(uint64_t));
+    bucket_chunk *chunks = arena_alloc(arena, chunk_count * sizeof(bucket_chunk));
+    uint32_t *heads = arena_alloc(arena, bucket_count * sizeof(uint32_t));
+    uint8_t *seg_sieve = arena_alloc(arena, (segment_bits + 7) / 8);
+    if (next_multiple == NULL || chunks == NULL || heads == NULL || seg_sieve == NULL) {
+        arena_restore(arena, mark);
+        return SIEVE_ERROR;
+    }
+    
+    sieve_state state;
+    sieve_state_attach(&state, base_primes, small_count, next_multiple);
+    sieve_state_init(&state, 1);
+    
+    bucket_ring ring = { .chunks = chunks, .free_head = 0, .heads = heads,
+                         .bucket_count = bucket_count, .segment_bits = segment_bits };
+    for (size_t c = 0; c < chunk_count; c++) {
+        chunks[c].next = (c + 1 < chunk_count) ? (uint32_t)(c + 1) : BUCKET_NONE;
+    }
+    for (size_t b = 0; b < bucket_count; b++) {
+        heads[b] = BUCKET_NONE;
+    }
+    
+    // Special case: 2 is the only even prime
+    size_t prime_count = 1;
+    if (w != NULL) {
+        prime_writer_put(w, 2);
+    }
+    
+    // Phase 2: Process aligned segments, adding each large prime to the
+    // buckets once its square reaches the current segment
+    size_t next_large = small_count;
+    size_t last_segment = n / segment_size;
+    
+    for (size_t segment = 0; segment <= last_segment; segment++) {
+        size_t segment_low = segment * segment_size;
+        size_t first_odd = segment_low + 1;
+        size_t last_odd = (n % 2 == 0) ? n - 1 : n;
+        if (segment < last_segment) {
+            last_odd = segment_low + segment_size - 1;
+        }
+        if (first_odd > last_odd) {
+            break;  // Final segment holds a single even number
+        }
+        size_t odd_count = (last_odd - first_odd) / 2 + 1;
+        
+        // Primes below segment_bits hit this segment many times
+        STATS_BEGIN(SIEVE_PHASE_SEGMENT_INIT);
+        presieve_fill(seg_sieve, first_odd, segment_bits);
+        STATS_END(SIEVE_PHASE_SEGMENT_INIT);
+        STATS_BEGIN(SIEVE_PHASE_MARK);
+        sieve_state_mark(&state, seg_sieve, segment_bits);
+        sieve_state_advance(&state, segment_bits);
+        
+        while (next_large < base_count &&
+               base_primes[next_large] * base_primes[next_large] <= last_odd) {
+            size_t p = base_primes[next_large++];
+            bucket_push(&ring, segment % bucket_count, (uint32_t)p,
+                        (uint32_t)((p * p - first_odd) / 2));
+        }
+        if (large_count > 0) {
+            bucket_mark_segment(&ring, segment, seg_sieve);
+        }
+        STATS_END(SIEVE_PHASE_MARK);
+        
+        if (segment == 0) {
+            CLEAR_BIT(seg_sieve, 0);  // 1 is not prime
+        }
+        
+        // Count and output primes in segment
+        STATS_BEGIN(SIEVE_PHASE_COUNT);
+        prime_count += count_segment(seg_sieve, odd_count);
+        STATS_END(SIEVE_PHASE_COUNT);
+        if (w != NULL) {
+            STATS_BEGIN(SIEVE_PHASE_OUTPUT);
+            prime_writer_put_segment(w, seg_sieve, first_odd, odd_count);
+            STATS_END(SIEVE_PHASE_OUTPUT);
+        }
+    }
+    
+    arena_restore(arena, mark);
+    return prime_count;
+}
+
+// ============================================================================
+// PARALLEL SEGMENTED SIEVE (count only)
+// ============================================================================
+
+// Work-stealing scheduler: each worker owns a deque of pending segment
+// indices [next, end), packed into one 64-bit word so that the owner's pop
+// from the front and a thief's steal from the back are both a single CAS.
+typedef struct {
+    _Atomic uint64_t range;                 // (end << 32) | next
+    char pad[64 - sizeof(uint64_t)];        // One deque per cache line
+} segment_deque;
+
+#define DEQUE_PACK(next, end) (((uint64_t)(end) << 32) | (uint64_t)(next))
+#define DEQUE_NEXT(r)         ((uint32_t)(r))
+#define DEQUE_END(r)          ((uint32_t)((r) >> 32))
+
+typedef struct parallel_job parallel_job;
+
+typedef struct {
+    parallel_job *job;
+    size_t id;
+    size_t prime_count;                     // Per-thread partial count
+    size_t tasks;                           // Tasks this worker counted
+    pthread_t thread;
+} parallel_worker;
+
+struct parallel_job {
+    const size_t *base_primes;              // Shared, read-only
+    size_t base_count;
+    size_t start;                           // First number covered by task 0
+    size_t n;
+    size_t segment_size;
+    size_t task_span;                       // Numbers per task (multiple of segment_size)
+    size_t nthreads;
+    segment_deque *deques;
+};
+
+// Owner side: take the lowest pending task
+static int deque_pop(segment_deque *dq, uint32_t *task) {
+    uint64_t r = atomic_load_explicit(&dq->range, memory_order_acquire);
+    while (DEQUE_NEXT(r) < DEQUE_END(r)) {
+        uint64_t taken = DEQUE_PACK(DEQUE_NEXT(r) + 1, DEQUE_END(r));
+        if (atomic_compare_exchange_weak_explicit(&dq->range, &r, taken,
+                memory_order_acq_rel, memory_order_acquire)) {
+            *task = DEQUE_NEXT(r);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Thief side: take the upper half of the victim's pending tasks
+static int deque_steal(segment_deque *dq, uint32_t *lo, uint32_t *hi) {
+    uint64_t r = atomic_load_explicit(&dq->range, memory_order_acquire);
+    while (DEQUE_NEXT(r) < DEQUE_END(r)) {
+        uint32_t remaining = DEQUE_END(r) - DEQUE_NEXT(r);
+        uint32_t mid = DEQUE_END(r) - (remaining + 1) / 2;
+        uint64_t left = DEQUE_PACK(DEQUE_NEXT(r), mid);
+        if (atomic_compare_exchange_weak_explicit(&dq->range, &r, left,
+                memory_order_acq_rel, memory_order_acquire)) {
+            *lo = mid;
+            *hi = DEQUE_END(r);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Per-thread sieving state: positioned for the segment starting at
+// resume_odd, which is where the worker's previous task ended
+typedef struct {
+    sieve_state state;
+    size_t resume_odd;                      // 0 = state not positioned yet
+} worker_state;
+
+// Sieve and count every segment of one task, reusing the worker's buffer
+static size_t count_task(const parallel_job *job, uint32_t task,
+                         worker_state *ws, uint8_t *seg_sieve) {
+    size_t count = 0;
+    size_t task_low = job->start + (size_t)task * job->task_span;
+    size_t task_high = (job->n - task_low < job->task_span) ? job->n
+                                                            : task_low + job->task_span - 1;
+    
+    size_t segment_size = job->segment_size;
+    
+    for (size_t segment_low = task_low; segment_low <= task_high; segment_low += segment_size) {
+        size_t segment_high = (task_high - segment_low < segment_size) ? task_high
+                                                                       : segment_low + segment_size - 1;
+        size_t first_odd = (segment_low % 2 == 0) ? segment_low + 1 : segment_low;
+        size_t last_odd = (segment_high % 2 == 0) ? segment_high - 1 : segment_high;
+        if (first_odd > last_odd) {
+            break;
+        }
+        size_t odd_count = (last_odd - first_odd) / 2 + 1;
+        
+        // Consecutive tasks continue the carried state; only a jump
+        // (a fresh or stolen range) pays for the divisions again
+        if (ws->resume_odd != first_odd) {
+            sieve_state_init(&ws->state, first_odd);
+        }
+        presieve_fill(seg_sieve, first_odd, odd_count);
+        sieve_state_mark(&ws->state, seg_sieve, odd_count);
+        sieve_state_advance(&ws->state, odd_count);
+        ws->resume_odd = last_odd + 2;
+        
+        count += count_segment(seg_sieve, odd_count);
+        
+        if (segment_high == task_high) {
+            break;  // Avoid wrapping past SIZE_MAX
+        }
+    }
+    return count;
+}
+
+static void *parallel_worker_main(void *arg) {
+    parallel_worker *self = arg;
+    const parallel_job *job = self->job;
+    segment_deque *own = &job->deques[self->id];
+    
+    // Per-thread segment buffer and sieving state, reused for every
+    // segment this worker sieves. They come from the caller's arena for
+    // worker 0 and from a pooled one for spawned threads, so the pages are
+    // first touched (and placed) by the thread using them and stay mapped
+    // for the next call.
+    sieve_arena *arena = (self->id == 0) ? arena_current() : arena_pool_take();
+    arena_mark mark = arena_save(arena);
+    uint8_t *seg_sieve = arena_alloc(arena, (job->segment_size / 2 + 7) / 8);
+    uint64_t *next_multiple = arena_alloc(arena, (job->base_count + 1) * sizeof(uint64_t));
+    worker_state ws = { .resume_odd = 0 };
+    sieve_state_attach(&ws.state, job->base_primes, job->base_count, next_multiple);
+    size_t count = 0;
+    size_t tasks = 0;
+    
+    // Without buffers this worker takes no tasks; the others steal them
+    while (seg_sieve != NULL && next_multiple != NULL) {
+        uint32_t task;
+        if (deque_pop(own, &task)) {
+            count += count_task(job, task, &ws, seg_sieve);
+            tasks++;
+            continue;
+        }
+        
+        // Own deque is empty: steal half of some other worker's backlog.
+        // Nobody pushes new work, so one failed pass means we are done.
+        int stole = 0;
+        for (size_t k = 1; k < job->nthreads && !stole; k++) {
+            uint32_t lo, hi;
+            size_t victim = (self->id + k) % job->nthreads;
+            if (deque_steal(&job->deques[victim], &lo, &hi)) {
+                atomic_store_explicit(&own->range, DEQUE_PACK(lo + 1, hi), memory_order_release);
+                count += count_task(job, lo, &ws, seg_sieve);
+                tasks++;
+                stole = 1;
+            }
+        }
+        if (!stole) {
+            break;
+        }
+    }
+    
+    arena_restore(arena, mark);
+    if (self->id != 0) {
+        arena_pool_give(arena);
+    }
+    self->prime_count = count;
+    self->tasks = tasks;
+    return NULL;
+}
+
+size_t sieve_count_parallel(size_t n, size_t nthreads) {
+    if (n < 4) {
+        return sieve_simple(n, NULL);  // Odd-only segments cannot hold the prime 2
+    }
+    if (nthreads == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = (online > 0) ? (size_t)online : 1;
+    }
+    
+    // Phase 1: Base primes up to sqrt(n), shared by all workers
+    size_t sqrt_n = isqrt(n);
+    size_t segment_size = sieve_get_config()->segment_size;
+    size_t base_count;
+    sieve_arena *arena = arena_current();
+    arena_mark mark = arena_save(arena);
+    size_t *base_primes = arena_base_primes(arena, sqrt_n, &base_count);
+    
+    size_t start = sqrt_n + 1;
+    if (base_primes == NULL || start > n) {
+        arena_restore(arena, mark);
+        return (base_primes != NULL) ? base_count : SIEVE_ERROR;
+    }
+    
+    // Phase 2: Split [sqrt(n)+1, n] into tasks of whole segments. A task is
+    // normally one segment; it only grows when the index would overflow 32 bits.
+    size_t segment_total = (n - start) / segment_size + 1;
+    size_t segments_per_task = segment_total / UINT32_MAX + 1;
+    size_t task_span = segments_per_task * segment_size;
+    size_t task_count = (n - start) / task_span + 1;
+    if (nthreads > task_count) {
+        nthreads = task_count;
+    }
+    
+    segment_deque *deques = arena_alloc(arena, nthreads * sizeof(segment_deque));
+    parallel_worker *workers = arena_alloc(arena, nthreads * sizeof(parallel_worker));
+    if (deques == NULL || workers == NULL) {
+        arena_restore(arena, mark);
+        return SIEVE_ERROR;
+    }
+    parallel_job job = {
+        .base_primes = base_primes,
+        .base_count = base_count,
+        .start = start,
+        .n = n,
+        .segment_size = segment_size,
+        .task_span = task_span,
+        .nthreads = nthreads,
+        .deques = deques,
+    };
+    
+    // Seed each deque with a contiguous block; stealing rebalances the rest
+    for (size_t t = 0; t < nthreads; t++) {
+        uint32_t lo = (uint32_t)(task_count * t / nthreads);
+        uint32_t hi = (uint32_t)(task_count * (t + 1) / nthreads);
+        atomic_init(&deques[t].range, DEQUE_PACK(lo, hi));
+        workers[t] = (parallel_worker){ .job = &job, .id = t };
+    }
+    
+    // Worker 0 runs on the calling thread
+    size_t spawned = 1;
+    for (size_t t = 1; t < nthreads; t++, spawned++) {
+        if (pthread_create(&workers[t].thread, NULL, parallel_worker_main, &workers[t]) != 0) {
+            break;  // Remaining deques get stolen by the threads we do have
+        }
+    }
+    parallel_worker_main(&workers[0]);
+    
+    // Reduce per-thread counts. Tasks are only left over if no worker at
+    // all got its buffers.
+    size_t prime_count = base_count + workers[0].prime_count;
+    size_t tasks_done = workers[0].tasks;
+    for (size_t t = 1; t < spawned; t++) {
+        pthread_join(workers[t].thread, NULL);
+        prime_count += workers[t].prime_count;
+        tasks_done += workers[t].tasks;
     }
+    
+    arena_restore(arena, mark);
+    return (tasks_done == task_count) ? prime_count : SIEVE_ERROR;
 }
 
+// ============================================================================
+// PARALLEL OUTPUT: workers sieve and format segments, written in order
+// ============================================================================
+//
+// Workers claim segments in increasing order from a shared counter, sieve
+// each into a private bitmap and hand it on according to the format:
+//   TEXT, VARINT  format into ring slot k % ring_size; the writer (calling
+//                 thread) collects consecutive finished slots in segment
+//                 order and writes them with a single pwritev()
+//   U32, U64      wait only for the running prime count of segments < k,
+//                 published in segment order, then format privately and
+//                 pwrite() at count * width
+//   BITMAP        pwrite() the segment's bitmap bytes at a fixed offset
+// Segments start at multiples of the span, itself a multiple of 128, so
+// each begins on a bitmap byte and a 64-bit sieve word. A varint slot
+// starts with its first prime as an absolute value; the writer, which knows
+// the previous segment's last prime, swaps in the real gap via one iovec.
+
+#define OUTPUT_SPAN_MAX        ((size_t)1 << 21)  // Numbers per output segment
+#define OUTPUT_RING_PER_THREAD 2                  // Ring slots per worker
+#define OUTPUT_IOV_MAX         64                 // iovecs per pwritev()
+
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    uint64_t first_prime;                   // 0 = no prime in the segment
+    uint64_t last_prime;
+    uint64_t segment;                       // Segment held while ready
+    int ready;
+} output_slot;
+
+typedef struct {
+    const size_t *base_primes;              // Shared, read-only
+    size_t base_count;
+    size_t n;
+    size_t span;
+    uint64_t segment_count;
+    sieve_format format;
+    int fd;
+    size_t buffer_bytes;                    // Formatted size bound of a segment
+    _Atomic uint64_t next_segment;          // Claim counter
+    _Atomic int error;
+    
+    // Everything below is guarded by lock; any change broadcasts `changed`
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    output_slot *slots;                     // TEXT / VARINT ring
+    size_t ring_size;
+    uint64_t written;                       // Segments the writer is done with
+    uint64_t counted;                       // U32 / U64: segments in the prefix
+    uint64_t primes_before;                 // U32 / U64: primes in those segments
+} output_job;
+
+typedef struct {
+    output_job *job;
+    uint8_t *bits;                          // Segment bitmap
+    uint64_t *next_multiple;                // Sieving state
+    uint8_t *format_buf;                    // U32 / U64 formatting
+    size_t prime_count;
+    pthread_t thread;
+} output_worker;
+
+static void output_error(output_job *job, const char *what) {
+    if (atomic_exchange(&job->error, 1) == 0) {
+        fprintf(stderr, "Error: %s to output file failed: %s\n", what, strerror(errno));
+    }
+}
+
+static void output_pwrite(output_job *job, const uint8_t *buf, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t r = pwrite(job->fd, buf, len, (off_t)offset);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            output_error(job, "Write");
+            return;
+        }
+        buf += r;
+        len -= (size_t)r;
+        offset += (uint64_t)r;
+    }
+}
+
+// Write all of iov[0, count) at offset, resuming after short writes
+static void output_pwritev(output_job *job, struct iovec *iov, int count, uint64_t offset) {
+    while (count > 0) {
+        ssize_t r = pwritev(job->fd, iov, count, (off_t)offset);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            output_error(job, "Write");
+            return;
+        }
+        offset += (uint64_t)r;
+        size_t done = (size_t)r;
+        while (count > 0 && done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+}
+
+// Encode v as a LEB128 varint; returns its length
+static size_t output_varint(uint8_t *out, uint64_t v) {
+    size_t len = 0;
+    while (v >= 0x80) {
+        out[len++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[len++] = (uint8_t)v;
+    return len;
+}
+
+// Format segment k (primes 2 and up for k == 0) into out
+static size_t output_format(const output_job *job, uint64_t k, const uint8_t *bits,
+                            uint64_t first_odd, size_t odd_count, uint8_t *out) {
+    uint64_t last_prime = 0;
+    size_t len = 0;
+    if (k == 0) {
+        len = format_prime(out, job->format, 2, &last_prime);
+    }
+    return len + format_segment(out + len, job->format, bits, first_odd, odd_count, &last_prime);
+}
+
+// First and last prime of segment k, which holds at least one
+static void output_bounds(uint64_t k, const uint8_t *bits, uint64_t first_odd,
+                          size_t odd_count, uint64_t *first, uint64_t *last) {
+    size_t words = (odd_count + 63) / 64;
+    size_t w = 0;
+    uint64_t word = 0;
+    while (w < words && (word = segment_word(bits, odd_count, w)) == 0) {
+        w++;
+    }
+    if (w == words) {
+        *first = *last = 2;                  // Segment 0 holding only the prime 2
+        return;
+    }
+    *first = (k == 0) ? 2 : first_odd + 128 * (uint64_t)w + 2 * (uint64_t)__builtin_ctzll(word);
+    w = words - 1;
+    while ((word = segment_word(bits, odd_count, w)) == 0) {
+        w--;
+    }
+    *last = first_odd + 128 * (uint64_t)w + 2 * (uint64_t)(63 - __builtin_clzll(word));
+}
+
+static void output_handoff(output_job *job, uint64_t k, const uint8_t *bits,
+                           uint64_t first_odd, size_t odd_count, size_t count,
+                           uint8_t *private_buf) {
+    switch (job->format) {
+    case SIEVE_FORMAT_BITMAP: {
+        size_t bytes = (odd_count + 7) / 8;
+        output_pwrite(job, bits, bytes, (first_odd - 1) / 16);
+        break;
+    }
+    case SIEVE_FORMAT_U32:
+    case SIEVE_FORMAT_U64: {
+        pthread_mutex_lock(&job->lock);
+        while (job->counted != k) {
+            pthread_cond_wait(&job->changed, &job->lock);
+        }
+        uint64_t before = job->primes_before;
+        job->primes_before += count;
+        job->counted++;
+        pthread_cond_broadcast(&job->changed);
+        pthread_mutex_unlock(&job->lock);
+        
+        size_t width = (job->format == SIEVE_FORMAT_U32) ? sizeof(uint32_t) : sizeof(uint64_t);
+        size_t len = output_format(job, k, bits, first_odd, odd_count, private_buf);
+        output_pwrite(job, private_buf, len, before * width);
+        break;
+    }
+    default: {
+        output_slot *slot = &job->slots[k % job->ring_size];
+        pthread_mutex_lock(&job->lock);
+        while (k >= job->written + job->ring_size) {
+            pthread_cond_wait(&job->changed, &job->lock);
+        }
+        pthread_mutex_unlock(&job->lock);
+        
+        // Free slot: only this worker touches it until it is marked ready
+        slot->len = output_format(job, k, bits, first_odd, odd_count, slot->buf);
+        slot->first_prime = 0;
+        slot->last_prime = 0;
+        if (count != 0) {
+            output_bounds(k, bits, first_odd, odd_count, &slot->first_prime, &slot->last_prime);
+        }
+        
+        pthread_mutex_lock(&job->lock);
+        slot->segment = k;
+        slot->ready = 1;
+        pthread_cond_broadcast(&job->changed);
+        pthread_mutex_unlock(&job->lock);
+        break;
+    }
+    }
+}
+
+static void *output_worker_main(void *arg) {
+    output_worker *self = arg;
+    output_job *job = self->job;
+    worker_state ws = { .resume_odd = 0 };
+    sieve_state_attach(&ws.state, job->base_primes, job->base_count, self->next_multiple);
+    size_t count = 0;
+    
+    for (;;) {
+        uint64_t k = atomic_fetch_add(&job->next_segment, 1);
+        if (k >= job->segment_count) {
+            break;
+        }
+        uint64_t low = k * job->span;
+        uint64_t high = (job->n - low < job->span) ? job->n : low + job->span - 1;
+        uint64_t first_odd = low + 1;
+        uint64_t last_odd = (high % 2 == 0) ? high - 1 : high;
+        size_t odd_count = (size_t)((last_odd - first_odd) / 2 + 1);
+        uint8_t *bits = self->bits;
+        
+        if (ws.resume_odd != first_odd) {
+            sieve_state_init(&ws.state, first_odd);
+        }
+        presieve_fill(bits, first_odd, odd_count);
+        sieve_state_mark(&ws.state, bits, odd_count);
+        sieve_state_advance(&ws.state, odd_count);
+        ws.resume_odd = last_odd + 2;
+        if (k == 0) {
+            CLEAR_BIT(bits, 0);                  // The number 1
+        }
+        if (odd_count % 8 != 0) {
+            bits[odd_count / 8] &= (uint8_t)((1u << (odd_count % 8)) - 1);
+        }
+        
+        size_t segment_primes = count_segment(bits, odd_count) + (k == 0);
+        count += segment_primes;
+        output_handoff(job, k, bits, first_odd, odd_count, segment_primes, self->format_buf);
+    }
+    
+    self->prime_count = count;
+    return NULL;
+}
+
+// Writer side for TEXT / VARINT: pwritev() runs of finished slots in order
+static void output_writer_run(output_job *job) {
+    struct iovec iov[OUTPUT_IOV_MAX];
+    uint8_t gaps[OUTPUT_IOV_MAX / 2][10];
+    uint64_t offset = 0;
+    uint64_t last_prime = 0;
+    uint64_t written = 0;
+    
+    while (written < job->segment_count) {
+        size_t run = 0;
+        pthread_mutex_lock(&job->lock);
+        for (;;) {
+            while (run < OUTPUT_IOV_MAX / 2 && run < job->ring_size &&
+                   written + run < job->segment_count) {
+                const output_slot *slot = &job->slots[(written + run) % job->ring_size];
+                if (!slot->ready || slot->segment != written + run) {
+                    break;
+                }
+                run++;
+            }
+            if (run > 0) {
+                break;
+            }
+            pthread_cond_wait(&job->changed, &job->lock);
+        }
+        pthread_mutex_unlock(&job->lock);
+        
+        int iov_count = 0;
+        size_t total = 0;
+        for (size_t r = 0; r < run; r++) {
+            output_slot *slot = &job->slots[(written + r) % job->ring_size];
+            uint8_t *data = slot->buf;
+            size_t len = slot->len;
+            if (job->format == SIEVE_FORMAT_VARINT && slot->first_prime != 0) {
+                // The slot opens with varint(first_prime): swap in the gap
+                size_t absolute = output_varint(gaps[r], slot->first_prime);
+                size_t gap = output_varint(gaps[r], slot->first_prime - last_prime);
+                iov[iov_count++] = (struct iovec){ .iov_base = gaps[r], .iov_len = gap };
+                total += gap;
+                data += absolute;
+                len -= absolute;
+            }
+            if (slot->first_prime != 0) {
+                last_prime = slot->last_prime;
+            }
+            if (len != 0) {
+                iov[iov_count++] = (struct iovec){ .iov_base = data, .iov_len = len };
+                total += len;
+            }
+        }
+        output_pwritev(job, iov, iov_count, offset);
+        offset += total;
+        
+        pthread_mutex_lock(&job->lock);
+        for (size_t r = 0; r < run; r++) {
+            job->slots[(written + r) % job->ring_size].ready = 0;
+        }
+        written += run;
+        job->written = written;
+        pthread_cond_broadcast(&job->changed);
+        pthread_mutex_unlock(&job->lock);
+    }
+}
+
+size_t sieve_write_parallel(size_t n, const char *output_file, sieve_format format,
+                            size_t nthreads) {
+    if (nthreads == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = (online > 0) ? (size_t)online : 1;
+    }
+    const sieve_config *config = sieve_get_config();
+    if (nthreads < 2 || n < config->simple_threshold ||
+        (format == SIEVE_FORMAT_U32 && n > UINT32_MAX)) {
+        return sieve_write_primes(n, output_file, format, SIEVE_ENGINE_AUTO);  // Reports u32 overflow
+    }
+    
+    // TEXT and VARINT spend one thread of the budget on the writer
+    int ordered = (format == SIEVE_FORMAT_TEXT || format == SIEVE_FORMAT_VARINT);
+    int fixed = (format == SIEVE_FORMAT_U32 || format == SIEVE_FORMAT_U64);
+    size_t span = (config->segment_size < OUTPUT_SPAN_MAX) ? config->segment_size : OUTPUT_SPAN_MAX;
+    span -= span % 128;
+    uint64_t segment_count = (n - 1) / span + 1;
+    size_t worker_count = ordered ? nthreads - 1 : nthreads;
+    if (worker_count > segment_count) {
+        worker_count = (size_t)segment_count;
+    }
+    // A span of y numbers holds at most 2y / ln y primes (Montgomery-Vaughan)
+    size_t max_primes = (size_t)(2.0 * (double)span / log((double)span)) + 2;
+    size_t buffer_bytes = max_primes * FORMAT_MAX_BYTES;
+    
+    // Every buffer is reserved up front, so no worker can fail mid-run and
+    // stall the segments queued behind it
+    size_t base_count;
+    sieve_arena *arena = arena_current();
+    arena_mark mark = arena_save(arena);
+    size_t *base_primes = arena_base_primes(arena, isqrt(n), &base_count);
+    output_job *job = arena_alloc(arena, sizeof(output_job));
+    output_worker *workers = arena_alloc(arena, worker_count * sizeof(output_worker));
+    size_t ring_size = ordered ? worker_count * OUTPUT_RING_PER_THREAD : 0;
+    output_slot *slots = ordered ? arena_alloc(arena, ring_size * sizeof(output_slot)) : NULL;
+    int allocated = (base_primes != NULL && job != NULL && workers != NULL &&
+                     (!ordered || slots != NULL));
+    for (size_t t = 0; allocated && t < worker_count; t++) {
+        workers[t] = (output_worker){ .job = job };
+        workers[t].bits = arena_alloc(arena, span / 16);
+        workers[t].next_multiple = arena_alloc(arena, (base_count + 1) * sizeof(uint64_t));
+        workers[t].format_buf = fixed ? arena_alloc(arena, buffer_bytes) : NULL;
+        allocated = (workers[t].bits != NULL && workers[t].next_multiple != NULL &&
+                     (!fixed || workers[t].format_buf != NULL));
+    }
+    for (size_t s = 0; allocated && s < ring_size; s++) {
+        slots[s] = (output_slot){ .buf = arena_alloc(arena, buffer_bytes) };
+        allocated = (slots[s].buf != NULL);
+    }
+    if (!allocated) {
+        arena_restore(arena, mark);
+        return SIEVE_ERROR;
+    }
+    
+    int fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Could not open output file '%s'\n", output_file);
+        arena_restore(arena, mark);
+        return sieve_count_parallel(n, nthreads);  // Continue without file output
+    }
+    
+    *job = (output_job){
+        .base_primes = base_primes,
+        .base_count = base_count,
+        .n = n,
+        .span = span,
+        .segment_count = segment_count,
+        .format = format,
+        .fd = fd,
+        .buffer_bytes = buffer_bytes,
+        .slots = slots,
+        .ring_size = ring_size,
+    };
+    atomic_init(&job->next_segment, 0);
+    atomic_init(&job->error, 0);
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->changed, NULL);
+    
+    // Fixed layouts run worker 0 on the calling thread; ordered ones run
+    // the writer there and need at least one spawned worker
+    size_t first_spawned = ordered ? 0 : 1;
+    size_t spawned = first_spawned;
+    while (spawned < worker_count &&
+           pthread_create(&workers[spawned].thread, NULL, output_worker_main, &workers[spawned]) == 0) {
+        spawned++;
+    }
+    
+    size_t prime_count = 0;
+    int fallback = ordered && spawned == 0;
+    if (!fallback) {
+        if (ordered) {
+            output_writer_run(job);
+        } else {
+            output_worker_main(&workers[0]);
+            prime_count = workers[0].prime_count;
+        }
+    }
+    for (size_t t = first_spawned; t < spawned; t++) {
+        pthread_join(workers[t].thread, NULL);
+        prime_count += workers[t].prime_count;
+    }
+    
+    pthread_cond_destroy(&job->changed);
+    pthread_mutex_destroy(&job->lock);
+    if (close(fd) != 0) {
+        output_error(job, "Closing");
+    }
+    int failed = atomic_load(&job->error);  // Already reported
+    arena_restore(arena, mark);
+    if (fallback) {
+        return sieve_write_primes(n, output_file, format, SIEVE_ENGINE_AUTO);
+    }
+    return failed ? SIEVE_ERROR : prime_count;
+}
+
+// ============================================================================
+// RANGE SIEVE: primes in [lo, hi] without sieving from 0
+// ============================================================================
+
+// Sieve the odd numbers in [first_odd, last_odd] segment by segment.
+// Base primes only go up to sqrt(last_odd), and only segments inside the
+// window are touched, so the cost follows the window width, not hi.
+int sieve_window(uint64_t first_odd, uint64_t last_odd,
+                 segment_visit_fn visit, void *ctx) {
+    size_t segment_size = sieve_get_config()->segment_size;
+    size_t base_count;
+    sieve_arena *arena = arena_current();
+    arena_mark mark = arena_save(arena);
+    size_t *base_primes = arena_base_primes(arena, isqrt(last_odd), &base_count);
+    uint64_t *next_multiple = arena_alloc(arena, (base_count + 1) * sizeof(uint64_t));
+    uint8_t *seg_sieve = arena_alloc(arena, (segment_size / 2 + 7) / 8);
+    if (base_primes == NULL || next_multiple == NULL || seg_sieve == NULL) {
+        arena_restore(arena, mark);
+        return -1;
+    }
+    
+    sieve_state state;
+    sieve_state_attach(&state, base_primes, base_count, next_multiple);
+    sieve_state_init(&state, first_odd);
+    
+    // Step by bit count rather than by value so hi = 2^64 - 1 cannot wrap
+    uint64_t total_odds = (last_odd - first_odd) / 2 + 1;
+    
+    for (uint64_t done = 0; done < total_odds; ) {
+        size_t odd_count = segment_size / 2;
+        if (total_odds - done < odd_count) {
+            odd_count = (size_t)(total_odds - done);
+        }
+        
+        presieve_fill(seg_sieve, first_odd + 2 * done, odd_count);
+        sieve_state_mark(&state, seg_sieve, odd_count);
+        sieve_state_advance(&state, odd_count);
+        
+        visit(seg_sieve, first_odd + 2 * done, odd_count, ctx);
+        done += odd_count;
+    }
+    
+    arena_restore(arena, mark);
+    return 0;
+}
+
+typedef struct {
+    sieve_prime_fn fn;
+    void *ctx;
+    uint64_t count;
+} range_visitor;
+
+SIEVE_KERNEL
+static void range_visit_segment(const uint8_t *seg_sieve, uint64_t first_odd,
+                                size_t odd_count, void *ctx) {
+    range_visitor *rv = ctx;
+    
+    if (rv->fn == NULL) {
+        rv->count += count_segment(seg_sieve, odd_count);
+        return;
+    }
+    // Decode with ctz / clear-lowest-bit, one 64-bit word at a time
+    for (size_t k = 0; 64 * k < odd_count; k++) {
+        uint64_t bits = segment_word(seg_sieve, odd_count, k);
+        uint64_t word_first = first_odd + 128 * (uint64_t)k;
+        while (bits != 0) {
+            rv->count++;
+            rv->fn(word_first + 2 * (uint64_t)__builtin_ctzll(bits), rv->ctx);
+            bits &= bits - 1;
+        }
+    }
+}
+
+typedef struct {
+    sieve_batch_fn fn;
+    void *ctx;
+    uint64_t *primes;
+    size_t len;
+    size_t capacity;                        // The caller's batch size
+    uint64_t count;
+} batch_visitor;
+
+static void batch_flush(batch_visitor *bv) {
+    if (bv->len != 0) {
+        bv->fn(bv->primes, bv->len, bv->ctx);
+        bv->count += bv->len;
+        bv->len = 0;
+    }
+}
+
+SIEVE_KERNEL
+static void batch_visit_segment(const uint8_t *seg_sieve, uint64_t first_odd,
+                                size_t odd_count, void *ctx) {
+    batch_visitor *bv = ctx;
+    uint64_t *primes = bv->primes;
+    
+    // Batches too small to take a whole word: flush whenever one fills
+    if (bv->capacity < 64) {
+        for (size_t k = 0; 64 * k < odd_count; k++) {
+            uint64_t bits = segment_word(seg_sieve, odd_count, k);
+            uint64_t word_first = first_odd + 128 * (uint64_t)k;
+            while (bits != 0) {
+                primes[bv->len++] = word_first + 2 * (uint64_t)__builtin_ctzll(bits);
+                bits &= bits - 1;
+                if (bv->len == bv->capacity) {
+                    batch_flush(bv);
+                }
+            }
+        }
+        return;
+    }
+    
+    for (size_t k = 0; 64 * k < odd_count; k++) {
+        uint64_t bits = segment_word(seg_sieve, odd_count, k);
+        if (bv->len + 64 > bv->capacity) {
+            batch_flush(bv);
+        }
+        uint64_t word_first = first_odd + 128 * (uint64_t)k;
+        size_t len = bv->len;
+        while (bits != 0) {
+            primes[len++] = word_first + 2 * (uint64_t)__builtin_ctzll(bits);
+            bits &= bits - 1;
+        }
+        bv->len = len;
+    }
+}
+
+uint64_t sieve_range(uint64_t lo, uint64_t hi, sieve_prime_fn fn, void *ctx) {
+    if (hi < 2 || lo > hi) {
+        return 0;
+    }
+    
+    range_visitor rv = { .fn = fn, .ctx = ctx, .count = 0 };
+    
+    // Special case: 2 is the only even prime
+    if (lo <= 2) {
+        rv.count = 1;
+        if (fn != NULL) {
+            fn(2, ctx);
+        }
+    }
+    
+    // Odd numbers from max(lo, 3) to hi (1 is not prime)
+    uint64_t first_odd = (lo <= 3) ? 3 : (lo | 1);
+    uint64_t last_odd = (hi % 2 == 0) ? hi - 1 : hi;
+    if (first_odd <= last_odd) {
+        uint64_t odd_primes;
+        if (fn == NULL && last_odd - first_odd >= GPU_MIN_RANGE && gpu_range_enabled()
+                && gpu_count_odd(first_odd, last_odd, &odd_primes) == 0) {
+            rv.count += odd_primes;
+        } else if (sieve_window(first_odd, last_odd, range_visit_segment, &rv) != 0) {
+            return SIEVE_ERROR;
+        }
+    }
+    
+    return rv.count;
+}
+
+uint64_t sieve_for_each(uint64_t lo, uint64_t hi, sieve_prime_fn fn, void *ctx) {
+    return (fn != NULL) ? sieve_range(lo, hi, fn, ctx) : 0;
+}
+
+uint64_t sieve_for_each_batch(uint64_t lo, uint64_t hi, size_t batch,
+                              sieve_batch_fn fn, void *ctx) {
+    if (fn == NULL || hi < 2 || lo > hi) {
+        return 0;
+    }
+    
+    sieve_arena *arena = arena_current();
+    arena_mark mark = arena_save(arena);
+    batch_visitor bv = { .fn = fn, .ctx = ctx, .len = 0, .count = 0 };
+    bv.capacity = (batch == 0) ? SIEVE_BATCH_DEFAULT : batch;
+    bv.primes = arena_alloc(arena, bv.capacity * sizeof(uint64_t));
+    if (bv.primes == NULL) {
+        arena_restore(arena, mark);
+        return SIEVE_ERROR;
+    }
+    
+    if (lo <= 2) {
+        bv.primes[bv.len++] = 2;
+        if (bv.len == bv.capacity) {
+            batch_flush(&bv);
+        }
+    }
+    uint64_t first_odd = (lo <= 3) ? 3 : (lo | 1);
+    uint64_t last_odd = (hi % 2 == 0) ? hi - 1 : hi;
+    int status = 0;
+    if (first_odd <= last_odd) {
+        status = sieve_window(first_odd, last_odd, batch_visit_segment, &bv);
+    }
+    batch_flush(&bv);
+    
+    arena_restore(arena, mark);
+    return (status == 0) ? bv.count : SIEVE_ERROR;
+}
+
+// ============================================================================
+// PRIME ITERATOR: segments sieved on demand, one segment of primes buffered
+// ============================================================================
+//
+// Windows are aligned to multiples of the segment size, so the window that
+// holds the cursor also serves the first prev(). Walking forward continues
+// the carried sieve_state like sieve_segmented(); a jump or a step back
+// repositions it with sieve_state_init(). Base primes cover twice the
+// square root actually needed and are regenerated when a window outgrows
+// them, so a forward walk rebuilds them O(log) times.
+
+struct prime_iterator_state {
+    sieve_arena *arena;                     // Owns everything below
+    arena_mark tables;                      // Rolled back when the tables grow
+    size_t span;                            // Numbers per window (even)
+    uint64_t low;                           // Window [low, high] held in primes
+    uint64_t high;
+    size_t base_limit;                      // Base primes cover sqrt(x) up to here
+    size_t *base_primes;
+    size_t base_count;
+    uint64_t *next_multiple;
+    sieve_state sieve;
+    uint64_t resume_odd;                    // sieve is positioned here (0 = not at all)
+    uint8_t *seg_sieve;
+    uint64_t *primes;
+};
+
+#define ITERATOR_MIN_BASE  65536
+#define ITERATOR_MAX_BASE  4294967295ULL    // isqrt(2^64 - 1)
+
+// (Re)build base primes and buffers so windows up to sqrt_needed^2 can be sieved
+static int iterator_grow_tables(prime_iterator_state *st, size_t sqrt_needed) {
+    size_t limit = (sqrt_needed > ITERATOR_MAX_BASE / 2) ? ITERATOR_MAX_BASE : 2 * sqrt_needed;
+    if (limit < ITERATOR_MIN_BASE) {
+        limit = ITERATOR_MIN_BASE;
+    }
+    
+    // A window of k odd numbers holds at most k - floor(k/3) + 1 odd
+    // primes (every third odd is a multiple of 3), plus the prime 2
+    size_t odd_count = st->span / 2;
+    size_t capacity = odd_count - odd_count / 3 + 2;
+    
+    arena_restore(st->arena, st->tables);
+    st->base_primes = arena_base_primes(st->arena, limit, &st->base_count);
+    st->next_multiple = arena_alloc(st->arena, (st->base_count + 1) * sizeof(uint64_t));
+    st->seg_sieve = arena_alloc(st->arena, (odd_count + 7) / 8);
+    st->primes = arena_alloc(st->arena, capacity * sizeof(uint64_t));
+    st->base_limit = 0;
+    st->resume_odd = 0;
+    if (st->base_primes == NULL || st->next_multiple == NULL ||
+        st->seg_sieve == NULL || st->primes == NULL) {
+        return -1;
+    }
+    
+    sieve_state_attach(&st->sieve, st->base_primes, st->base_count, st->next_multiple);
+    st->base_limit = limit;
+    return 0;
+}
+
+// Sieve and decode the aligned window holding x
+static int iterator_load_window(prime_iterator *it, uint64_t x) {
+    prime_iterator_state *st = it->state;
+    uint64_t low = x - x % st->span;
+    uint64_t high = (UINT64_MAX - low < st->span - 1) ? UINT64_MAX : low + st->span - 1;
+    uint64_t first_odd = (low < 3) ? 3 : (low | 1);  // 1 is not prime
+    uint64_t last_odd = (high % 2 == 0) ? high - 1 : high;
+    
+    size_t sqrt_hi = (first_odd <= last_odd) ? isqrt(last_odd) : 0;
+    if (st->primes == NULL || sqrt_hi > st->base_limit) {
+        if (iterator_grow_tables(st, sqrt_hi) != 0) {
+            it->primes = NULL;
+            it->count = 0;
+            it->index = 0;
+            return -1;
+        }
+    }
+    
+    // Special case: 2 is the only even prime
+    size_t count = 0;
+    if (low <= 2 && high >= 2) {
+        st->primes[count++] = 2;
+    }
+    
+    if (first_odd <= last_odd) {
+        size_t odd_count = (size_t)((last_odd - first_odd) / 2 + 1);
+        if (st->resume_odd != first_odd) {
+            sieve_state_init(&st->sieve, first_odd);
+        }
+        presieve_fill(st->seg_sieve, first_odd, odd_count);
+        sieve_state_mark(&st->sieve, st->seg_sieve, odd_count);
+        sieve_state_advance(&st->sieve, odd_count);
+        st->resume_odd = last_odd + 2;
+        
+        // Decode with ctz / clear-lowest-bit, one 64-bit word at a time
+        for (size_t k = 0; 64 * k < odd_count; k++) {
+            uint64_t bits = segment_word(st->seg_sieve, odd_count, k);
+            uint64_t word_first = first_odd + 128 * (uint64_t)k;
+            while (bits != 0) {
+                st->primes[count++] = word_first + 2 * (uint64_t)__builtin_ctzll(bits);
+                bits &= bits - 1;
+            }
+        }
+    }
+    
+    st->low = low;
+    st->high = high;
+    it->primes = st->primes;
+    it->count = count;
+    return 0;
+}
+
+void prime_iterator_init(prime_iterator *it, uint64_t start) {
+    it->primes = NULL;
+    it->count = 0;
+    it->index = 0;
+    it->state = NULL;
+    
+    sieve_arena *arena = sieve_arena_create(0, 0);
+    prime_iterator_state *st = arena_alloc(arena, sizeof(prime_iterator_state));
+    if (st == NULL) {
+        sieve_arena_destroy(arena);
+        return;  // next() and prev() report no primes
+    }
+    st->arena = arena;
+    st->tables = arena_save(arena);
+    st->span = sieve_get_config()->segment_size;
+    st->base_limit = 0;
+    st->resume_odd = 0;
+    st->primes = NULL;
+    it->state = st;
+    
+    prime_iterator_skipto(it, start);
+}
+
+void prime_iterator_skipto(prime_iterator *it, uint64_t start) {
+    prime_iterator_state *st = it->state;
+    if (st == NULL) {
+        return;
+    }
+    if (it->primes == NULL || start < st->low || start > st->high) {
+        iterator_load_window(it, start);
+    }
+    
+    // First buffered prime >= start
+    size_t lo = 0, hi = it->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (it->primes[mid] < start) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    it->index = lo;
+}
+
+uint64_t prime_iterator_next(prime_iterator *it) {
+    prime_iterator_state *st = it->state;
+    while (it->index == it->count) {
+        if (st == NULL || st->high == UINT64_MAX ||
+            iterator_load_window(it, st->high + 1) != 0) {
+            return 0;
+        }
+        it->index = 0;
+    }
+    return it->primes[it->index++];
+}
+
+uint64_t prime_iterator_prev(prime_iterator *it) {
+    prime_iterator_state *st = it->state;
+    while (it->index == 0) {
+        if (st == NULL || st->low == 0 ||
+            iterator_load_window(it, st->low - 1) != 0) {
+            return 0;
+        }
+        it->index = it->count;
+    }
+    return it->primes[--it->index];
+}
+
+void prime_iterator_free(prime_iterator *it) {
+    if (it->state != NULL) {
+        sieve_arena_destroy(it->state->arena);
+    }
+    it->primes = NULL;
+    it->count = 0;
+    it->index = 0;
+    it->state = NULL;
+}
+
+// ============================================================================
+// SIEVE CONTEXT: base primes and buffers kept across calls
+// ============================================================================
+//
+// The context owns a private arena holding its base-prime table, the
+// matching next-multiple offsets, one segment bitmap and (on first output)
+// a writer. A larger n extends the table in place of rebuilding it: only
+// the primes in (base_limit, new_limit] are sieved and appended. The limit
+// at least doubles each time, so the arrays abandoned when the capacity
+// runs out add up to less than the live ones. The pre-sieve pattern is
+// already shared process-wide.
+
+#define CTX_MIN_BASE 65536
+
+struct sieve_ctx {
+    sieve_arena *arena;                     // Owns everything below
+    size_t base_limit;                      // Table holds every prime up to here
+    size_t *base_primes;
+    size_t base_count;
+    size_t base_capacity;
+    uint64_t *next_multiple;                // base_capacity + 1 slots
+    size_t segment_size;
+    uint8_t *seg_sieve;
+    prime_writer *writer;
+};
+
+sieve_ctx *sieve_ctx_create(void) {
+    sieve_arena *arena = sieve_arena_create(0, 0);
+    sieve_ctx *ctx = arena_alloc(arena, sizeof(sieve_ctx));
+    if (ctx == NULL) {
+        sieve_arena_destroy(arena);
+        return NULL;
+    }
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->arena = arena;
+    return ctx;
+}
+
+void sieve_ctx_destroy(sieve_ctx *ctx) {
+    if (ctx != NULL) {
+        sieve_arena_destroy(ctx->arena);
+    }
+}
+
+static void ctx_append_prime(uint64_t prime, void *arg) {
+    sieve_ctx *ctx = arg;
+    if (ctx->base_count < ctx->base_capacity) {
+        ctx->base_primes[ctx->base_count++] = (size_t)prime;
+    }
+}
+
+// Make the table cover sqrt_n, extending it past the current limit
+static int ctx_grow_base(sieve_ctx *ctx, size_t sqrt_n) {
+    if (sqrt_n <= ctx->base_limit) {
+        return 0;
+    }
+    size_t limit = 2 * ctx->base_limit;
+    if (limit < sqrt_n) {
+        limit = sqrt_n;
+    }
+    if (limit < CTX_MIN_BASE) {
+        limit = CTX_MIN_BASE;
+    }
+    
+    size_t capacity = max_prime_count(limit);
+    if (capacity > ctx->base_capacity) {
+        size_t *primes = arena_alloc(ctx->arena, capacity * sizeof(size_t));
+        uint64_t *next = arena_alloc(ctx->arena, (capacity + 1) * sizeof(uint64_t));
+        if (primes == NULL || next == NULL) {
+            return -1;
+        }
+        if (ctx->base_count != 0) {
+            memcpy(primes, ctx->base_primes, ctx->base_count * sizeof(size_t));
+        }
+        ctx->base_primes = primes;
+        ctx->next_multiple = next;
+        ctx->base_capacity = capacity;
+    }
+    
+    if (sieve_range(ctx->base_limit + 1, limit, ctx_append_prime, ctx) == SIEVE_ERROR) {
+        return -1;
+    }
+    ctx->base_limit = limit;
+    return 0;
+}
+
+// Tables for sieving [1, n] with the current segment size
+static int ctx_prepare(sieve_ctx *ctx, size_t n) {
+    if (ctx_grow_base(ctx, isqrt(n)) != 0) {
+        return -1;
+    }
+    size_t segment_size = sieve_get_config()->segment_size;
+    if (segment_size > ctx->segment_size) {
+        ctx->seg_sieve = arena_alloc(ctx->arena, (segment_size / 2 + 7) / 8);
+        if (ctx->seg_sieve == NULL) {
+            ctx->segment_size = 0;
+            return -1;
+        }
+    }
+    ctx->segment_size = segment_size;
+    return 0;
+}
+
+size_t sieve_ctx_write_primes(sieve_ctx *ctx, size_t n, const char *output_file,
+                              sieve_format format) {
+    prime_writer *w = NULL;
+    if (output_file != NULL) {
+        if (ctx->writer == NULL) {
+            ctx->writer = arena_alloc(ctx->arena, sizeof(prime_writer));
+        }
+        if (ctx->writer == NULL) {
+            return SIEVE_ERROR;
+        }
+        if (prime_writer_open(ctx->writer, output_file, format, n) == 0) {
+            w = ctx->writer;
+        }
+    }
+    
+    size_t prime_count = SIEVE_ERROR;        // Unless the tables can be had
+    if (n < 4) {
+        prime_count = sieve_simple(n, w);
+    } else if (ctx_prepare(ctx, n) == 0) {
+        // Only the prefix of the table up to sqrt(n) takes part
+        size_t sqrt_n = isqrt(n);
+        size_t lo = 0, hi = ctx->base_count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (ctx->base_primes[mid] <= sqrt_n) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        prime_count = segmented_run(n, w, ctx->base_primes, lo, ctx->next_multiple,
+                                    ctx->seg_sieve, ctx->segment_size, NULL);
+    }
+    
+    // The final flush and close are where short writes show up
+    if (w != NULL && prime_writer_close(w) != 0) {
+        prime_count = SIEVE_ERROR;
+    }
+    return prime_count;
+}
+
+// ============================================================================
+// Main dispatcher
+// ============================================================================
+
+size_t sieve_of_eratosthenes(size_t n, const char *output_file) {
+    return sieve_write_primes(n, output_file, SIEVE_FORMAT_TEXT, SIEVE_ENGINE_AUTO);
+}
+
+size_t sieve_with_engine(size_t n, const char *output_file, sieve_engine engine) {
+    return sieve_write_primes(n, output_file, SIEVE_FORMAT_TEXT, engine);
+}
+
+static size_t run_engine(size_t n, prime_writer *w, sieve_engine engine) {
+    switch (engine) {
+    case SIEVE_ENGINE_SIMPLE:
+        return sieve_simple(n, w);
+    case SIEVE_ENGINE_SEGMENTED:
+        return sieve_segmented(n, w);
+    case SIEVE_ENGINE_BUCKET:
+        return sieve_bucket(n, w);
+    case SIEVE_ENGINE_WHEEL:
+        return sieve_wheel30(n, w);
+    case SIEVE_ENGINE_LUCY:
+        if (w == NULL) {
+            size_t count = prime_count_lucy(n);
+            if (count != 0 || n < 2) {
+                return count;
+            }
+        }
+        break;  // Cannot list primes, or no memory for the tables: sieve instead
+    case SIEVE_ENGINE_GPU: {
+        uint64_t odd_primes;
+        if (w == NULL && n >= 3 && gpu_count_odd(3, (n % 2 == 0) ? n - 1 : n, &odd_primes) == 0) {
+            return (size_t)odd_primes + 1;  // And 2
+        }
+        break;  // Listing primes, or no device: the CPU engines
+    }
+    case SIEVE_ENGINE_AUTO:
+    default:
+        break;
+    }
+    
+    // Count-only: Lucy needs 16 * sqrt(n) bytes and returns 0 (never a
+    // valid count for n >= 2) if they cannot be had; then sieve instead
+    const sieve_config *config = sieve_get_config();
+    if (w == NULL && n >= 2 && n >= config->count_threshold) {
+        size_t count = prime_count_lucy(n);
+        if (count != 0) {
+            return count;
+        }
+    }
+    if (n < config->simple_threshold) {
+        return sieve_simple(n, w);
+    } else if (n < config->bucket_threshold) {
+        return sieve_segmented(n, w);
+    } else {
+        return sieve_bucket(n, w);
+    }
+}
+
+size_t sieve_write_primes(size_t n, const char *output_file, sieve_format format,
+                          sieve_engine engine) {
+    sieve_arena *arena = arena_current();
+    arena_mark mark = arena_save(arena);
+    
+    // Continue without file output if it cannot be opened
+    prime_writer *w = NULL;
+    if (output_file != NULL) {
+        w = arena_alloc(arena, sizeof(prime_writer));
+        if (w == NULL) {
+            arena_restore(arena, mark);
+            return SIEVE_ERROR;
+        }
+        if (prime_writer_open(w, output_file, format, n) != 0) {
+            w = NULL;
+        }
+    }
+    
+    size_t prime_count = run_engine(n, w, engine);
+    
+    if (w != NULL && prime_writer_close(w) != 0) {
+        prime_count = SIEVE_ERROR;
+    }
+    arena_restore(arena, mark);
+    return prime_count;
+}
+
+int sieve_write_checkpointed(size_t n, const char *output_file, sieve_format format,
+                             const char *state_file, unsigned interval, int resume,
+                             size_t *prime_count) {
+    if (n < 4) {
+        *prime_count = sieve_write_primes(n, output_file, format, SIEVE_ENGINE_SIMPLE);
+        return (*prime_count == SIEVE_ERROR) ? -1 : 0;  // Nothing worth saving
+    }
+    
+    segment_checkpoint cp = { .path = state_file, .interval = interval, .next_due = 0 };
+    int resumed = resume && checkpoint_load(state_file, &cp.state) == 0;
+    if (resumed && (cp.state.n != n || cp.state.lo != 0 ||
+                    cp.state.has_output != (output_file != NULL) ||
+                    (output_file != NULL && cp.state.format != (uint32_t)format))) {
+        fprintf(stderr, "Error: Checkpoint '%s' belongs to a different run\n", state_file);
+        return -1;
+    }
+    if (!resumed) {
+        memset(&cp.state, 0, sizeof(cp.state));
+        cp.state.n = n;
+        cp.state.has_output = (output_file != NULL);
+        cp.state.format = (uint32_t)format;
+    }
+    
+    size_t segment_size = sieve_get_config()->segment_size;
+    size_t base_count;
+    sieve_arena *arena = arena_current();
+    arena_mark mark = arena_save(arena);
+    prime_writer *w = NULL;
+    int status = 0;
+    if (output_file != NULL) {
+        w = arena_alloc(arena, sizeof(prime_writer));
+        if (w == NULL) {
+            status = -1;
+        } else if (resumed) {
+            status = prime_writer_resume(w, output_file, format, n, cp.state.output_offset,
+                                         cp.state.last_prime, cp.state.bit_pos,
+                                         (uint8_t)cp.state.acc);
+        } else {
+            status = prime_writer_open(w, output_file, format, n);
+        }
+    }
+    size_t *base_primes = arena_base_primes(arena, isqrt(n), &base_count);
+    uint64_t *next_multiple = arena_alloc(arena, (base_count + 1) * sizeof(uint64_t));
+    uint8_t *seg_sieve = arena_alloc(arena, (segment_size / 2 + 7) / 8);
+    if (status != 0 || base_primes == NULL || next_multiple == NULL || seg_sieve == NULL) {
+        if (w != NULL && status == 0) {
+            prime_writer_close(w);
+        }
+        arena_restore(arena, mark);
+        return -1;
+    }
+    
+    *prime_count = segmented_run(n, w, base_primes, base_count, next_multiple,
+                                 seg_sieve, segment_size, &cp);
+    if (w != NULL && prime_writer_close(w) != 0) {
+        status = -1;
+    }
+    arena_restore(arena, mark);
+    
+    // A finished run needs no state; a failed one keeps its last good save
+    if (status == 0) {
+        unlink(state_file);
+    }
+    return status;
+}
+
+// ============================================================================
+// NTH PRIME: analytic estimate, one count, then a short walk
+// ============================================================================
+//
+// R^{-1}(k), with Riemann's R(x) = sum mu(m)/m * li(x^(1/m)), lands within
+// roughly sqrt(p_k) of the k-th prime. The primes up to that estimate are
+// counted once; the iterator then steps the few remaining primes forward or
+// backward from it.
+
+#define NTH_PRIME_DIRECT 1000               // Below this k, just walk from 0
+#define PI_2_64          425656284035217743ULL  // pi(2^64)
+
+// li(x) by Ramanujan's series (converges for every x > 1)
+static long double log_integral(long double x) {
+    const long double euler_gamma = 0.57721566490153286061L;
+    long double lx = logl(x);
+    long double sum = 0, term = 1, inner = 0;
+    
+    for (int n = 1; n < 200; n++) {
+        term *= -lx / (n * 2.0L);            // (-1)^n (ln x)^n / (n! 2^n)
+        if ((n - 1) % 2 == 0) {
+            inner += 1.0L / (2 * ((n - 1) / 2) + 1);
+        }
+        long double delta = -2 * term * inner;
+        sum += delta;
+        if (fabsl(delta) < 1e-20L * fabsl(sum)) {
+            break;
+        }
+    }
+    return euler_gamma + logl(lx) + sqrtl(x) * sum;
+}
+
+// Riemann R(x); terms stop once x^(1/m) drops below 2
+static long double riemann_r(long double x) {
+    static const signed char mobius[] = {
+        0, 1, -1, -1, 0, -1, 1, -1, 0, 0, 1, -1, 0, -1, 1, 1, 0, -1, 0, -1, 0,
+        1, 1, -1, 0, 0, 1, 0, 0, -1, -1, -1, 0, 1, 1, 1, 0, -1, 1, 1, 0, -1,
+        -1, -1, 0, 0, 1, -1, 0, 0, 0, 1, 0, -1, 0, 1, 0, 1, 1, -1, 0, -1, 1, 0, 0
+    };
+    long double sum = 0;
+    for (int m = 1; m < (int)sizeof(mobius); m++) {
+        long double root = powl(x, 1.0L / m);
+        if (root < 2) {
+            break;
+        }
+        if (mobius[m] != 0) {
+            sum += mobius[m] * log_integral(root) / m;
+        }
+    }
+    return sum;
+}
+
+// Newton's method on R(x) = k, using R'(x) ~ 1 / ln x
+static uint64_t riemann_r_inverse(uint64_t k) {
+    long double lk = logl((long double)k);
+    long double x = k * (lk + logl(lk) - 1);  // Cipolla's first terms
+    for (int i = 0; i < 50; i++) {
+        long double step = (riemann_r(x) - k) * logl(x);
+        x -= step;
+        if (fabsl(step) < 1) {
+            break;
+        }
+    }
+    return (x >= 18446744073709551615.0L) ? UINT64_MAX : (uint64_t)x;
+}
+
+uint64_t nth_prime(uint64_t k) {
+    if (k == 0 || k > PI_2_64) {
+        return 0;
+    }
+    
+    // Count the primes up to the estimate in O(n^(3/4)) time whatever
+    // count_threshold says; the Lucy engine sieves only if its tables fail
+    uint64_t start = (k < NTH_PRIME_DIRECT) ? 0 : riemann_r_inverse(k);
+    uint64_t count = (start < 2) ? 0 : run_engine((size_t)start, NULL, SIEVE_ENGINE_LUCY);
+    if (count == SIEVE_ERROR) {
+        return 0;
+    }
+    
+    // The cursor sits after p_count; walk to p_k
+    prime_iterator it;
+    prime_iterator_init(&it, (start == UINT64_MAX) ? start : start + 1);
+    uint64_t prime = 0;
+    if (count < k) {
+        for (uint64_t i = count; i < k; i++) {
+            prime = prime_iterator_next(&it);
+        }
+    } else {
+        for (uint64_t i = count; i >= k; i--) {
+            prime = prime_iterator_prev(&it);
+        }
+    }
+    prime_iterator_free(&it);
+    
+    return prime;
+}
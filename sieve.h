@@ -4,14 +4,650 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/**
+ * Returned in place of a prime count when a call fails: scratch memory that
+ * could not be mapped or an output file that could not be written (both
+ * reported on stderr). Never a valid count.
+ */
+#define SIEVE_ERROR ((size_t)-1)
+
 /**
  * Find all prime numbers up to n using the Sieve of Eratosthenes algorithm.
  * 
  * @param n The upper limit (inclusive)
  * @param output_file Optional file path to write primes to (NULL to skip)
- * @return The count of primes found
+ * @return The count of primes found, or SIEVE_ERROR on failure
  */
 size_t sieve_of_eratosthenes(size_t n, const char *output_file);
 
-#endif /* SIEVE_H */
+/**
+ * Storage/marking engines behind sieve_of_eratosthenes().
+ */
+typedef enum {
+    SIEVE_ENGINE_AUTO = 0,      /* Pick by n (simple, segmented or bucket; Lucy to count) */
+    SIEVE_ENGINE_SIMPLE,        /* Single odd-only bit array */
+    SIEVE_ENGINE_SEGMENTED,     /* Odd-only segments */
+    SIEVE_ENGINE_BUCKET,        /* Odd-only segments + buckets for large primes */
+    SIEVE_ENGINE_WHEEL,         /* Mod-30 wheel segments (8 residues per byte) */
+    SIEVE_ENGINE_LUCY,          /* Count-only pi(n) in O(n^(3/4)), no sieving */
+    SIEVE_ENGINE_GPU            /* Count-only segments on an OpenCL device */
+} sieve_engine;
+
+/**
+ * Output file formats.
+ */
+typedef enum {
+    SIEVE_FORMAT_TEXT = 0,      /* One decimal prime per line */
+    SIEVE_FORMAT_U32,           /* Raw uint32_t per prime, host byte order */
+    SIEVE_FORMAT_U64,           /* Raw uint64_t per prime, host byte order */
+    SIEVE_FORMAT_VARINT,        /* LEB128 varint gap to the previous prime (first from 0) */
+    SIEVE_FORMAT_BITMAP         /* Odd-only bitmap of [1, n]: bit i (LSB first) = 2i+1 */
+} sieve_format;
+
+/**
+ * Same as sieve_of_eratosthenes(), but with an explicit engine.
+ * 
+ * @param n The upper limit (inclusive)
+ * @param output_file Optional file path to write primes to (NULL to skip)
+ * @param engine Engine to run (SIEVE_ENGINE_AUTO = default dispatch)
+ * @return The count of primes found, or SIEVE_ERROR on failure
+ */
+size_t sieve_with_engine(size_t n, const char *output_file, sieve_engine engine);
+
+/**
+ * Find all primes up to n and write them in the given format.
+ * 
+ * @param n The upper limit (inclusive)
+ * @param output_file Optional file path to write primes to (NULL to skip)
+ * @param format Output file format
+ * @param engine Engine to run (SIEVE_ENGINE_AUTO = default dispatch)
+ * @return The count of primes found, or SIEVE_ERROR on failure (including
+ *         a prime too large for SIEVE_FORMAT_U32)
+ */
+size_t sieve_write_primes(size_t n, const char *output_file, sieve_format format,
+                          sieve_engine engine);
+
+/**
+ * Find all primes up to n and write them with parallel workers, each of
+ * which sieves and formats whole segments. Text and varint segments are
+ * written in order by one writer thread with pwritev(); u32, u64 and bitmap
+ * workers pwrite() straight to offsets derived from per-segment counts.
+ * 
+ * @param n The upper limit (inclusive)
+ * @param output_file File path to write primes to
+ * @param format Output file format
+ * @param nthreads Thread budget (0 = one per online CPU), writer included;
+ *                 below 2 the primes are written by a single thread
+ * @return The count of primes found, or SIEVE_ERROR if the buffers could
+ *         not be allocated or a write to the output file failed
+ */
+size_t sieve_write_parallel(size_t n, const char *output_file, sieve_format format,
+                            size_t nthreads);
+
+/**
+ * Find all primes up to n with the segmented engine, saving the segment
+ * cursor, the count so far and the output offset to a small state file at
+ * most every `interval` seconds (at segment boundaries only). An
+ * interrupted run started again with `resume` set continues from its last
+ * save and produces the same file as an uninterrupted one. The state file
+ * is removed once the run completes.
+ * 
+ * @param n The upper limit (inclusive)
+ * @param output_file Optional file path to write primes to (NULL to skip)
+ * @param format Output file format
+ * @param state_file Path of the checkpoint state file
+ * @param interval Seconds between saves (0 = after every segment)
+ * @param resume Continue from state_file if it holds a valid checkpoint;
+ *               otherwise start from the beginning
+ * @param prime_count Receives the count of primes found
+ * @return 0 on success, -1 if the checkpoint belongs to another run or the
+ *         output could not be opened or written
+ */
+int sieve_write_checkpointed(size_t n, const char *output_file, sieve_format format,
+                             const char *state_file, unsigned interval, int resume,
+                             size_t *prime_count);
+
+/**
+ * Count primes up to n with a multithreaded segmented sieve.
+ * 
+ * Segments are distributed to worker threads through a work-stealing
+ * scheduler; each worker sieves with its own segment buffer.
+ * 
+ * @param n The upper limit (inclusive)
+ * @param nthreads Number of worker threads (0 = one per online CPU)
+ * @return The count of primes found, or SIEVE_ERROR if no worker could get
+ *         its buffers
+ */
+size_t sieve_count_parallel(size_t n, size_t nthreads);
+
+/**
+ * The OpenCL device used by SIEVE_ENGINE_GPU and, with SIEVE_GPU=1 set, by
+ * wide count-only sieve_range() calls. libOpenCL is loaded on first use and
+ * the device must match the CPU count of a few check windows; the backend
+ * is off when none is installed, no GPU is found or passes, or SIEVE_GPU=0
+ * is set, and those counts then run on the CPU engines.
+ * 
+ * @return The device name, or NULL if no device is usable
+ */
+const char *sieve_gpu_device(void);
+
+/**
+ * The instruction-set level the marking, counting and decoding kernels run
+ * at. Builds made with make PORTABLE=1 carry one copy of each kernel per
+ * level and pick the widest the host supports at load time.
+ * 
+ * @return "x86-64-v4", "x86-64-v3", "x86-64-v2", "sve", "armv8-a", or
+ *         "native" for a -march=native build
+ */
+const char *sieve_kernel_isa(void);
+
+/**
+ * Callback invoked once per prime, in increasing order.
+ */
+typedef void (*sieve_prime_fn)(uint64_t prime, void *ctx);
+
+/**
+ * Find all primes in the window [lo, hi] with a segmented sieve.
+ * 
+ * Only base primes up to sqrt(hi) are generated and only the segments
+ * inside the window are sieved. Any hi up to UINT64_MAX is accepted.
+ * 
+ * @param lo The lower limit (inclusive)
+ * @param hi The upper limit (inclusive)
+ * @param fn Optional callback for each prime (NULL to count only)
+ * @param ctx Opaque pointer passed through to fn
+ * @return The count of primes in [lo, hi], or SIEVE_ERROR if the sieving
+ *         tables could not be allocated
+ */
+uint64_t sieve_range(uint64_t lo, uint64_t hi, sieve_prime_fn fn, void *ctx);
+
+/**
+ * Call fn for every prime in [lo, hi], in increasing order, without any
+ * file I/O. Each segment's bitmap is decoded a 64-bit word at a time.
+ * 
+ * @return The count of primes in [lo, hi], 0 if fn is NULL, or SIEVE_ERROR
+ *         as for sieve_range()
+ */
+uint64_t sieve_for_each(uint64_t lo, uint64_t hi, sieve_prime_fn fn, void *ctx);
+
+/**
+ * Callback invoked with consecutive primes, in increasing order. The array
+ * is only valid during the call.
+ */
+typedef void (*sieve_batch_fn)(const uint64_t *primes, size_t count, void *ctx);
+
+#define SIEVE_BATCH_DEFAULT 4096  // Primes per batch when batch == 0
+
+/**
+ * Like sieve_for_each(), but hands the primes over in arrays of at most
+ * batch primes, so the per-prime cost is a store rather than a call.
+ * 
+ * @param batch Largest array passed to fn (0 = SIEVE_BATCH_DEFAULT). Any
+ *              size is honoured, but below 64 the primes of a bitmap word
+ *              no longer fit one batch and are stored one at a time
+ * @return The count of primes in [lo, hi], 0 if fn is NULL, or SIEVE_ERROR
+ *         if the batch buffer or the sieving tables cannot be allocated
+ */
+uint64_t sieve_for_each_batch(uint64_t lo, uint64_t hi, size_t batch,
+                              sieve_batch_fn fn, void *ctx);
+
+/**
+ * Forward/backward prime iterator. Segments are sieved on demand and only
+ * the primes of the current segment are buffered, so memory stays constant
+ * and the first prime costs one segment regardless of start.
+ * 
+ * The iterator is a cursor between primes: next() returns the prime after
+ * it and prev() the prime before it. After init(start) or skipto(start),
+ * next() returns the smallest prime >= start and prev() the largest
+ * prime < start.
+ */
+typedef struct prime_iterator_state prime_iterator_state;
+
+typedef struct {
+    const uint64_t *primes;        // Buffered primes of the current segment
+    size_t count;
+    size_t index;                  // Cursor: next() returns primes[index]
+    prime_iterator_state *state;   // Sieving tables (owned by the iterator)
+} prime_iterator;
+
+/**
+ * Initialize an iterator positioned at start. Release it with
+ * prime_iterator_free().
+ */
+void prime_iterator_init(prime_iterator *it, uint64_t start);
 
+/**
+ * @return The next prime, or 0 once past the largest prime below 2^64
+ */
+uint64_t prime_iterator_next(prime_iterator *it);
+
+/**
+ * @return The previous prime, or 0 once past 2
+ */
+uint64_t prime_iterator_prev(prime_iterator *it);
+
+/**
+ * Move the cursor to start, keeping the iterator's sieving tables.
+ */
+void prime_iterator_skipto(prime_iterator *it, uint64_t start);
+
+/**
+ * Release the iterator's memory.
+ */
+void prime_iterator_free(prime_iterator *it);
+
+/**
+ * Reusable segmented-sieve context. It owns the base-prime table, the
+ * sieving offsets, the segment bitmap and the output buffer, and keeps them
+ * between calls: a larger n only sieves the base primes it adds, and calls
+ * at or below the largest n so far allocate nothing. A context must not be
+ * used by two threads at once.
+ */
+typedef struct sieve_ctx sieve_ctx;
+
+/**
+ * @return A new context, or NULL if no memory could be mapped
+ */
+sieve_ctx *sieve_ctx_create(void);
+
+/**
+ * Release a context and all of its tables.
+ */
+void sieve_ctx_destroy(sieve_ctx *ctx);
+
+/**
+ * Same as sieve_write_primes() with the segmented engine, using and
+ * extending the context's tables.
+ * 
+ * @param ctx Context from sieve_ctx_create()
+ * @param n The upper limit (inclusive)
+ * @param output_file Optional file path to write primes to (NULL to skip)
+ * @param format Output file format
+ * @return The count of primes found, or SIEVE_ERROR on failure
+ */
+size_t sieve_ctx_write_primes(sieve_ctx *ctx, size_t n, const char *output_file,
+                              sieve_format format);
+
+/**
+ * Find the k-th prime (nth_prime(1) == 2).
+ * 
+ * Jumps to an analytic estimate (inverse of Riemann's R function), counts
+ * the primes up to it with the sublinear Lucy method (O(n^(3/4)) time,
+ * O(sqrt n) memory), and sieves the short stretch to the exact answer.
+ * 
+ * @param k 1-based index of the prime
+ * @return The k-th prime, or 0 if k is 0, the prime exceeds 2^64 - 1 or
+ *         the counting tables could not be allocated
+ */
+uint64_t nth_prime(uint64_t k);
+
+#define SIEVE_TUPLE_MAX      16    // Most members in a counted tuple
+#define SIEVE_TUPLE_MAX_SPAN 1024  // Largest offset of the last member
+
+/**
+ * Count prime k-tuples: the odd p with p + offsets[j] prime for every j and
+ * lo <= p, p + offsets[k - 1] <= hi. Offsets {0, 2} count twin primes,
+ * {0, 4} cousin primes, {0, 2, 6} and {0, 4, 6} prime triplets.
+ *
+ * Tuples are found with word-wide ANDs of the segment bitmaps, including
+ * those that straddle two segments; no prime is written out or decoded.
+ *
+ * @param offsets k even, strictly increasing offsets, the first one 0
+ * @param k Number of members, 2 to SIEVE_TUPLE_MAX
+ * @return The number of tuples, or 0 if the pattern is invalid
+ */
+uint64_t sieve_count_tuples(uint64_t lo, uint64_t hi, const unsigned *offsets, size_t k);
+
+/**
+ * Sharded counting: [lo, hi] is split into count shards of about equal
+ * estimated sieving work (wider shards at small x, narrower ones at large
+ * x), each counted by an independent run and saved as a result record.
+ * Records are in host byte order and end in an FNV-1a checksum.
+ */
+typedef struct {
+    char magic[8];                 // "SIEVESH1"
+    uint32_t version;
+    uint32_t index;                // This shard, 0-based
+    uint32_t count;                // Shards in the split
+    uint32_t reserved;             // Zero
+    uint64_t lo, hi;               // The whole range being split
+    uint64_t shard_lo, shard_hi;   // This shard (empty if shard_lo > shard_hi)
+    uint64_t prime_count;          // Primes in [shard_lo, shard_hi]
+    uint64_t checksum;             // FNV-1a of every byte above
+} sieve_shard_result;
+
+/**
+ * Bounds of shard index of count. Every node computes the same split from
+ * the same arguments; the shards tile [lo, hi] in index order.
+ * 
+ * @return 0 on success, -1 if the shard does not exist (or [lo, hi] holds
+ *         fewer than count numbers)
+ */
+int sieve_shard_range(uint64_t lo, uint64_t hi, uint32_t index, uint32_t count,
+                      uint64_t *shard_lo, uint64_t *shard_hi);
+
+/**
+ * Count the primes of one shard with sieve_range() and fill in its record.
+ * 
+ * @return 0 on success, -1 if the shard does not exist or could not be
+ *         sieved
+ */
+int sieve_shard_run(uint64_t lo, uint64_t hi, uint32_t index, uint32_t count,
+                    sieve_shard_result *result);
+
+/**
+ * sieve_shard_run() on the CPU with the segment cursor and the count so
+ * far saved to state_file at most every `interval` seconds, as in
+ * sieve_write_checkpointed(). A run started again with `resume` set
+ * continues a long shard from its last save; the state file is removed
+ * once the record is filled in.
+ * 
+ * @return 0 on success, -1 if the shard does not exist, the checkpoint
+ *         belongs to another shard or the sieving tables could not be
+ *         allocated
+ */
+int sieve_shard_run_checkpointed(uint64_t lo, uint64_t hi, uint32_t index, uint32_t count,
+                                 const char *state_file, unsigned interval, int resume,
+                                 sieve_shard_result *result);
+
+/**
+ * Save a record under a temporary name and rename it into place, so a
+ * result file is either complete or absent.
+ * 
+ * @return 0 on success, -1 on error
+ */
+int sieve_shard_write(const char *path, const sieve_shard_result *result);
+
+/**
+ * Load a record and verify its magic, version and checksum.
+ * 
+ * @return 0 on success, -1 if the file is missing or not a valid record
+ */
+int sieve_shard_read(const char *path, sieve_shard_result *result);
+
+/**
+ * Read the result files of one split and add up their counts. Fails
+ * unless every shard of the split is present exactly once and the shards
+ * tile [lo, hi] with no gap or overlap.
+ * 
+ * @param total Receives the count of primes in [lo, hi]
+ * @return 0 on success, -1 on error (reported on stderr)
+ */
+int sieve_shard_merge(const char *const *paths, size_t n_paths, uint64_t *total);
+
+/**
+ * Test each of xs[0..n) for primality: out[i] = 1 if xs[i] is prime, else 0.
+ * Inputs below 2^24 are looked up in a bitmap sieved on first use; the rest
+ * get trial division by the primes to 53 and then a deterministic
+ * Miller-Rabin (exact for all 64-bit inputs), several inputs interleaved.
+ */
+void is_prime_batch(const uint64_t *xs, size_t n, uint8_t *out);
+
+/**
+ * One prime power of a factorization.
+ */
+typedef struct {
+    uint64_t prime;
+    unsigned exponent;
+} sieve_factor;
+
+#define SIEVE_FACTOR_MAX 15  // Most distinct prime factors below 2^64
+
+/**
+ * Called once per number, in increasing order, with its prime factors in
+ * increasing order (none for n = 1).
+ */
+typedef void (*sieve_factor_fn)(uint64_t n, const sieve_factor *factors, size_t count,
+                                void *ctx);
+
+/**
+ * Factor every integer in [lo, hi] with a segmented smallest-prime-factor
+ * sieve: each segment lists, per number, the base primes up to sqrt(hi)
+ * that divide it, so no number is trial divided. 0 is skipped. The cost
+ * follows the window width: [10^12, 10^12 + 10^8] needs only the primes
+ * up to 10^6.
+ * 
+ * @return The count of numbers factored, or 0 if fn is NULL, the range is
+ *         empty or the segment tables could not be allocated
+ */
+uint64_t sieve_factor_range(uint64_t lo, uint64_t hi, sieve_factor_fn fn, void *ctx);
+
+/**
+ * On-disk prime table: an odd-only bitmap of [1, limit] with a rank/select
+ * index: the cumulative prime count at every block of SIEVE_CACHE_BLOCK_BITS
+ * bits, the count within the block at every 512 bits, and the block of every
+ * 4096th prime. Opening it is one mmap; counts below the limit cost two table
+ * lookups and a popcount of at most 64 bytes, and the k-th prime a short
+ * search between two samples. Files are in host byte order.
+ */
+typedef struct sieve_cache sieve_cache;
+
+#define SIEVE_CACHE_BLOCK_BITS 4096  // Bits (odd numbers) per cumulative count
+
+/**
+ * Sieve [1, limit] and write a cache file. The file is written under a
+ * temporary name and renamed into place, so readers never see it half done.
+ * 
+ * @return 0 on success, -1 on error
+ */
+int sieve_cache_build(uint64_t limit, const char *path);
+
+/**
+ * Memory-map a cache file read-only.
+ * 
+ * @return The cache, or NULL if the file is missing or not a valid cache
+ */
+sieve_cache *sieve_cache_open(const char *path);
+
+/**
+ * Unmap a cache.
+ */
+void sieve_cache_close(sieve_cache *cache);
+
+/**
+ * @return The largest number the cache covers
+ */
+uint64_t sieve_cache_limit(const sieve_cache *cache);
+
+/**
+ * Count the primes in [lo, hi]. The part above the cached limit, if any,
+ * is sieved with sieve_range().
+ * 
+ * @return The count of primes in [lo, hi], or SIEVE_ERROR if sieving the
+ *         part above the limit failed
+ */
+uint64_t sieve_cache_count(const sieve_cache *cache, uint64_t lo, uint64_t hi);
+
+/**
+ * The k-th prime (k = 1 gives 2), for k up to the number of cached primes.
+ * 
+ * @return The k-th prime, or 0 if k is 0 or beyond the cached limit
+ */
+uint64_t sieve_cache_nth_prime(const sieve_cache *cache, uint64_t k);
+
+/**
+ * is_prime_batch() with the cache as the fast path: inputs up to the cached
+ * limit are read from its bitmap, in sorted order for locality, and only
+ * the ones above it go through Miller-Rabin.
+ */
+void sieve_cache_is_prime_batch(const sieve_cache *cache, const uint64_t *xs, size_t n,
+                                uint8_t *out);
+
+/**
+ * Resident prime table for [0, limit], compressed for memory: numbers are
+ * addressed on the mod-30 wheel, and each block of 61440 numbers keeps its
+ * primes as a wheel bitmap or, when smaller (above a few million), as an
+ * Elias-Fano code of their positions. At 10^10 that is 2.4x smaller
+ * than an odd-only bitmap (258MB). Queries decode only the block involved.
+ */
+typedef struct sieve_table sieve_table;
+
+/**
+ * Sieve [0, limit] into a new table.
+ * 
+ * @return The table, or NULL if it could not be allocated
+ */
+sieve_table *sieve_table_build(uint64_t limit);
+
+/**
+ * Release a table.
+ */
+void sieve_table_free(sieve_table *table);
+
+/**
+ * @return The largest number the table covers
+ */
+uint64_t sieve_table_limit(const sieve_table *table);
+
+/**
+ * @return Bytes held by the table
+ */
+uint64_t sieve_table_bytes(const sieve_table *table);
+
+/**
+ * @return 1 if x is prime, 0 if not, -1 if x is above the table's limit
+ */
+int sieve_table_is_prime(const sieve_table *table, uint64_t x);
+
+/**
+ * @return The smallest prime greater than x, or 0 if there is none up to
+ *         the table's limit
+ */
+uint64_t sieve_table_next_prime(const sieve_table *table, uint64_t x);
+
+/**
+ * Per-phase instrumentation of the single-threaded engines (simple,
+ * segmented, bucket, wheel) and of the Lucy count. Only builds with -DSIEVE_STATS (make STATS=1)
+ * collect anything; otherwise the probes compile away entirely.
+ */
+typedef enum {
+    SIEVE_PHASE_BASE_PRIMES = 0,   /* Base primes up to sqrt(n) */
+    SIEVE_PHASE_SEGMENT_INIT,      /* Pre-sieve fill / memset of each segment */
+    SIEVE_PHASE_MARK,              /* Crossing off multiples */
+    SIEVE_PHASE_COUNT,             /* Popcount of each segment */
+    SIEVE_PHASE_OUTPUT,            /* Formatting and writing primes */
+    SIEVE_PHASE_LUCY,              /* Lucy_Hedgehog table passes (no sieve) */
+    SIEVE_PHASES
+} sieve_phase;
+
+typedef struct {
+    double seconds;                // Wall time summed over all calls
+    uint64_t calls;                // Times the phase was entered
+    int64_t instructions;          // Hardware counters, -1 = unavailable
+    int64_t branch_misses;
+    int64_t l1d_misses;            // L1d read misses
+    int64_t llc_misses;            // Last-level cache misses
+} sieve_phase_stats;
+
+/**
+ * Start or stop collecting. The first start opens the perf_event_open
+ * counters the kernel allows (wall time is always collected).
+ * 
+ * @return 0 on success, -1 if the library was built without SIEVE_STATS
+ */
+int sieve_stats_enable(int on);
+
+/**
+ * Zero the collected totals.
+ */
+void sieve_stats_reset(void);
+
+/**
+ * Copy the totals collected so far, one entry per sieve_phase.
+ */
+void sieve_stats_get(sieve_phase_stats stats[SIEVE_PHASES]);
+
+/**
+ * @return Short name of a phase ("base_primes", "mark", ...)
+ */
+const char *sieve_phase_name(sieve_phase phase);
+
+/**
+ * Scratch-memory arena used by the engines for bitmaps, base primes and
+ * sieving state. Each thread lazily creates its own arena, which is kept
+ * and reused by later calls on that thread; a caller may install its own.
+ */
+typedef struct sieve_arena sieve_arena;
+
+#define SIEVE_ARENA_HUGEPAGES 1u  // Back blocks with MAP_HUGETLB 2MB pages when reserved
+
+/**
+ * Create an arena backed by mmap'd memory.
+ * 
+ * @param initial_size Bytes to reserve up front (the arena grows on demand)
+ * @param flags SIEVE_ARENA_* flags
+ * @return The arena, or NULL if no memory could be mapped
+ */
+sieve_arena *sieve_arena_create(size_t initial_size, unsigned flags);
+
+/**
+ * Create an arena inside caller-supplied memory. Allocations that do not
+ * fit spill into mmap'd blocks, which sieve_arena_destroy() releases.
+ * 
+ * @param buffer Memory owned by the caller; must outlive the arena
+ * @param size Size of buffer in bytes
+ * @param flags SIEVE_ARENA_* flags (apply to spill blocks)
+ * @return The arena, or NULL if buffer is too small to hold its header
+ */
+sieve_arena *sieve_arena_create_in(void *buffer, size_t size, unsigned flags);
+
+/**
+ * Release an arena and every block it mapped.
+ */
+void sieve_arena_destroy(sieve_arena *arena);
+
+/**
+ * Make the calling thread's sieve calls allocate from arena
+ * (NULL = back to the thread's own default arena). Worker threads started
+ * by the parallel engines borrow arenas from a pool the library keeps
+ * between calls.
+ */
+void sieve_set_thread_arena(sieve_arena *arena);
+
+/**
+ * Tuning parameters shared by all engines. Defaults are derived from the
+ * detected cache sizes on first use; sieve_set_config() replaces them.
+ */
+typedef struct {
+    size_t l1d_cache;              // L1 data cache in bytes (0 = unknown)
+    size_t l2_cache;               // L2 cache in bytes (0 = unknown)
+    size_t segment_size;           // Numbers per segment (even)
+    size_t simple_threshold;       // AUTO: simple sieve below this n
+    uint64_t bucket_threshold;     // AUTO: bucket sieve from this n on
+    uint64_t count_threshold;      // AUTO, count only: Lucy pi(x) from this n on
+} sieve_config;
+
+/**
+ * Detect the cache sizes and derive default parameters from them.
+ * 
+ * @param config Filled in on return
+ */
+void sieve_config_detect(sieve_config *config);
+
+/**
+ * The configuration in effect (detected on first call).
+ */
+const sieve_config *sieve_get_config(void);
+
+/**
+ * Replace the configuration in effect. Out-of-range segment sizes are
+ * clamped. Not synchronized with running sieves: call it beforehand.
+ */
+void sieve_set_config(const sieve_config *config);
+
+/**
+ * Override fields of config from a "key = value" file, as written by
+ * sieve_config_save(). Keys missing from the file are left unchanged.
+ * 
+ * @return 0 on success, -1 if the file could not be read or had bad lines
+ */
+int sieve_config_load(sieve_config *config, const char *path);
+
+/**
+ * Write config to a file readable by sieve_config_load().
+ * 
+ * @return 0 on success, -1 on error
+ */
+int sieve_config_save(const sieve_config *config, const char *path);
+
+#endif /* SIEVE_H */
@@ -0,0 +1,266 @@
+#define _GNU_SOURCE  // MAP_ANONYMOUS, MAP_HUGETLB, madvise
+#include "sieve.h"
+#include "sieve_internal.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// ============================================================================
+// MEMORY ARENA
+// ============================================================================
+//
+// Scratch memory for the engines (bitmaps, base primes, sieving state,
+// buckets, output buffers) comes from a bump allocator instead of stack
+// VLAs, so neither n nor sqrt(n) is bounded by the thread's stack size.
+//
+// An arena is a chain of blocks. Engines save a mark on entry and restore it
+// on exit; up to ARENA_KEEP bytes of blocks are kept, so a thread that
+// sieves repeatedly stops mapping memory after its first call. Blocks are
+// mmap'd (2MB-aligned sizes get MADV_HUGEPAGE, or MAP_HUGETLB with
+// SIEVE_ARENA_HUGEPAGES) and are first touched by the thread that owns the
+// arena, so on NUMA systems each worker's pages are placed on its own node.
+// Worker threads of the parallel engines only live for one call; they
+// borrow arenas from a pool so their blocks survive to the next call.
+
+#define ARENA_ALIGN      64                 // Cache line
+#define ARENA_HUGE_PAGE  (2u << 20)
+#define ARENA_MIN_BLOCK  (4u << 20)
+#define ARENA_KEEP       (64u << 20)        // Spare blocks kept after a restore
+
+struct arena_block {
+    arena_block *next;
+    uint8_t *base;
+    size_t size;
+    size_t used;
+    size_t map_size;                        // 0 = caller-supplied memory
+};
+
+struct sieve_arena {
+    arena_block *first;
+    arena_block *current;
+    unsigned flags;
+    int self_mapped;                        // Arena header lives in first block's mapping
+};
+
+static size_t align_up(size_t x, size_t a) {
+    return (x + a - 1) & ~(a - 1);
+}
+
+// Map a block able to hold at least `payload` bytes; the block header sits
+// at the start of the mapping
+static arena_block *arena_map_block(size_t payload, unsigned flags) {
+    size_t header = align_up(sizeof(arena_block), ARENA_ALIGN);
+    size_t map_size = align_up(header + payload, ARENA_HUGE_PAGE);
+    if (map_size < ARENA_MIN_BLOCK) {
+        map_size = ARENA_MIN_BLOCK;
+    }
+    
+    void *mem = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (flags & SIEVE_ARENA_HUGEPAGES) {
+        mem = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+#endif
+    if (mem == MAP_FAILED) {
+        // No reserved huge pages: fall back to transparent huge pages
+        mem = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            fprintf(stderr, "Error: Could not map %zu bytes of sieve memory\n", map_size);
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(mem, map_size, MADV_HUGEPAGE);
+#endif
+    }
+    
+    arena_block *block = mem;
+    block->next = NULL;
+    block->base = (uint8_t *)mem + header;
+    block->size = map_size - header;
+    block->used = 0;
+    block->map_size = map_size;
+    return block;
+}
+
+sieve_arena *sieve_arena_create(size_t initial_size, unsigned flags) {
+    size_t header = align_up(sizeof(sieve_arena), ARENA_ALIGN);
+    arena_block *block = arena_map_block(header + initial_size, flags);
+    if (block == NULL) {
+        return NULL;
+    }
+    
+    // The arena header is the first allocation of its own first block
+    sieve_arena *arena = (sieve_arena *)(void *)block->base;
+    block->used = header;
+    arena->first = block;
+    arena->current = block;
+    arena->flags = flags;
+    arena->self_mapped = 1;
+    return arena;
+}
+
+sieve_arena *sieve_arena_create_in(void *buffer, size_t size, unsigned flags) {
+    uint8_t *start = (uint8_t *)align_up((size_t)buffer, ARENA_ALIGN);
+    size_t header = align_up(sizeof(sieve_arena), ARENA_ALIGN) +
+                    align_up(sizeof(arena_block), ARENA_ALIGN);
+    if (buffer == NULL || (size_t)(start - (uint8_t *)buffer) + header > size) {
+        return NULL;
+    }
+    
+    sieve_arena *arena = (sieve_arena *)(void *)start;
+    arena_block *block = (arena_block *)(void *)(start + align_up(sizeof(sieve_arena), ARENA_ALIGN));
+    block->next = NULL;
+    block->base = start + header;
+    block->size = size - (size_t)(block->base - (uint8_t *)buffer);
+    block->used = 0;
+    block->map_size = 0;
+    
+    arena->first = block;
+    arena->current = block;
+    arena->flags = flags;
+    arena->self_mapped = 0;
+    return arena;
+}
+
+void sieve_arena_destroy(sieve_arena *arena) {
+    if (arena == NULL) {
+        return;
+    }
+    // Unmap overflow blocks first; the first block may hold the arena itself
+    arena_block *block = arena->first->next;
+    while (block != NULL) {
+        arena_block *next = block->next;
+        munmap(block, block->map_size);
+        block = next;
+    }
+    if (arena->self_mapped) {
+        munmap(arena->first, arena->first->map_size);
+    }
+}
+
+void *arena_alloc(sieve_arena *arena, size_t size) {
+    if (arena == NULL) {
+        return NULL;  // No arena could be created for this thread
+    }
+    size = align_up(size, ARENA_ALIGN);
+    
+    // Current block, then any cached blocks after it, then a fresh mapping
+    arena_block *block = arena->current;
+    while (block->size - block->used < size) {
+        if (block->next == NULL) {
+            size_t grow = block->size * 2;
+            block->next = arena_map_block((size > grow) ? size : grow, arena->flags);
+            if (block->next == NULL) {
+                return NULL;
+            }
+        }
+        block = block->next;
+        block->used = 0;
+    }
+    
+    arena->current = block;
+    void *ptr = block->base + block->used;
+    block->used += size;
+    return ptr;
+}
+
+arena_mark arena_save(const sieve_arena *arena) {
+    if (arena == NULL) {
+        return (arena_mark){ NULL, 0 };
+    }
+    return (arena_mark){ arena->current, arena->current->used };
+}
+
+void arena_restore(sieve_arena *arena, arena_mark mark) {
+    if (arena == NULL) {
+        return;
+    }
+    arena->current = mark.block;
+    mark.block->used = mark.used;
+    
+    // Everything past the mark is free again. Keep up to ARENA_KEEP bytes of
+    // it mapped for the next call; one huge run does not pin its memory.
+    size_t kept = 0;
+    arena_block **link = &mark.block->next;
+    while (*link != NULL) {
+        arena_block *block = *link;
+        if (kept + block->map_size <= ARENA_KEEP) {
+            kept += block->map_size;
+            link = &block->next;
+        } else {
+            *link = block->next;
+            munmap(block, block->map_size);
+        }
+    }
+}
+
+// ---- Per-thread arena -------------------------------------------------------
+
+static _Thread_local sieve_arena *thread_arena;       // Set by user or lazily created
+static _Thread_local sieve_arena *thread_default;     // Owned by this thread
+static pthread_key_t arena_key;
+static pthread_once_t arena_key_once = PTHREAD_ONCE_INIT;
+
+static void arena_thread_exit(void *arena) {
+    sieve_arena_destroy(arena);
+}
+
+static void arena_key_create(void) {
+    pthread_key_create(&arena_key, arena_thread_exit);
+}
+
+void sieve_set_thread_arena(sieve_arena *arena) {
+    thread_arena = arena;
+}
+
+sieve_arena *arena_current(void) {
+    if (thread_arena != NULL) {
+        return thread_arena;
+    }
+    if (thread_default == NULL) {
+        pthread_once(&arena_key_once, arena_key_create);
+        thread_default = sieve_arena_create(0, 0);
+        if (thread_default != NULL) {
+            pthread_setspecific(arena_key, thread_default);  // Freed at thread exit
+        }
+    }
+    return thread_default;
+}
+
+// ---- Worker arena pool ------------------------------------------------------
+//
+// Arenas outlive the worker threads they are lent to: each keeps up to
+// ARENA_KEEP bytes of blocks, so a repeated parallel call maps nothing new.
+// A pooled arena may go to another worker next time, whose pages then sit
+// where the first borrower touched them.
+
+#define ARENA_POOL_MAX 256                  // Idle arenas kept; extras are unmapped
+
+static sieve_arena *arena_pool[ARENA_POOL_MAX];
+static size_t arena_pool_size;
+static pthread_mutex_t arena_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+sieve_arena *arena_pool_take(void) {
+    sieve_arena *arena = NULL;
+    pthread_mutex_lock(&arena_pool_lock);
+    if (arena_pool_size > 0) {
+        arena = arena_pool[--arena_pool_size];
+    }
+    pthread_mutex_unlock(&arena_pool_lock);
+    return (arena != NULL) ? arena : sieve_arena_create(0, 0);
+}
+
+void arena_pool_give(sieve_arena *arena) {
+    if (arena == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&arena_pool_lock);
+    if (arena_pool_size < ARENA_POOL_MAX) {
+        arena_pool[arena_pool_size++] = arena;
+        arena = NULL;
+    }
+    pthread_mutex_unlock(&arena_pool_lock);
+    sieve_arena_destroy(arena);
+}
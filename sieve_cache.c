@@ -0,0 +1,447 @@
+#include "sieve.h"
+#include "sieve_internal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// ============================================================================
+// PERSISTENT PRIME TABLE CACHE
+// ============================================================================
+//
+// File layout (host byte order), all of it used in place through one mmap:
+//
+//   [0, CACHE_PAGE)        header (struct sieve_cache)
+//   bitmap_offset          odd-only bitmap of [1, limit], bit i = 2i + 1,
+//                          zero-padded to whole blocks
+//   counts_offset          block_count + 1 uint64_t: counts[b] is the number
+//                          of odd primes in bits [0, b * SIEVE_CACHE_BLOCK_BITS)
+//   sub_offset             CACHE_SUBS uint16_t per block: odd primes in the
+//                          block before each of its 512-bit sub-blocks
+//   select_offset          select_count uint64_t: select[j] is the block that
+//                          holds odd prime number j * CACHE_SELECT_STEP (0-based)
+//
+// pi(x) is then counts[b] + sub[b][s] plus a popcount of at most one 64-byte
+// sub-block (rank). The k-th prime is found from the select sample below it:
+// a short binary search over counts[] between two samples, a scan of eight
+// sub-block counts, then at most eight word popcounts (select). Counts are
+// taken while the sieve fills the bitmap, block by block, so building costs
+// no second pass. The sieve_cache handle is the mapped header itself, so
+// opening a cache allocates nothing and parses nothing beyond a few sanity
+// checks.
+
+#define CACHE_MAGIC       "SIEVEC01"
+#define CACHE_VERSION     2
+#define CACHE_PAGE        4096              // Bitmap starts page-aligned
+#define CACHE_SUB_BITS    512
+#define CACHE_SUBS        (SIEVE_CACHE_BLOCK_BITS / CACHE_SUB_BITS)
+#define CACHE_SELECT_STEP 4096              // Odd primes per select sample
+
+struct sieve_cache {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_bits;
+    uint64_t limit;
+    uint64_t file_size;
+    uint64_t bitmap_offset;
+    uint64_t bitmap_bytes;
+    uint64_t counts_offset;
+    uint64_t block_count;
+    uint64_t prime_count;                   // pi(limit), including 2
+    uint64_t sub_offset;
+    uint64_t select_offset;
+    uint64_t select_count;
+};
+
+#define CACHE_BLOCK_BYTES (SIEVE_CACHE_BLOCK_BITS / 8)
+
+static const uint8_t *cache_bitmap(const sieve_cache *cache) {
+    return (const uint8_t *)cache + cache->bitmap_offset;
+}
+
+static const uint64_t *cache_counts(const sieve_cache *cache) {
+    return (const uint64_t *)((const uint8_t *)cache + cache->counts_offset);
+}
+
+static const uint16_t *cache_subs(const sieve_cache *cache) {
+    return (const uint16_t *)((const uint8_t *)cache + cache->sub_offset);
+}
+
+static const uint64_t *cache_select(const sieve_cache *cache) {
+    return (const uint64_t *)((const uint8_t *)cache + cache->select_offset);
+}
+
+// Odd numbers in [1, x]
+static uint64_t odd_bits_upto(uint64_t x) {
+    return x / 2 + (x & 1);
+}
+
+// Room for select samples: fewer than half the odd numbers (plus a few
+// below 55) are prime; the unused tail stays zero
+static uint64_t select_capacity(uint64_t bit_count) {
+    return (bit_count / 2 + 8) / CACHE_SELECT_STEP + 1;
+}
+
+// ---- Building ---------------------------------------------------------------
+
+typedef struct {
+    uint8_t *bitmap;
+    uint64_t *counts;
+    uint16_t *subs;
+    uint64_t blocks_done;                   // Blocks whose counts are filled in
+} cache_builder;
+
+// Rank entries of block b, while its bits are still in cache
+static void cache_count_block(cache_builder *cb, uint64_t b) {
+    const uint8_t *block = cb->bitmap + b * CACHE_BLOCK_BYTES;
+    uint64_t in_block = 0;
+    for (unsigned s = 0; s < CACHE_SUBS; s++) {
+        cb->subs[b * CACHE_SUBS + s] = (uint16_t)in_block;
+        in_block += popcount_bits(block + s * (CACHE_SUB_BITS / 8), CACHE_SUB_BITS);
+    }
+    cb->counts[b + 1] = cb->counts[b] + in_block;
+}
+
+// OR one sieved segment into the (zero-filled) mapped bitmap at its bit
+// position, then count the blocks it completed
+static void cache_visit_segment(const uint8_t *seg_sieve, uint64_t first_odd,
+                                size_t odd_count, void *ctx) {
+    cache_builder *cb = ctx;
+    uint8_t *bitmap = cb->bitmap;
+    uint64_t bit = (first_odd - 1) / 2;
+    uint8_t *dst = bitmap + bit / 8;
+    unsigned shift = (unsigned)(bit % 8);
+    size_t byte_count = (odd_count + 7) / 8;
+
+    for (size_t k = 0; k < byte_count; k++) {
+        unsigned bits = seg_sieve[k];
+        if (k == byte_count - 1 && odd_count % 8 != 0) {
+            bits &= (1u << (odd_count % 8)) - 1;  // Bits past the window are stale
+        }
+        dst[k] |= (uint8_t)(bits << shift);
+        if (shift != 0 && (bits >> (8 - shift)) != 0) {
+            dst[k + 1] |= (uint8_t)(bits >> (8 - shift));
+        }
+    }
+    if (bit == 0) {
+        CLEAR_BIT(bitmap, 0);                // The window starts at 1, which is no prime
+    }
+    
+    // Bits past the segment are only touched by the shifted spill, which
+    // lands at or after bit + odd_count: every block below that is final
+    uint64_t end = bit + odd_count;
+    while ((cb->blocks_done + 1) * SIEVE_CACHE_BLOCK_BITS <= end) {
+        cache_count_block(cb, cb->blocks_done++);
+    }
+}
+
+int sieve_cache_build(uint64_t limit, const char *path) {
+    uint64_t bit_count = odd_bits_upto(limit);
+    uint64_t block_count = (bit_count + SIEVE_CACHE_BLOCK_BITS - 1) / SIEVE_CACHE_BLOCK_BITS;
+    uint64_t bitmap_bytes = block_count * CACHE_BLOCK_BYTES;
+    uint64_t counts_offset = CACHE_PAGE + bitmap_bytes;
+    uint64_t sub_offset = counts_offset + (block_count + 1) * sizeof(uint64_t);
+    uint64_t select_offset = sub_offset + block_count * CACHE_SUBS * sizeof(uint16_t);
+    uint64_t file_size = select_offset + select_capacity(bit_count) * sizeof(uint64_t);
+    if (file_size > SIZE_MAX || file_size > (uint64_t)INT64_MAX) {
+        fprintf(stderr, "Error: A cache up to %llu does not fit in memory\n",
+                (unsigned long long)limit);
+        return -1;
+    }
+
+    char tmp_path[4096];
+    if ((size_t)snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%ld", path, (long)getpid())
+            >= sizeof(tmp_path)) {
+        fprintf(stderr, "Error: Cache path '%s' is too long\n", path);
+        return -1;
+    }
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Could not create cache file '%s': %s\n", tmp_path, strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)file_size) != 0) {
+        fprintf(stderr, "Error: Could not size cache file '%s': %s\n", tmp_path, strerror(errno));
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+    uint8_t *map = mmap(NULL, (size_t)file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error: Could not map cache file '%s': %s\n", tmp_path, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+
+    // Bitmap and rank counts: one window over [1, limit]; the last block
+    // is counted once the window has filled it as far as it goes
+    cache_builder cb = {
+        .bitmap = map + CACHE_PAGE,
+        .counts = (uint64_t *)(map + counts_offset),
+        .subs = (uint16_t *)(map + sub_offset),
+        .blocks_done = 0,
+    };
+    cb.counts[0] = 0;
+    if (bit_count > 0 && sieve_window(1, 2 * bit_count - 1, cache_visit_segment, &cb) != 0) {
+        munmap(map, (size_t)file_size);
+        unlink(tmp_path);
+        return -1;
+    }
+    while (cb.blocks_done < block_count) {
+        cache_count_block(&cb, cb.blocks_done++);
+    }
+    uint64_t *counts = cb.counts;
+
+    // Select samples: the block of every CACHE_SELECT_STEP-th odd prime
+    uint64_t *select = (uint64_t *)(map + select_offset);
+    uint64_t samples = 0;
+    for (uint64_t b = 0; b < block_count; b++) {
+        while (samples * CACHE_SELECT_STEP < counts[b + 1]) {
+            select[samples++] = b;
+        }
+    }
+
+    // Header last, so a crash mid-build never leaves a valid-looking file
+    sieve_cache *header = (sieve_cache *)map;
+    header->version = CACHE_VERSION;
+    header->block_bits = SIEVE_CACHE_BLOCK_BITS;
+    header->limit = limit;
+    header->file_size = file_size;
+    header->bitmap_offset = CACHE_PAGE;
+    header->bitmap_bytes = bitmap_bytes;
+    header->counts_offset = counts_offset;
+    header->block_count = block_count;
+    header->prime_count = counts[block_count] + (limit >= 2);
+    header->sub_offset = sub_offset;
+    header->select_offset = select_offset;
+    header->select_count = samples;
+    memcpy(header->magic, CACHE_MAGIC, sizeof(header->magic));
+
+    int status = 0;
+    if (msync(map, (size_t)file_size, MS_SYNC) != 0) {
+        fprintf(stderr, "Error: Writing cache file '%s' failed: %s\n", tmp_path, strerror(errno));
+        status = -1;
+    }
+    munmap(map, (size_t)file_size);
+    if (status == 0 && rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Error: Could not rename cache file to '%s': %s\n", path, strerror(errno));
+        status = -1;
+    }
+    if (status != 0) {
+        unlink(tmp_path);
+    }
+    return status;
+}
+
+// ---- Opening ----------------------------------------------------------------
+
+sieve_cache *sieve_cache_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < CACHE_PAGE) {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    const sieve_cache *cache = map;
+    uint64_t bit_count = odd_bits_upto(cache->limit);
+    uint64_t block_count = (bit_count + SIEVE_CACHE_BLOCK_BITS - 1) / SIEVE_CACHE_BLOCK_BITS;
+    int valid = memcmp(cache->magic, CACHE_MAGIC, sizeof(cache->magic)) == 0
+             && cache->version == CACHE_VERSION
+             && cache->block_bits == SIEVE_CACHE_BLOCK_BITS
+             && cache->file_size == (uint64_t)st.st_size
+             && cache->block_count == block_count
+             && cache->bitmap_offset == CACHE_PAGE
+             && cache->bitmap_bytes == block_count * CACHE_BLOCK_BYTES
+             && cache->counts_offset == CACHE_PAGE + cache->bitmap_bytes
+             && cache->sub_offset == cache->counts_offset + (block_count + 1) * sizeof(uint64_t)
+             && cache->select_offset == cache->sub_offset
+                                        + block_count * CACHE_SUBS * sizeof(uint16_t)
+             && cache->file_size == cache->select_offset
+                                    + select_capacity(bit_count) * sizeof(uint64_t)
+             && cache->select_count <= select_capacity(bit_count);
+    if (!valid) {
+        fprintf(stderr, "Error: '%s' is not a valid prime cache\n", path);
+        munmap(map, (size_t)st.st_size);
+        return NULL;
+    }
+    return map;
+}
+
+void sieve_cache_close(sieve_cache *cache) {
+    if (cache != NULL) {
+        munmap(cache, (size_t)cache->file_size);
+    }
+}
+
+// ---- Queries ----------------------------------------------------------------
+
+uint64_t sieve_cache_limit(const sieve_cache *cache) {
+    return cache->limit;
+}
+
+// pi(x) for x <= limit: two count lookups plus a partial sub-block popcount
+static uint64_t cache_pi(const sieve_cache *cache, uint64_t x) {
+    if (x < 2) {
+        return 0;
+    }
+    uint64_t bit = odd_bits_upto(x);
+    uint64_t block = bit / SIEVE_CACHE_BLOCK_BITS;
+    size_t rest = (size_t)(bit % SIEVE_CACHE_BLOCK_BITS);
+    uint64_t count = cache_counts(cache)[block];
+    if (rest != 0) {
+        size_t sub = rest / CACHE_SUB_BITS;
+        count += cache_subs(cache)[block * CACHE_SUBS + sub];
+        if (rest % CACHE_SUB_BITS != 0) {
+            count += popcount_bits(cache_bitmap(cache) + block * CACHE_BLOCK_BYTES
+                                   + sub * (CACHE_SUB_BITS / 8), rest % CACHE_SUB_BITS);
+        }
+    }
+    return count + 1;  // The prime 2
+}
+
+uint64_t sieve_cache_count(const sieve_cache *cache, uint64_t lo, uint64_t hi) {
+    if (lo > hi) {
+        return 0;
+    }
+
+    uint64_t count = 0;
+    if (lo <= cache->limit) {
+        uint64_t top = (hi < cache->limit) ? hi : cache->limit;
+        count = cache_pi(cache, top) - ((lo > 0) ? cache_pi(cache, lo - 1) : 0);
+    }
+    if (hi > cache->limit) {
+        uint64_t above = sieve_range((lo > cache->limit) ? lo : cache->limit + 1, hi, NULL, NULL);
+        if (above == SIEVE_ERROR) {
+            return SIEVE_ERROR;
+        }
+        count += above;
+    }
+    return count;
+}
+
+uint64_t sieve_cache_nth_prime(const sieve_cache *cache, uint64_t k) {
+    if (k == 1 && cache->prime_count >= 1) {
+        return 2;
+    }
+    if (k < 2 || k > cache->prime_count) {
+        return 0;
+    }
+    uint64_t rank = k - 2;                   // 0-based among the odd primes
+    const uint64_t *counts = cache_counts(cache);
+
+    // Last block b with counts[b] <= rank, between the samples around rank
+    uint64_t j = rank / CACHE_SELECT_STEP;
+    uint64_t lo = cache_select(cache)[j];
+    uint64_t hi = (j + 1 < cache->select_count) ? cache_select(cache)[j + 1]
+                                                : cache->block_count - 1;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo + 1) / 2;
+        if (counts[mid] <= rank) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    uint64_t left = rank - counts[lo];
+
+    const uint16_t *subs = cache_subs(cache) + lo * CACHE_SUBS;
+    unsigned s = CACHE_SUBS - 1;
+    while (subs[s] > left) {
+        s--;
+    }
+    left -= subs[s];
+
+    // The word, then the bit, holding the (left + 1)-th set bit
+    const uint8_t *sub = cache_bitmap(cache) + lo * CACHE_BLOCK_BYTES + s * (CACHE_SUB_BITS / 8);
+    for (unsigned w = 0; w < CACHE_SUB_BITS / 64; w++) {
+        uint64_t bits;
+        memcpy(&bits, sub + 8 * w, sizeof(bits));
+        unsigned ones = (unsigned)__builtin_popcountll(bits);
+        if (left < ones) {
+            for (; left > 0; left--) {
+                bits &= bits - 1;
+            }
+            uint64_t bit = lo * SIEVE_CACHE_BLOCK_BITS + s * CACHE_SUB_BITS + 64 * w
+                         + (uint64_t)__builtin_ctzll(bits);
+            return 2 * bit + 1;
+        }
+        left -= ones;
+    }
+    return 0;                                // Unreachable on a valid cache
+}
+
+// ---- Batched primality ------------------------------------------------------
+//
+// Lookups into a large cache are cache misses in input order, so each chunk
+// of in-range inputs is sorted first and read in address order. Inputs above
+// the limit are gathered and passed to is_prime_batch() together.
+
+#define CACHE_BATCH 4096
+
+typedef struct {
+    uint64_t x;
+    size_t slot;
+} cache_query;
+
+static int compare_queries(const void *a, const void *b) {
+    uint64_t x = ((const cache_query *)a)->x, y = ((const cache_query *)b)->x;
+    return (x > y) - (x < y);
+}
+
+void sieve_cache_is_prime_batch(const sieve_cache *cache, const uint64_t *xs, size_t n,
+                                uint8_t *out) {
+    sieve_arena *arena = arena_current();
+    arena_mark mark = arena_save(arena);
+    cache_query *queries = arena_alloc(arena, CACHE_BATCH * sizeof(*queries));
+    uint64_t *far_xs = arena_alloc(arena, CACHE_BATCH * sizeof(*far_xs));
+    size_t *far_slots = arena_alloc(arena, CACHE_BATCH * sizeof(*far_slots));
+    uint8_t *far_out = arena_alloc(arena, CACHE_BATCH);
+    if (queries == NULL || far_xs == NULL || far_slots == NULL || far_out == NULL) {
+        arena_restore(arena, mark);
+        is_prime_batch(xs, n, out);          // Correct, just without the cache
+        return;
+    }
+
+    const uint8_t *bitmap = cache_bitmap(cache);
+    for (size_t start = 0; start < n; start += CACHE_BATCH) {
+        size_t end = (n - start > CACHE_BATCH) ? start + CACHE_BATCH : n;
+        size_t near = 0, far = 0;
+        for (size_t i = start; i < end; i++) {
+            if (xs[i] > cache->limit) {
+                far_xs[far] = xs[i];
+                far_slots[far++] = i;
+            } else if ((xs[i] & 1) == 0) {
+                out[i] = (xs[i] == 2);
+            } else {
+                queries[near].x = xs[i];
+                queries[near++].slot = i;
+            }
+        }
+
+        qsort(queries, near, sizeof(*queries), compare_queries);
+        for (size_t q = 0; q < near; q++) {
+            uint64_t x = queries[q].x;
+            out[queries[q].slot] = (x > 1) && GET_BIT(bitmap, x / 2) != 0;
+        }
+
+        is_prime_batch(far_xs, far, far_out);
+        for (size_t f = 0; f < far; f++) {
+            out[far_slots[f]] = far_out[f];
+        }
+    }
+    arena_restore(arena, mark);
+}
@@ -0,0 +1,125 @@
+#include "sieve.h"
+#include "sieve_internal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// ============================================================================
+// CHECKPOINTS: resumable segmented runs
+// ============================================================================
+//
+// segmented_run() calls checkpoint_segment() after each segment; between
+// saves that is one clock read. A save fsyncs the output first and then
+// replaces the state file atomically (tmp + fsync + rename), so a crash at
+// any point leaves a state that is at or behind the bytes on disk. Resuming
+// cuts the output back to the recorded offset and sieves on from next_low
+// with a fresh sieve state: only the cursor, the count and the writer's
+// position are saved, never the segment bitmap or the large-prime offsets.
+// Count-only shards (sieve_shard_run_checkpointed) save the same state
+// with no writer, from the sieve_window() visitor.
+
+#define CHECKPOINT_MAGIC   "SIEVECK1"
+#define CHECKPOINT_VERSION 2                // 1: no lo field, whole-range runs only
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    checkpoint_state state;
+    uint64_t checksum;                      // FNV-1a of the bytes before it
+} checkpoint_record;
+
+static uint64_t checkpoint_checksum(const checkpoint_record *r) {
+    const uint8_t *bytes = (const uint8_t *)r;
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < offsetof(checkpoint_record, checksum); i++) {
+        h = (h ^ bytes[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static double checkpoint_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int checkpoint_save(const char *path, const checkpoint_state *st) {
+    checkpoint_record r;
+    memset(&r, 0, sizeof(r));
+    memcpy(r.magic, CHECKPOINT_MAGIC, sizeof(r.magic));
+    r.version = CHECKPOINT_VERSION;
+    r.state = *st;
+    r.checksum = checkpoint_checksum(&r);
+
+    char tmp_path[4096];
+    if ((size_t)snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%ld", path, (long)getpid())
+            >= sizeof(tmp_path)) {
+        fprintf(stderr, "Error: Checkpoint path '%s' is too long\n", path);
+        return -1;
+    }
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Could not create checkpoint '%s': %s\n", tmp_path, strerror(errno));
+        return -1;
+    }
+    int ok = write(fd, &r, sizeof(r)) == (ssize_t)sizeof(r) && fsync(fd) == 0;
+    ok = (close(fd) == 0) && ok;
+    if (!ok || rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Error: Writing checkpoint '%s' failed: %s\n", path, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+int checkpoint_load(const char *path, checkpoint_state *st) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    checkpoint_record r;
+    ssize_t got = read(fd, &r, sizeof(r));
+    close(fd);
+    if (got != (ssize_t)sizeof(r)
+            || memcmp(r.magic, CHECKPOINT_MAGIC, sizeof(r.magic)) != 0
+            || r.version != CHECKPOINT_VERSION
+            || r.checksum != checkpoint_checksum(&r)) {
+        return -1;
+    }
+    *st = r.state;
+    return 0;
+}
+
+void checkpoint_segment(segment_checkpoint *cp, prime_writer *w,
+                        uint64_t next_low, uint64_t prime_count) {
+    if (cp->error) {
+        return;
+    }
+    double now = checkpoint_clock();
+    if (now < cp->next_due) {
+        return;
+    }
+    cp->next_due = now + cp->interval;
+
+    checkpoint_state *st = &cp->state;
+    st->next_low = next_low;
+    st->prime_count = prime_count;
+    if (w != NULL) {
+        if (prime_writer_sync(w) != 0) {
+            cp->error = 1;
+            return;
+        }
+        st->output_offset = w->written;
+        st->last_prime = w->last_prime;
+        st->bit_pos = w->bit_pos;
+        st->acc = w->acc;
+    }
+    if (checkpoint_save(cp->path, st) != 0) {
+        cp->error = 1;
+    }
+}
@@ -0,0 +1,285 @@
+#include "sieve.h"
+#include "sieve_internal.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#include <sys/sysctl.h>
+#endif
+
+// ============================================================================
+// RUNTIME CONFIGURATION: segment size and engine crossovers
+// ============================================================================
+//
+// The best segment size depends on the data cache: sieve_state_mark()
+// scatters writes over one segment bitmap, so the bitmap should stay in L1d.
+// Cache sizes come from sysconf() (glibc reads them via cpuid on x86), then
+// from sysfs where sysconf reports nothing (typical on arm64), and from
+// sysctl on macOS. When nothing is known the old fixed values are used.
+
+#ifndef BUCKET_THRESHOLD
+#define BUCKET_THRESHOLD 100000000000ULL  // 10^11
+#endif
+
+#ifndef COUNT_THRESHOLD
+#define COUNT_THRESHOLD 100000              // Lucy wins from about 10^4 on
+#endif
+
+#define SEGMENT_SIZE_DEFAULT (256 * 1024)  // Used when the L1d size is unknown
+#define THRESHOLD_DEFAULT    10000000      // 10 million
+#define SEGMENT_SIZE_MIN     1024
+#define SEGMENT_SIZE_MAX     ((size_t)1 << 31)  // Bucket offsets are 32-bit
+
+static sieve_config active_config;
+static pthread_once_t config_once = PTHREAD_ONCE_INIT;
+
+#if defined(__linux__)
+// Size of the cpu0 cache at `level` whose type matches ("Data"/"Unified")
+static size_t cache_size_sysfs(unsigned level, const char *type) {
+    for (unsigned index = 0; index < 8; index++) {
+        char path[96];
+        char value[32];
+        unsigned found_level = 0;
+        
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%u/level", index);
+        FILE *f = fopen(path, "r");
+        if (f == NULL) {
+            break;
+        }
+        int ok = (fscanf(f, "%u", &found_level) == 1);
+        fclose(f);
+        if (!ok || found_level != level) {
+            continue;
+        }
+        
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%u/type", index);
+        f = fopen(path, "r");
+        if (f == NULL) {
+            continue;
+        }
+        ok = (fscanf(f, "%31s", value) == 1);
+        fclose(f);
+        if (!ok || (strcmp(value, type) != 0 && strcmp(value, "Unified") != 0)) {
+            continue;
+        }
+        
+        // "48K", "2048K" or "1M"
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%u/size", index);
+        f = fopen(path, "r");
+        if (f == NULL) {
+            continue;
+        }
+        unsigned long size = 0;
+        char unit = '\0';
+        ok = (fscanf(f, "%lu%c", &size, &unit) >= 1);
+        fclose(f);
+        if (ok) {
+            if (unit == 'K') size <<= 10;
+            if (unit == 'M') size <<= 20;
+            return (size_t)size;
+        }
+    }
+    return 0;
+}
+#endif
+
+static size_t detect_cache(unsigned level) {
+    long size = 0;
+#if defined(_SC_LEVEL1_DCACHE_SIZE) && defined(_SC_LEVEL2_CACHE_SIZE)
+    size = sysconf(level == 1 ? _SC_LEVEL1_DCACHE_SIZE : _SC_LEVEL2_CACHE_SIZE);
+#endif
+#if defined(__linux__)
+    if (size <= 0) {
+        size = (long)cache_size_sysfs(level, "Data");
+    }
+#elif defined(__APPLE__)
+    if (size <= 0) {
+        uint64_t value = 0;
+        size_t len = sizeof(value);
+        if (sysctlbyname(level == 1 ? "hw.l1dcachesize" : "hw.l2cachesize",
+                         &value, &len, NULL, 0) == 0) {
+            size = (long)value;
+        }
+    }
+#endif
+    return (size > 0) ? (size_t)size : 0;
+}
+
+// Keep a configuration usable by every engine
+static void config_sanitize(sieve_config *config) {
+    if (config->segment_size < SEGMENT_SIZE_MIN) {
+        config->segment_size = SEGMENT_SIZE_MIN;
+    }
+    if (config->segment_size > SEGMENT_SIZE_MAX) {
+        config->segment_size = SEGMENT_SIZE_MAX;
+    }
+    config->segment_size &= ~(size_t)1;  // Segments hold whole odd/even pairs
+}
+
+void sieve_config_detect(sieve_config *config) {
+    config->l1d_cache = detect_cache(1);
+    config->l2_cache = detect_cache(2);
+    config->segment_size = SEGMENT_SIZE_DEFAULT;
+    config->simple_threshold = THRESHOLD_DEFAULT;
+    config->bucket_threshold = BUCKET_THRESHOLD;
+    config->count_threshold = COUNT_THRESHOLD;
+    
+    if (config->l1d_cache != 0) {
+        // One segment bitmap (16 numbers per byte) fills the largest power
+        // of two that fits in L1d; the simple sieve wins only while its
+        // whole bitmap fits there too
+        size_t bitmap = 1;
+        while (bitmap * 2 <= config->l1d_cache) {
+            bitmap *= 2;
+        }
+        config->segment_size = bitmap * 16;
+        config->simple_threshold = config->l1d_cache * 16;
+    }
+#ifdef SEGMENT_SIZE
+    config->segment_size = SEGMENT_SIZE;  // Pinned at build time
+#endif
+    config_sanitize(config);
+}
+
+static void config_init(void) {
+    sieve_config_detect(&active_config);
+}
+
+const sieve_config *sieve_get_config(void) {
+    pthread_once(&config_once, config_init);
+    return &active_config;
+}
+
+void sieve_set_config(const sieve_config *config) {
+    pthread_once(&config_once, config_init);
+    active_config = *config;
+    config_sanitize(&active_config);
+}
+
+// ---- Config file: "key = value" lines, '#' starts a comment -----------------
+
+#define SIMPLE_THRESHOLD_MAX ((uint64_t)1 << 36)  // A 4GB simple-sieve bitmap
+
+// Every key a tuning file may set, with the values it accepts. Out-of-range
+// values are rejected rather than clamped, so a typo cannot silently turn
+// into an absurd segment size or threshold.
+#define CONFIG_KEY(field, min, max) \
+    { #field, offsetof(sieve_config, field), sizeof(((sieve_config *)0)->field), min, max }
+
+static const struct {
+    const char *key;
+    size_t offset;
+    size_t size;                            // sizeof(size_t) or sizeof(uint64_t)
+    uint64_t min, max;
+} config_keys[] = {
+    CONFIG_KEY(l1d_cache,        0,                SEGMENT_SIZE_MAX),
+    CONFIG_KEY(l2_cache,         0,                (uint64_t)1 << 40),
+    CONFIG_KEY(segment_size,     SEGMENT_SIZE_MIN, SEGMENT_SIZE_MAX),
+    CONFIG_KEY(simple_threshold, 0,                SIMPLE_THRESHOLD_MAX),
+    CONFIG_KEY(bucket_threshold, 0,                UINT64_MAX),
+    CONFIG_KEY(count_threshold,  0,                UINT64_MAX),
+};
+#define CONFIG_KEY_COUNT (sizeof(config_keys) / sizeof(config_keys[0]))
+
+// Unsigned decimal: digits only (no sign, which strtoull would negate
+// around 2^64) and within 64 bits
+static int parse_config_value(const char *text, uint64_t *value) {
+    if (*text < '0' || *text > '9') {
+        return 0;
+    }
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(text, &end, 10);
+    if (errno == ERANGE || *end != '\0') {
+        return 0;
+    }
+    *value = (uint64_t)v;
+    return 1;
+}
+
+int sieve_config_load(sieve_config *config, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Error: Could not open config file '%s'\n", path);
+        return -1;
+    }
+    
+    char line[256];
+    int status = 0;
+    for (unsigned lineno = 1; fgets(line, sizeof(line), f) != NULL; lineno++) {
+        char key[64];
+        char text[32];
+        uint64_t value;
+        char *hash = strchr(line, '#');
+        if (hash != NULL) {
+            *hash = '\0';
+        }
+        
+        if (line[strspn(line, " \t\r\n")] == '\0') {
+            continue;  // Blank or comment-only line
+        }
+        char tail;
+        if (sscanf(line, " %63[a-z0-9_] = %31s %c", key, text, &tail) != 2) {
+            fprintf(stderr, "Error: %s:%u: expected 'key = value'\n", path, lineno);
+            status = -1;
+            continue;
+        }
+        
+        size_t k = 0;
+        while (k < CONFIG_KEY_COUNT && strcmp(key, config_keys[k].key) != 0) {
+            k++;
+        }
+        if (k == CONFIG_KEY_COUNT) {
+            fprintf(stderr, "Error: %s:%u: unknown key '%s'\n", path, lineno, key);
+            status = -1;
+            continue;
+        }
+        if (!parse_config_value(text, &value) || value < config_keys[k].min ||
+            value > config_keys[k].max) {
+            fprintf(stderr, "Error: %s:%u: %s must be an integer from %llu to %llu, not '%s'\n",
+                    path, lineno, key, (unsigned long long)config_keys[k].min,
+                    (unsigned long long)config_keys[k].max, text);
+            status = -1;
+            continue;
+        }
+        
+        uint8_t *field = (uint8_t *)config + config_keys[k].offset;
+        if (config_keys[k].size == sizeof(uint64_t)) {
+            memcpy(field, &value, sizeof(value));
+        } else {
+            size_t narrow = (size_t)value;   // Range checked against the field
+            memcpy(field, &narrow, sizeof(narrow));
+        }
+    }
+    
+    fclose(f);
+    config_sanitize(config);
+    return status;
+}
+
+int sieve_config_save(const sieve_config *config, const char *path) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Error: Could not open config file '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+    
+    fprintf(f, "# Sieve tuning parameters\n");
+    fprintf(f, "l1d_cache = %zu\n", config->l1d_cache);
+    fprintf(f, "l2_cache = %zu\n", config->l2_cache);
+    fprintf(f, "segment_size = %zu\n", config->segment_size);
+    fprintf(f, "simple_threshold = %zu\n", config->simple_threshold);
+    fprintf(f, "bucket_threshold = %llu\n", (unsigned long long)config->bucket_threshold);
+    fprintf(f, "count_threshold = %llu\n", (unsigned long long)config->count_threshold);
+    
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Error: Writing config file '%s' failed\n", path);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include "sieve.h"
+#include "sieve_internal.h"
+
+// ============================================================================
+// LUCY_HEDGEHOG PRIME COUNTING: pi(n) without sieving [1, n]
+// ============================================================================
+//
+// S(v) starts as the count of 2..v and, after processing the prime p, holds
+// the count of numbers in 2..v that are prime or have no prime factor <= p.
+// Only the values v = n / i occur, so S lives in two tables of sqrt(n)
+// entries: small[v] for v <= r and large[i] = S(n / i) for i <= r. Sifting
+// out p changes S(v) for every v >= p^2 by
+//
+//     S(v) -= S(v / p) - S(p - 1)
+//
+// and once every p <= r has been processed, large[1] = S(n) = pi(n). The
+// whole pass costs O(n^(3/4) / log n) operations and O(sqrt(n)) memory.
+
+size_t prime_count_lucy(size_t n) {
+    if (n < 2) {
+        return 0;
+    }
+
+    size_t r = isqrt(n);
+    size_t base_count;
+    sieve_arena *arena = arena_current();
+    arena_mark mark = arena_save(arena);
+    size_t *base_primes = arena_base_primes(arena, r, &base_count);
+    uint64_t *small = arena_alloc(arena, (r + 1) * sizeof(uint64_t));
+    uint64_t *large = arena_alloc(arena, (r + 1) * sizeof(uint64_t));
+    if (base_primes == NULL || small == NULL || large == NULL) {
+        arena_restore(arena, mark);
+        return 0;
+    }
+
+    STATS_BEGIN(SIEVE_PHASE_LUCY);
+    small[0] = 0;
+    for (size_t v = 1; v <= r; v++) {
+        small[v] = v - 1;
+        large[v] = n / v - 1;
+    }
+
+    for (size_t k = 0; k < base_count; k++) {
+        uint64_t p = base_primes[k];
+        uint64_t sp = small[p - 1];              // pi(p - 1)
+        uint64_t p2 = p * p;
+
+        // large[i] for n / i >= p^2; n / (i*p) is large[i*p] while i*p <= r
+        size_t large_end = (n / p2 < r) ? (size_t)(n / p2) : r;
+        size_t direct_end = (r / p < large_end) ? r / p : large_end;
+        for (size_t i = 1; i <= direct_end; i++) {
+            large[i] -= large[i * p] - sp;
+        }
+        // n / (i*p) == (n / p) / i < 2^32: a double quotient is off by at
+        // most one, and cheaper than a 64-bit divide
+        uint64_t np = n / p;
+        double npd = (double)np;
+        for (size_t i = direct_end + 1; i <= large_end; i++) {
+            uint64_t q = (uint64_t)(npd / (double)i);
+            q -= (q * i > np);
+            q += ((q + 1) * i <= np);
+            large[i] -= small[q] - sp;
+        }
+
+        // small[v] for v >= p^2, top down so small[v / p] is still old.
+        // v / p is constant over runs of p values, which avoids dividing
+        for (size_t q = r / p; q >= p; q--) {
+            uint64_t delta = small[q] - sp;
+            size_t run_end = (q * p + p - 1 < r) ? q * p + p - 1 : r;
+            for (size_t v = q * p; v <= run_end; v++) {
+                small[v] -= delta;
+            }
+        }
+    }
+
+    STATS_END(SIEVE_PHASE_LUCY);
+
+    size_t prime_count = (size_t)large[1];
+    arena_restore(arena, mark);
+    return prime_count;
+}
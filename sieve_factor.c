@@ -0,0 +1,158 @@
+#include "sieve.h"
+#include "sieve_internal.h"
+#include <string.h>
+
+// ============================================================================
+// FACTOR SIEVE: full factorizations of every integer in [lo, hi]
+// ============================================================================
+//
+// Instead of clearing bits, each segment records for every number the odd
+// base primes (up to sqrt(hi)) that divide it, in ascending order, so the
+// first entry is its smallest odd prime factor. The entries are base-prime
+// indices, one, two or four bytes wide depending on how many base primes
+// the window needs: a window at 10^12 has 78497 odd base primes and takes
+// 32-bit entries, one below 4*10^9 fits in 16 bits. They are laid out per
+// number (CSR): a counting pass fills counts[], a prefix sum turns them into
+// start offsets, and a second pass over the same multiples writes the
+// indices. Both passes step through the segment like the segmented engine,
+// one carried offset per base prime.
+//
+// Factorizations are then read off without trial division: powers of 2 come
+// from ctz, each listed prime is divided out as a multiply by its inverse,
+// and what is left after the listed primes is 1 or the one prime factor
+// above sqrt(hi) (the large cofactor), which is reported last.
+
+#ifndef FACTOR_SEGMENT
+#define FACTOR_SEGMENT (1u << 16)          // Numbers per segment
+#endif
+
+// Most prime factors >= span one number below 2^64 can have
+static unsigned large_factor_max(uint64_t span) {
+    unsigned k = 0;
+    for (uint64_t v = 1; v <= UINT64_MAX / span; v *= span) {
+        k++;
+    }
+    return k;
+}
+
+static inline void entry_store(void *entries, unsigned width, uint32_t k, uint32_t index) {
+    switch (width) {
+        case 1:  ((uint8_t *)entries)[k] = (uint8_t)index; break;
+        case 2:  ((uint16_t *)entries)[k] = (uint16_t)index; break;
+        default: ((uint32_t *)entries)[k] = index; break;
+    }
+}
+
+static inline uint32_t entry_load(const void *entries, unsigned width, uint32_t k) {
+    switch (width) {
+        case 1:  return ((const uint8_t *)entries)[k];
+        case 2:  return ((const uint16_t *)entries)[k];
+        default: return ((const uint32_t *)entries)[k];
+    }
+}
+
+uint64_t sieve_factor_range(uint64_t lo, uint64_t hi, sieve_factor_fn fn, void *ctx) {
+    uint64_t first = (lo == 0) ? 1 : lo;
+    if (fn == NULL || first > hi) {
+        return 0;
+    }
+
+    sieve_arena *arena = arena_current();
+    arena_mark mark = arena_save(arena);
+    size_t base_count;
+    size_t *base_primes = arena_base_primes(arena, isqrt(hi), &base_count);
+    if (base_primes == NULL) {
+        arena_restore(arena, mark);
+        return 0;
+    }
+
+    // A segment holds at most span/p + 1 multiples of each p < span, and no
+    // number has more than large_factor_max(span) prime factors >= span
+    size_t span = FACTOR_SEGMENT;
+    size_t capacity = (size_t)large_factor_max(span) * span;
+    for (size_t j = 1; j < base_count && base_primes[j] < span; j++) {
+        capacity += span / base_primes[j] + 1;
+    }
+    unsigned width = (base_count <= UINT8_MAX) ? 1 : (base_count <= UINT16_MAX) ? 2 : 4;
+
+    // Offsets stay below p < 2^32; inverses make each division a multiply
+    uint32_t *next_offset = arena_alloc(arena, (base_count + 1) * sizeof(uint32_t));
+    uint64_t *inverses = arena_alloc(arena, (base_count + 1) * sizeof(uint64_t));
+    uint8_t *counts = arena_alloc(arena, span);
+    uint32_t *start = arena_alloc(arena, (span + 1) * sizeof(uint32_t));
+    void *entries = arena_alloc(arena, capacity * width);
+    if (next_offset == NULL || inverses == NULL || counts == NULL || start == NULL
+            || entries == NULL) {
+        arena_restore(arena, mark);
+        return 0;
+    }
+    for (size_t j = 1; j < base_count; j++) {
+        uint64_t p = base_primes[j];
+        uint64_t r = first % p;
+        next_offset[j] = (uint32_t)((r == 0) ? 0 : p - r);
+        inverses[j] = inverse_mod_2_64(p);
+    }
+
+    // Step by count rather than by value so hi = 2^64 - 1 cannot wrap
+    uint64_t total = hi - first + 1;
+    sieve_factor factors[SIEVE_FACTOR_MAX];
+    for (uint64_t done = 0; done < total; ) {
+        uint64_t base = first + done;
+        size_t len = (total - done < span) ? (size_t)(total - done) : span;
+
+        memset(counts, 0, len);
+        for (size_t j = 1; j < base_count; j++) {
+            size_t p = base_primes[j];
+            for (uint64_t i = next_offset[j]; i < len; i += p) {
+                counts[i]++;
+            }
+        }
+
+        // start[i + 1] is number i's write cursor; after the fill it has
+        // advanced to the end of i's entries, which is where i + 1's begin
+        start[0] = 0;
+        start[1] = 0;
+        for (size_t i = 1; i < len; i++) {
+            start[i + 1] = start[i] + counts[i - 1];
+        }
+        for (size_t j = 1; j < base_count; j++) {
+            size_t p = base_primes[j];
+            uint64_t i = next_offset[j];
+            for (; i < len; i += p) {
+                entry_store(entries, width, start[i + 1]++, (uint32_t)j);
+            }
+            next_offset[j] = (uint32_t)(i - len);
+        }
+
+        for (size_t i = 0; i < len; i++) {
+            uint64_t n = base + i;
+            uint64_t m = n;
+            size_t count = 0;
+            if ((m & 1) == 0) {
+                unsigned e = (unsigned)__builtin_ctzll(m);
+                factors[count++] = (sieve_factor){ .prime = 2, .exponent = e };
+                m >>= e;
+            }
+            for (uint32_t k = start[i]; k < start[i + 1]; k++) {
+                uint32_t j = entry_load(entries, width, k);
+                uint64_t p = base_primes[j];
+                unsigned e = 0;
+                // m * p^-1 is the quotient exactly when it times p fits in 64 bits
+                for (uint64_t q = m * inverses[j]; ((unsigned __int128)q * p) >> 64 == 0;
+                     q = m * inverses[j]) {
+                    m = q;
+                    e++;
+                }
+                factors[count++] = (sieve_factor){ .prime = p, .exponent = e };
+            }
+            if (m > 1) {
+                factors[count++] = (sieve_factor){ .prime = m, .exponent = 1 };
+            }
+            fn(n, factors, count, ctx);
+        }
+        done += len;
+    }
+
+    arena_restore(arena, mark);
+    return total;
+}
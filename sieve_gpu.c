@@ -0,0 +1,387 @@
+#include "sieve.h"
+#include "sieve_internal.h"
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ============================================================================
+// GPU BACKEND: count-only segmented sieve on an OpenCL device
+// ============================================================================
+//
+// One work-group sieves one segment of odd numbers in local memory (a bitmap
+// of up to GPU_MAX_SEGMENT bytes, as the device allows): primes with many
+// hits per segment are crossed off by the whole group (lane j takes
+// multiples j, j + lanes, ...), the rest are striped over the lanes one
+// prime each. The group then popcounts its bitmap and
+// stores a single count, so only 4 bytes per segment cross the bus. Batches
+// of segments alternate between two queues, which keeps the device busy
+// while the host collects and sums the previous batch.
+//
+// libOpenCL is opened with dlopen(), so building needs no OpenCL SDK and a
+// machine without a driver or device just takes the CPU path. A new device
+// must first reproduce the CPU count of a few check windows, or the backend
+// stays off. It serves SIEVE_ENGINE_GPU; wide count-only sieve_range()
+// calls use it only with SIEVE_GPU=1 in the environment, and SIEVE_GPU=0
+// turns it off altogether.
+
+#define GPU_BATCH_SEGMENTS 2048             // Segments per kernel launch
+#define GPU_QUEUES         2
+#define GPU_GROUP_SIZE     256              // Lanes per work-group, at most
+#define GPU_MAX_SEGMENT    32768            // Bytes of local memory per segment
+#define GPU_GROUP_PRIMES   64               // Hits per segment that make a prime shared
+
+// ---- The few OpenCL 1.2 entry points used, resolved at run time -------------
+
+typedef int32_t cl_int;
+typedef uint32_t cl_uint;
+typedef uint64_t cl_ulong;
+typedef void *cl_handle;                    // Platform, device, context, queue, ...
+
+#define CL_SUCCESS                    0
+#define CL_DEVICE_TYPE_GPU            (1u << 2)
+#define CL_DEVICE_TYPE_ACCELERATOR    (1u << 3)
+#define CL_DEVICE_MAX_WORK_GROUP_SIZE 0x1004
+#define CL_DEVICE_MAX_MEM_ALLOC_SIZE  0x1010
+#define CL_DEVICE_LOCAL_MEM_SIZE      0x1023
+#define CL_DEVICE_NAME                0x102B
+#define CL_MEM_WRITE_ONLY             (1u << 1)
+#define CL_MEM_READ_ONLY              (1u << 2)
+#define CL_MEM_COPY_HOST_PTR          (1u << 5)
+
+typedef struct {
+    cl_int (*GetPlatformIDs)(cl_uint, cl_handle *, cl_uint *);
+    cl_int (*GetDeviceIDs)(cl_handle, cl_ulong, cl_uint, cl_handle *, cl_uint *);
+    cl_int (*GetDeviceInfo)(cl_handle, cl_uint, size_t, void *, size_t *);
+    cl_handle (*CreateContext)(const intptr_t *, cl_uint, const cl_handle *, void *, void *, cl_int *);
+    cl_handle (*CreateCommandQueue)(cl_handle, cl_handle, cl_ulong, cl_int *);
+    cl_handle (*CreateProgramWithSource)(cl_handle, cl_uint, const char **, const size_t *, cl_int *);
+    cl_int (*BuildProgram)(cl_handle, cl_uint, const cl_handle *, const char *, void *, void *);
+    cl_handle (*CreateKernel)(cl_handle, const char *, cl_int *);
+    cl_handle (*CreateBuffer)(cl_handle, cl_ulong, size_t, void *, cl_int *);
+    cl_int (*SetKernelArg)(cl_handle, cl_uint, size_t, const void *);
+    cl_int (*EnqueueNDRangeKernel)(cl_handle, cl_handle, cl_uint, const size_t *, const size_t *,
+                                   const size_t *, cl_uint, const cl_handle *, cl_handle *);
+    cl_int (*EnqueueReadBuffer)(cl_handle, cl_handle, cl_uint, size_t, size_t, void *,
+                                cl_uint, const cl_handle *, cl_handle *);
+    cl_int (*Finish)(cl_handle);
+    cl_int (*ReleaseMemObject)(cl_handle);
+} cl_api;
+
+static const char *const cl_names[] = {
+    "clGetPlatformIDs", "clGetDeviceIDs", "clGetDeviceInfo", "clCreateContext",
+    "clCreateCommandQueue", "clCreateProgramWithSource", "clBuildProgram", "clCreateKernel",
+    "clCreateBuffer", "clSetKernelArg", "clEnqueueNDRangeKernel", "clEnqueueReadBuffer",
+    "clFinish", "clReleaseMemObject",
+};
+
+// ---- Device code ------------------------------------------------------------
+
+static const char *const gpu_kernel_source =
+    "__kernel void sieve_count(ulong first_odd, ulong total_odds, ulong seg_base,\n"
+    "                          __global const uint *primes, uint group_primes,\n"
+    "                          uint prime_count, __global uint *counts) {\n"
+    "    __local uint bits[SEG_BITS / 32];\n"
+    "    __local uint total;\n"
+    "    uint lid = get_local_id(0), lanes = get_local_size(0);\n"
+    "    ulong first_bit = (seg_base + get_group_id(0)) * SEG_BITS;\n"
+    "    if (first_bit >= total_odds) {\n"
+    "        return;                              /* Whole group: past the range */\n"
+    "    }\n"
+    "    uint nbits = (uint)min((ulong)SEG_BITS, total_odds - first_bit);\n"
+    "    ulong low = first_odd + 2 * first_bit, high = low + 2 * (ulong)(nbits - 1);\n"
+    "    for (uint i = lid; i < SEG_BITS / 32; i += lanes) bits[i] = 0xffffffffu;\n"
+    "    if (lid == 0) total = 0;\n"
+    "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+    "    for (uint k = 0; k < prime_count; ) {\n"
+    "        uint shared = (k < group_primes);\n"
+    "        uint pick = shared ? k : k + lid;\n"
+    "        k += shared ? 1 : lanes;\n"
+    "        if (pick >= prime_count) break;\n"
+    "        ulong p = primes[pick], sq = p * p;\n"
+    "        if (sq > high) break;                /* Primes are sorted */\n"
+    "        ulong start = sq;\n"
+    "        if (sq < low) {\n"
+    "            ulong r = low % p;\n"
+    "            start = (r == 0) ? low : low + (p - r);\n"
+    "            if ((start & 1) == 0) start += p;\n"
+    "        }\n"
+    "        ulong b = (start - low) / 2, step = p;\n"
+    "        if (shared) { b += lid * p; step = p * lanes; }\n"
+    "        for (; b < nbits; b += step) atomic_and(&bits[b / 32], ~(1u << (b % 32)));\n"
+    "    }\n"
+    "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+    "    uint c = 0;\n"
+    "    for (uint i = lid; 32 * i < nbits; i += lanes) {\n"
+    "        uint w = bits[i], left = nbits - 32 * i;\n"
+    "        if (left < 32) w &= (1u << left) - 1;\n"
+    "        c += popcount(w);\n"
+    "    }\n"
+    "    atomic_add(&total, c);\n"
+    "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+    "    if (lid == 0) counts[get_group_id(0)] = total;\n"
+    "}\n";
+
+// ---- Device setup, once per process -----------------------------------------
+
+static struct {
+    cl_api cl;
+    cl_handle context;
+    cl_handle queues[GPU_QUEUES];
+    cl_handle counts[GPU_QUEUES];           // Per-batch segment counts on the device
+    cl_handle kernel;
+    size_t lanes;
+    size_t segment_bits;
+    uint64_t max_alloc;
+    char name[128];
+    int ready;
+    int implicit;                           // SIEVE_GPU=1: sieve_range() may use it
+} gpu;
+
+static pthread_once_t gpu_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t gpu_lock = PTHREAD_MUTEX_INITIALIZER;  // One kernel object
+
+static int gpu_load_api(void) {
+    void *lib = dlopen("libOpenCL.so.1", RTLD_NOW | RTLD_LOCAL);
+    if (lib == NULL) {
+        lib = dlopen("libOpenCL.so", RTLD_NOW | RTLD_LOCAL);
+    }
+    if (lib == NULL) {
+        return -1;
+    }
+    // cl_api lists its pointers in cl_names order
+    for (size_t i = 0; i < sizeof(cl_names) / sizeof(cl_names[0]); i++) {
+        void *sym = dlsym(lib, cl_names[i]);
+        if (sym == NULL) {
+            return -1;
+        }
+        memcpy((char *)&gpu.cl + i * sizeof(sym), &sym, sizeof(sym));
+    }
+    return 0;
+}
+
+// First GPU (or accelerator) of any platform
+static cl_handle gpu_find_device(void) {
+    cl_handle platforms[16];
+    cl_uint n_platforms = 0;
+    if (gpu.cl.GetPlatformIDs(16, platforms, &n_platforms) != CL_SUCCESS) {
+        return NULL;
+    }
+    for (cl_uint i = 0; i < n_platforms && i < 16; i++) {
+        cl_handle device;
+        cl_uint n_devices = 0;
+        if (gpu.cl.GetDeviceIDs(platforms[i], CL_DEVICE_TYPE_GPU | CL_DEVICE_TYPE_ACCELERATOR,
+                                1, &device, &n_devices) == CL_SUCCESS && n_devices > 0) {
+            return device;
+        }
+    }
+    return NULL;
+}
+
+static int gpu_count_device(uint64_t first_odd, uint64_t last_odd, uint64_t *count);
+
+// Windows the device must count exactly like the CPU before it is used:
+// shared and striped primes, partial last segments and offsets past 2^32.
+// About 55ms of CPU sieving, once per process
+static int gpu_self_check(void) {
+    static const uint64_t windows[][2] = {
+        { 3, 9999999 },
+        { 1000000000001ULL, 1000000000001ULL + 10000000 },
+        { (1ULL << 44) + 1, (1ULL << 44) + 4000001 },
+    };
+    for (size_t i = 0; i < sizeof(windows) / sizeof(windows[0]); i++) {
+        uint64_t device, host = sieve_range(windows[i][0], windows[i][1], NULL, NULL);
+        if (host == SIEVE_ERROR || gpu_count_device(windows[i][0], windows[i][1], &device) != 0
+                || device != host) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void gpu_init(void) {
+    const char *env = getenv("SIEVE_GPU");
+    if ((env != NULL && strcmp(env, "0") == 0) || gpu_load_api() != 0) {
+        return;
+    }
+    gpu.implicit = (env != NULL && strcmp(env, "1") == 0);
+    cl_handle device = gpu_find_device();
+    if (device == NULL) {
+        return;
+    }
+
+    size_t max_group = 0;
+    cl_ulong local_mem = 0, max_alloc = 0;
+    if (gpu.cl.GetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(max_group),
+                             &max_group, NULL) != CL_SUCCESS
+            || gpu.cl.GetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(local_mem),
+                                    &local_mem, NULL) != CL_SUCCESS
+            || gpu.cl.GetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc),
+                                    &max_alloc, NULL) != CL_SUCCESS
+            || gpu.cl.GetDeviceInfo(device, CL_DEVICE_NAME, sizeof(gpu.name) - 1,
+                                    gpu.name, NULL) != CL_SUCCESS
+            || local_mem < 2048) {
+        return;
+    }
+    gpu.lanes = (max_group < GPU_GROUP_SIZE) ? max_group : GPU_GROUP_SIZE;
+    gpu.max_alloc = max_alloc;
+
+    // Largest power-of-two bitmap that leaves 1KB of local memory spare
+    size_t segment_bytes = GPU_MAX_SEGMENT;
+    while (segment_bytes + 1024 > local_mem) {
+        segment_bytes /= 2;
+    }
+    gpu.segment_bits = segment_bytes * 8;
+
+    cl_int err;
+    gpu.context = gpu.cl.CreateContext(NULL, 1, &device, NULL, NULL, &err);
+    if (err != CL_SUCCESS) {
+        return;
+    }
+    for (int q = 0; q < GPU_QUEUES; q++) {
+        gpu.queues[q] = gpu.cl.CreateCommandQueue(gpu.context, device, 0, &err);
+        if (err != CL_SUCCESS) {
+            return;
+        }
+        gpu.counts[q] = gpu.cl.CreateBuffer(gpu.context, CL_MEM_WRITE_ONLY,
+                                            GPU_BATCH_SEGMENTS * sizeof(cl_uint), NULL, &err);
+        if (err != CL_SUCCESS) {
+            return;
+        }
+    }
+
+    char options[64];
+    snprintf(options, sizeof(options), "-D SEG_BITS=%zuu", gpu.segment_bits);
+    const char *source = gpu_kernel_source;
+    cl_handle program = gpu.cl.CreateProgramWithSource(gpu.context, 1, &source, NULL, &err);
+    if (err != CL_SUCCESS
+            || gpu.cl.BuildProgram(program, 1, &device, options, NULL, NULL) != CL_SUCCESS) {
+        return;
+    }
+    gpu.kernel = gpu.cl.CreateKernel(program, "sieve_count", &err);
+    gpu.ready = (err == CL_SUCCESS && gpu_self_check() == 0);
+}
+
+const char *sieve_gpu_device(void) {
+    pthread_once(&gpu_once, gpu_init);
+    return gpu.ready ? gpu.name : NULL;
+}
+
+int gpu_range_enabled(void) {
+    return sieve_gpu_device() != NULL && gpu.implicit;
+}
+
+// ---- Counting ---------------------------------------------------------------
+
+// Wait for a batch and add up its segment counts
+static int gpu_collect(int q, const cl_uint *host_counts, size_t segments, uint64_t *sum) {
+    if (gpu.cl.Finish(gpu.queues[q]) != CL_SUCCESS) {
+        return -1;
+    }
+    for (size_t s = 0; s < segments; s++) {
+        *sum += host_counts[s];
+    }
+    return 0;
+}
+
+static int gpu_run(uint64_t first_odd, uint64_t total_odds, cl_handle primes,
+                   cl_uint group_primes, cl_uint prime_count, cl_uint *host_counts,
+                   uint64_t *count) {
+    uint64_t segments = (total_odds + gpu.segment_bits - 1) / gpu.segment_bits;
+    size_t pending[GPU_QUEUES] = { 0 };
+    uint64_t sum = 0;
+    int status = 0;
+
+    for (uint64_t base = 0, batch = 0; status == 0 && base < segments;
+         base += GPU_BATCH_SEGMENTS, batch++) {
+        int q = (int)(batch % GPU_QUEUES);
+        cl_uint *slot = host_counts + (size_t)q * GPU_BATCH_SEGMENTS;
+        if (pending[q] != 0) {
+            status = gpu_collect(q, slot, pending[q], &sum);
+            pending[q] = 0;
+        }
+        size_t n_segments = (segments - base < GPU_BATCH_SEGMENTS)
+                          ? (size_t)(segments - base) : GPU_BATCH_SEGMENTS;
+        size_t global = n_segments * gpu.lanes;
+        cl_ulong args[3] = { first_odd, total_odds, base };
+        for (cl_uint a = 0; a < 3; a++) {
+            status |= gpu.cl.SetKernelArg(gpu.kernel, a, sizeof(cl_ulong), &args[a]);
+        }
+        status |= gpu.cl.SetKernelArg(gpu.kernel, 3, sizeof(cl_handle), &primes);
+        status |= gpu.cl.SetKernelArg(gpu.kernel, 4, sizeof(cl_uint), &group_primes);
+        status |= gpu.cl.SetKernelArg(gpu.kernel, 5, sizeof(cl_uint), &prime_count);
+        status |= gpu.cl.SetKernelArg(gpu.kernel, 6, sizeof(cl_handle), &gpu.counts[q]);
+        if (status == 0) {
+            status = gpu.cl.EnqueueNDRangeKernel(gpu.queues[q], gpu.kernel, 1, NULL, &global,
+                                                 &gpu.lanes, 0, NULL, NULL);
+        }
+        if (status == 0) {
+            status = gpu.cl.EnqueueReadBuffer(gpu.queues[q], gpu.counts[q], 0, 0,
+                                              n_segments * sizeof(cl_uint), slot, 0, NULL, NULL);
+        }
+        if (status == 0) {
+            pending[q] = n_segments;
+        }
+    }
+    for (int q = 0; q < GPU_QUEUES; q++) {
+        if (pending[q] != 0 && gpu_collect(q, host_counts + (size_t)q * GPU_BATCH_SEGMENTS,
+                                           pending[q], &sum) != 0) {
+            status = -1;
+        }
+    }
+    *count = sum;
+    return (status == 0) ? 0 : -1;
+}
+
+int gpu_count_odd(uint64_t first_odd, uint64_t last_odd, uint64_t *count) {
+    if (sieve_gpu_device() == NULL) {
+        return -1;
+    }
+    return gpu_count_device(first_odd, last_odd, count);
+}
+
+// gpu_count_odd() once the device is set up (also during the self-check)
+static int gpu_count_device(uint64_t first_odd, uint64_t last_odd, uint64_t *count) {
+    // Odd base primes up to sqrt(last_odd), packed to 32 bits for the device
+    sieve_arena *arena = arena_current();
+    arena_mark mark = arena_save(arena);
+    size_t base_count;
+    size_t *base_primes = arena_base_primes(arena, isqrt(last_odd), &base_count);
+    cl_uint *primes = (base_primes != NULL)
+                    ? arena_alloc(arena, (base_count + 1) * sizeof(cl_uint)) : NULL;
+    cl_uint *host_counts = arena_alloc(arena, GPU_QUEUES * GPU_BATCH_SEGMENTS * sizeof(cl_uint));
+    if (primes == NULL || host_counts == NULL) {
+        arena_restore(arena, mark);
+        return -1;
+    }
+    cl_uint n_primes = 0, group_primes = 0;
+    for (size_t i = 0; i < base_count; i++) {
+        if (base_primes[i] == 2) {
+            continue;
+        }
+        if (base_primes[i] * GPU_GROUP_PRIMES < gpu.segment_bits) {
+            group_primes = n_primes + 1;     // Enough hits to share among the lanes
+        }
+        primes[n_primes++] = (cl_uint)base_primes[i];
+    }
+    primes[n_primes] = 0;                     // Keeps the buffer non-empty
+
+    int status = -1;
+    pthread_mutex_lock(&gpu_lock);
+    cl_int err;
+    size_t bytes = ((size_t)n_primes + 1) * sizeof(cl_uint);
+    cl_handle primes_mem = (bytes <= gpu.max_alloc)
+        ? gpu.cl.CreateBuffer(gpu.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes,
+                              primes, &err)
+        : NULL;
+    if (primes_mem != NULL && err == CL_SUCCESS) {
+        status = gpu_run(first_odd, (last_odd - first_odd) / 2 + 1, primes_mem, group_primes,
+                         n_primes, host_counts, count);
+        gpu.cl.ReleaseMemObject(primes_mem);
+    }
+    pthread_mutex_unlock(&gpu_lock);
+
+    arena_restore(arena, mark);
+    return status;
+}
@@ -0,0 +1,215 @@
+#ifndef SIEVE_INTERNAL_H
+#define SIEVE_INTERNAL_H
+
+#include "sieve.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Helpers shared between the sieve engines; not part of the public API
+
+// BIT ARRAY MACROS for odd-only sieve
+// Bit index i represents odd number (2*i + 1)
+#define GET_BIT(arr, i)   ((arr)[(i) >> 3] & (1 << ((i) & 7)))
+#define CLEAR_BIT(arr, i) ((arr)[(i) >> 3] &= ~(1 << ((i) & 7)))
+#define SET_BIT(arr, i)   ((arr)[(i) >> 3] |= (1 << ((i) & 7)))
+
+// Hot kernels (marking, decoding, scanning). A portable build (make
+// PORTABLE=1) compiles the tree for a baseline ISA and each SIEVE_KERNEL
+// function once more per wider level; the loader picks one per host by
+// cpuid (ifunc). Native builds already target the host and need no clones.
+#if defined(SIEVE_PORTABLE) && defined(__x86_64__) && defined(__GNUC__)
+#define SIEVE_KERNEL_CLONES 1
+#define SIEVE_KERNEL __attribute__((target_clones("arch=x86-64-v4", "arch=x86-64-v3", "default")))
+#elif defined(SIEVE_PORTABLE) && defined(__aarch64__) && defined(__GNUC__) && __GNUC__ >= 14 \
+      && !defined(__clang__)
+#define SIEVE_KERNEL_CLONES 1
+#define SIEVE_KERNEL __attribute__((target_clones("sve", "default")))
+#else
+#define SIEVE_KERNEL
+#endif
+
+// Segment span (numbers per segment) comes from sieve_get_config() at run
+// time; building with -DSEGMENT_SIZE=... pins it (sieve_config.c)
+
+// Find base primes up to limit (inclusive) using simple odd-only sieve;
+// SIEVE_ERROR if its bitmap cannot be allocated
+size_t find_base_primes(size_t limit, size_t *primes, size_t max_primes);
+
+// Allocate a table from arena and fill it with the primes up to limit;
+// returns NULL if the arena is out of memory
+size_t *arena_base_primes(sieve_arena *arena, size_t limit, size_t *count);
+
+// floor(sqrt(n)), exact even where double rounding is not
+size_t isqrt(size_t n);
+
+// Upper bound on pi(limit), used to size base-prime tables
+size_t max_prime_count(size_t limit);
+
+// Called once per sieved segment; bit i of seg_sieve is first_odd + 2*i
+typedef void (*segment_visit_fn)(const uint8_t *seg_sieve, uint64_t first_odd,
+                                 size_t odd_count, void *ctx);
+
+// Sieve the odd numbers in [first_odd, last_odd] segment by segment and
+// visit each one (sieve.c). Bit 0 of a window starting at 1 stays set.
+// Returns 0, or -1 (before any visit) if the tables cannot be allocated
+int sieve_window(uint64_t first_odd, uint64_t last_odd,
+                 segment_visit_fn visit, void *ctx);
+
+// Bitmap word k of a segment (odd numbers first_odd + 128k ...), with the
+// stale bits past odd_count cleared
+static inline uint64_t segment_word(const uint8_t *seg_sieve, size_t odd_count, size_t k) {
+    size_t left = odd_count - 64 * k;
+    uint64_t bits = 0;
+    memcpy(&bits, seg_sieve + 8 * k, (left >= 64) ? 8 : (left + 7) / 8);
+    if (left < 64) {
+        bits &= (1ULL << left) - 1;
+    }
+    return bits;
+}
+
+// n^-1 mod 2^64 for odd n, by Newton's iteration. For odd p, x is a multiple
+// of p iff x * p^-1 <= (2^64 - 1) / p, and then x * p^-1 is the quotient
+static inline uint64_t inverse_mod_2_64(uint64_t n) {
+    uint64_t inv = n;                        // Right to 3 bits for odd n
+    for (int i = 0; i < 5; i++) {
+        inv *= 2 - n * inv;                  // Each step doubles the correct bits
+    }
+    return inv;
+}
+
+// Count set bits in bits[0, bit_count), using the widest popcount kernel
+// the CPU supports (sieve_popcount.c)
+size_t popcount_bits(const uint8_t *bits, size_t bit_count);
+
+// Scratch arena (sieve_arena.c). Engines save a mark on entry and restore
+// it before returning; allocations are 64-byte aligned and NULL on failure
+// (a NULL arena is accepted and fails every allocation)
+typedef struct arena_block arena_block;
+
+typedef struct {
+    arena_block *block;
+    size_t used;
+} arena_mark;
+
+// The calling thread's arena, created on first use
+sieve_arena *arena_current(void);
+
+// Arenas for the parallel engines' worker threads, which only live for one
+// call: take one on thread start and give it back before exiting, so its
+// blocks are reused by the next call. take() returns NULL if none can be made
+sieve_arena *arena_pool_take(void);
+void arena_pool_give(sieve_arena *arena);
+
+void *arena_alloc(sieve_arena *arena, size_t size);
+arena_mark arena_save(const sieve_arena *arena);
+void arena_restore(sieve_arena *arena, arena_mark mark);
+
+// Buffered prime writer (sieve_output.c); see sieve_format for the layouts
+#define WRITER_BUFFER_SIZE (1 << 20)
+
+typedef struct {
+    int fd;
+    sieve_format format;
+    int error;
+    uint64_t limit;           // Bitmap format covers [1, limit]
+    uint64_t last_prime;      // Base of the next varint gap
+    uint64_t bit_pos;         // Bitmap format: bits emitted so far
+    uint8_t acc;              // Bitmap format: partially filled byte
+    uint64_t written;         // Bytes handed to write() so far
+    size_t len;
+    uint8_t buf[WRITER_BUFFER_SIZE];
+} prime_writer;
+
+// Returns 0 on success; reports the error on stderr and returns -1 otherwise
+int prime_writer_open(prime_writer *w, const char *path, sieve_format format, uint64_t limit);
+
+// Reopen an output file to continue a checkpointed run: the file is cut
+// back to `offset` bytes and the gap/bitmap state restored. Returns 0 on
+// success; reports the error on stderr and returns -1 otherwise
+int prime_writer_resume(prime_writer *w, const char *path, sieve_format format, uint64_t limit,
+                        uint64_t offset, uint64_t last_prime, uint64_t bit_pos, uint8_t acc);
+
+// Flush the buffer and fsync, so everything counted in w->written is on
+// disk; returns -1 if any write failed
+int prime_writer_sync(prime_writer *w);
+
+// Append one prime; primes must arrive in increasing order
+void prime_writer_put(prime_writer *w, uint64_t prime);
+
+// Append every prime of an odd-only segment (bit i = first_odd + 2*i)
+void prime_writer_put_segment(prime_writer *w, const uint8_t *seg_sieve,
+                              uint64_t first_odd, size_t odd_count);
+
+// Byte formats (TEXT, U32, U64, VARINT) into a caller buffer; VARINT gaps
+// run from *last_prime, which is updated. out needs FORMAT_MAX_BYTES per
+// prime, and U32 callers must check the range first. Return bytes written.
+#define FORMAT_MAX_BYTES 21   // 20 decimal digits and a newline
+size_t format_prime(uint8_t *out, sieve_format format, uint64_t prime, uint64_t *last_prime);
+size_t format_segment(uint8_t *out, sieve_format format, const uint8_t *seg_sieve,
+                      uint64_t first_odd, size_t odd_count, uint64_t *last_prime);
+
+// Flush and close; returns -1 if any write failed
+int prime_writer_close(prime_writer *w);
+
+// Phase probes (sieve_stats.c). Without SIEVE_STATS they are no-ops, so
+// they cost nothing in normal builds; keep them out of per-prime loops.
+#ifdef SIEVE_STATS
+void stats_begin(sieve_phase phase);
+void stats_end(sieve_phase phase);
+#define STATS_BEGIN(phase) stats_begin(phase)
+#define STATS_END(phase)   stats_end(phase)
+#else
+#define STATS_BEGIN(phase) ((void)0)
+#define STATS_END(phase)   ((void)0)
+#endif
+
+// Checkpoints of segmented runs and of count-only shards (sieve_checkpoint.c).
+// A state records where the next segment starts, the primes counted below
+// it and the output writer's position; saving one flushes the writer first,
+// so the state never points past what is on disk.
+typedef struct {
+    uint64_t n;               // Last number of the run
+    uint64_t lo;              // First number: 0, or a shard's shard_lo
+    uint64_t next_low;        // First number of the next segment (0 = fresh run)
+    uint64_t prime_count;     // Primes below next_low
+    uint32_t has_output;
+    uint32_t format;          // sieve_format, if has_output
+    uint64_t output_offset;   // Bytes of output on disk
+    uint64_t last_prime;      // Writer state at output_offset
+    uint64_t bit_pos;
+    uint64_t acc;
+} checkpoint_state;
+
+typedef struct {
+    const char *path;
+    double interval;          // Seconds between saves (0 = every segment)
+    double next_due;
+    checkpoint_state state;
+    int error;                // A save failed; later saves are skipped
+} segment_checkpoint;
+
+// Returns 0 and fills st from a valid state file; -1 if missing or invalid
+int checkpoint_load(const char *path, checkpoint_state *st);
+
+// Called after every segment; saves at most once per interval
+void checkpoint_segment(segment_checkpoint *cp, prime_writer *w,
+                        uint64_t next_low, uint64_t prime_count);
+
+// OpenCL backend (sieve_gpu.c). Counts the primes among the odd numbers in
+// [first_odd, last_odd], first_odd >= 3; returns -1 if no device is
+// usable or the kernel fails, and the caller sieves on the CPU instead.
+// gpu_range_enabled() says whether sieve_range() may use it unasked
+// (SIEVE_GPU=1 and a device that passed its self-check)
+#define GPU_MIN_RANGE 100000000000ULL      // Narrower ranges are not worth the setup
+int gpu_count_odd(uint64_t first_odd, uint64_t last_odd, uint64_t *count);
+int gpu_range_enabled(void);
+
+// Engines (sieve_wheel.c); w == NULL counts only. SIEVE_ERROR if the
+// arena runs out, like the engines in sieve.c
+size_t sieve_wheel30(size_t n, prime_writer *w);
+
+// Count-only pi(n) by the Lucy_Hedgehog method (sieve_count.c)
+size_t prime_count_lucy(size_t n);
+
+#endif /* SIEVE_INTERNAL_H */
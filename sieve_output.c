@@ -0,0 +1,296 @@
+#include "sieve.h"
+#include "sieve_internal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// ============================================================================
+// PRIME OUTPUT WRITER
+// ============================================================================
+//
+// Replaces per-prime fprintf(): primes are formatted by hand into a large
+// buffer that is flushed with write(). Formats:
+//   TEXT    - one decimal prime per line
+//   U32/U64 - raw fixed-width integers in host byte order
+//   VARINT  - LEB128 varint of the gap to the previous prime (first gap from 0)
+//   BITMAP  - odd-only bitmap of [1, limit]: bit i (LSB first) is 2*i + 1;
+//             the prime 2 is implied
+
+#define WRITER_SLACK 32  // Room for the longest single encoded prime
+
+static void writer_flush(prime_writer *w) {
+    size_t done = 0;
+    while (done < w->len && !w->error) {
+        ssize_t r = write(w->fd, w->buf + done, w->len - done);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Error: Write to output file failed: %s\n", strerror(errno));
+            w->error = 1;
+        } else {
+            done += (size_t)r;
+        }
+    }
+    w->written += done;
+    w->len = 0;
+}
+
+int prime_writer_open(prime_writer *w, const char *path, sieve_format format, uint64_t limit) {
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w->fd < 0) {
+        fprintf(stderr, "Error: Could not open output file '%s'\n", path);
+        return -1;
+    }
+    w->format = format;
+    w->error = 0;
+    w->limit = limit;
+    w->last_prime = 0;
+    w->bit_pos = 0;
+    w->acc = 0;
+    w->written = 0;
+    w->len = 0;
+    return 0;
+}
+
+int prime_writer_resume(prime_writer *w, const char *path, sieve_format format, uint64_t limit,
+                        uint64_t offset, uint64_t last_prime, uint64_t bit_pos, uint8_t acc) {
+    w->fd = open(path, O_WRONLY);
+    if (w->fd < 0) {
+        fprintf(stderr, "Error: Could not reopen output file '%s'\n", path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(w->fd, &st) != 0 || (uint64_t)st.st_size < offset ||
+        ftruncate(w->fd, (off_t)offset) != 0 || lseek(w->fd, (off_t)offset, SEEK_SET) < 0) {
+        fprintf(stderr, "Error: Output file '%s' is shorter than its checkpoint\n", path);
+        close(w->fd);
+        return -1;
+    }
+    w->format = format;
+    w->error = 0;
+    w->limit = limit;
+    w->last_prime = last_prime;
+    w->bit_pos = bit_pos;
+    w->acc = acc;
+    w->written = offset;
+    w->len = 0;
+    return 0;
+}
+
+int prime_writer_sync(prime_writer *w) {
+    writer_flush(w);
+    if (!w->error && fsync(w->fd) != 0) {
+        fprintf(stderr, "Error: Syncing output file failed: %s\n", strerror(errno));
+        w->error = 1;
+    }
+    return w->error ? -1 : 0;
+}
+
+// Two digits at a time from a 200-byte table
+static const char digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static size_t format_decimal(char *out, uint64_t value) {
+    char tmp[24];
+    char *p = tmp + sizeof(tmp);
+    
+    while (value >= 100) {
+        unsigned pair = (unsigned)(value % 100);
+        value /= 100;
+        p -= 2;
+        memcpy(p, digit_pairs + 2 * pair, 2);
+    }
+    if (value >= 10) {
+        p -= 2;
+        memcpy(p, digit_pairs + 2 * value, 2);
+    } else {
+        *--p = (char)('0' + value);
+    }
+    
+    size_t len = (size_t)(tmp + sizeof(tmp) - p);
+    memcpy(out, p, len);
+    return len;
+}
+
+// ---- Byte formats into a caller buffer -------------------------------------
+
+size_t format_prime(uint8_t *out, sieve_format format, uint64_t prime, uint64_t *last_prime) {
+    size_t len = 0;
+    switch (format) {
+    case SIEVE_FORMAT_U32: {
+        uint32_t v = (uint32_t)prime;
+        memcpy(out, &v, sizeof(v));
+        len = sizeof(v);
+        break;
+    }
+    case SIEVE_FORMAT_U64:
+        memcpy(out, &prime, sizeof(prime));
+        len = sizeof(prime);
+        break;
+    case SIEVE_FORMAT_VARINT: {
+        uint64_t gap = prime - *last_prime;
+        while (gap >= 0x80) {
+            out[len++] = (uint8_t)(gap | 0x80);
+            gap >>= 7;
+        }
+        out[len++] = (uint8_t)gap;
+        break;
+    }
+    case SIEVE_FORMAT_TEXT:
+    default:
+        len = format_decimal((char *)out, prime);
+        out[len++] = '\n';
+        break;
+    }
+    *last_prime = prime;
+    return len;
+}
+
+SIEVE_KERNEL
+size_t format_segment(uint8_t *out, sieve_format format, const uint8_t *seg_sieve,
+                      uint64_t first_odd, size_t odd_count, uint64_t *last_prime) {
+    size_t len = 0;
+    for (size_t k = 0; 64 * k < odd_count; k++) {
+        uint64_t bits = segment_word(seg_sieve, odd_count, k);
+        uint64_t word_first = first_odd + 128 * (uint64_t)k;
+        while (bits != 0) {
+            len += format_prime(out + len, format,
+                                word_first + 2 * (uint64_t)__builtin_ctzll(bits), last_prime);
+            bits &= bits - 1;
+        }
+    }
+    return len;
+}
+
+// ---- Bitmap format: a bit stream with a partial byte in acc -----------------
+
+static void bitmap_emit_byte(prime_writer *w, uint8_t byte) {
+    if (w->len == WRITER_BUFFER_SIZE) {
+        writer_flush(w);
+    }
+    w->buf[w->len++] = byte;
+}
+
+// Append zero bits until bit_pos == target
+static void bitmap_pad(prime_writer *w, uint64_t target) {
+    if (target <= w->bit_pos) {
+        return;
+    }
+    unsigned used = (unsigned)(w->bit_pos % 8);
+    if (used != 0) {
+        uint64_t fill = 8 - used;
+        if (target - w->bit_pos < fill) {
+            w->bit_pos = target;
+            return;
+        }
+        bitmap_emit_byte(w, w->acc);
+        w->acc = 0;
+        w->bit_pos += fill;
+    }
+    while (target - w->bit_pos >= 8) {
+        size_t room = WRITER_BUFFER_SIZE - w->len;
+        uint64_t bytes = (target - w->bit_pos) / 8;
+        size_t chunk = (bytes < room) ? (size_t)bytes : room;
+        memset(w->buf + w->len, 0, chunk);
+        w->len += chunk;
+        w->bit_pos += 8 * (uint64_t)chunk;
+        if (w->len == WRITER_BUFFER_SIZE) {
+            writer_flush(w);
+        }
+    }
+    w->bit_pos = target;
+}
+
+// Append bits[0, bit_count) at bit_pos
+static void bitmap_append(prime_writer *w, const uint8_t *bits, size_t bit_count) {
+    unsigned shift = (unsigned)(w->bit_pos % 8);
+    size_t full = bit_count / 8;
+    
+    for (size_t i = 0; i < full; i++) {
+        uint8_t b = bits[i];
+        bitmap_emit_byte(w, (uint8_t)(w->acc | (b << shift)));
+        w->acc = shift ? (uint8_t)(b >> (8 - shift)) : 0;
+    }
+    w->bit_pos += 8 * (uint64_t)full;
+    
+    for (size_t i = full * 8; i < bit_count; i++) {
+        if (GET_BIT(bits, i)) {
+            w->acc |= (uint8_t)(1u << (w->bit_pos % 8));
+        }
+        if (++w->bit_pos % 8 == 0) {
+            bitmap_emit_byte(w, w->acc);
+            w->acc = 0;
+        }
+    }
+}
+
+// ---- Public writer API ------------------------------------------------------
+
+void prime_writer_put(prime_writer *w, uint64_t prime) {
+    if (w->len + WRITER_SLACK > WRITER_BUFFER_SIZE) {
+        writer_flush(w);
+    }
+    
+    if (w->format == SIEVE_FORMAT_U32 && prime > UINT32_MAX) {
+        if (!w->error) {
+            fprintf(stderr, "Error: Prime %llu does not fit the u32 output format\n",
+                    (unsigned long long)prime);
+        }
+        w->error = 1;
+        return;
+    }
+    if (w->format == SIEVE_FORMAT_BITMAP) {
+        if (prime % 2 == 1) {
+            bitmap_pad(w, (prime - 1) / 2);
+            w->acc |= (uint8_t)(1u << (w->bit_pos % 8));
+            if (++w->bit_pos % 8 == 0) {
+                bitmap_emit_byte(w, w->acc);
+                w->acc = 0;
+            }
+        }
+        w->last_prime = prime;
+        return;
+    }
+    w->len += format_prime(w->buf + w->len, w->format, prime, &w->last_prime);
+}
+
+// Emit the primes of one 64-bit bitmap word with ctz / clear-lowest-bit
+static inline void writer_put_word(prime_writer *w, uint64_t bits, uint64_t first_prime) {
+    while (bits != 0) {
+        prime_writer_put(w, first_prime + 2 * (uint64_t)__builtin_ctzll(bits));
+        bits &= bits - 1;
+    }
+}
+
+SIEVE_KERNEL
+void prime_writer_put_segment(prime_writer *w, const uint8_t *seg_sieve,
+                              uint64_t first_odd, size_t odd_count) {
+    if (w->format == SIEVE_FORMAT_BITMAP) {
+        bitmap_pad(w, (first_odd - 1) / 2);
+        bitmap_append(w, seg_sieve, odd_count);
+        return;
+    }
+    
+    for (size_t k = 0; 64 * k < odd_count; k++) {
+        writer_put_word(w, segment_word(seg_sieve, odd_count, k), first_odd + 128 * (uint64_t)k);
+    }
+}
+
+int prime_writer_close(prime_writer *w) {
+    if (w->format == SIEVE_FORMAT_BITMAP) {
+        bitmap_pad(w, (w->limit + 1) / 2);
+        if (w->bit_pos % 8 != 0) {
+            bitmap_emit_byte(w, w->acc);
+        }
+    }
+    writer_flush(w);
+    if (close(w->fd) != 0 && !w->error) {
+        fprintf(stderr, "Error: Closing output file failed: %s\n", strerror(errno));
+        w->error = 1;
+    }
+    return w->error ? -1 : 0;
+}
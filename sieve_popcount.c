@@ -0,0 +1,192 @@
+#include "sieve_internal.h"
+#include <string.h>
+#include <pthread.h>
+
+#if defined(SIEVE_KERNEL_CLONES) && defined(__aarch64__)
+#include <sys/auxv.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define POPCOUNT_X86 1
+#endif
+
+// ============================================================================
+// PRIME COUNTING over segment bitmaps
+// ============================================================================
+//
+// Count-only runs spend a large share of their time turning bitmaps into a
+// number. The kernels below count whole bytes; popcount_bits() masks the
+// final partial byte. The widest kernel the CPU supports is picked once at
+// first use.
+
+typedef size_t (*popcount_kernel)(const uint8_t *bytes, size_t byte_count);
+
+// Portable: one 64-bit word at a time, short tail zero-padded into a word
+static size_t popcount_scalar(const uint8_t *bytes, size_t byte_count) {
+    size_t count = 0;
+    size_t i = 0;
+    
+    for (; i + 8 <= byte_count; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        count += (size_t)__builtin_popcountll(word);
+    }
+    if (i < byte_count) {
+        uint64_t word = 0;
+        memcpy(&word, bytes + i, byte_count - i);
+        count += (size_t)__builtin_popcountll(word);
+    }
+    
+    return count;
+}
+
+#ifdef POPCOUNT_X86
+
+// Per-byte popcount via nibble lookup, summed into four 64-bit lanes
+__attribute__((target("avx2")))
+static inline __m256i popcount256(__m256i v) {
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0F);
+    __m256i lo = _mm256_and_si256(v, low_mask);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+    __m256i per_byte = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                                       _mm256_shuffle_epi8(lookup, hi));
+    return _mm256_sad_epu8(per_byte, _mm256_setzero_si256());
+}
+
+// Carry-save adder: (high, low) = a + b + c, bitwise
+#define CSA(high, low, a, b, c) do {                                   \
+        __m256i u_ = _mm256_xor_si256((a), (b));                       \
+        (high) = _mm256_or_si256(_mm256_and_si256((a), (b)),           \
+                                 _mm256_and_si256(u_, (c)));           \
+        (low) = _mm256_xor_si256(u_, (c));                             \
+    } while (0)
+
+// AVX2 Harley-Seal (Mula, Kurz & Lemire): a tree of carry-save adders
+// folds 16 vectors into ones/twos/fours/eights, so the expensive vector
+// popcount runs once per 16 loads
+__attribute__((target("avx2")))
+static size_t popcount_avx2(const uint8_t *bytes, size_t byte_count) {
+    const __m256i *v = (const __m256i *)(const void *)bytes;
+    size_t vec_count = byte_count / 32;
+    __m256i total = _mm256_setzero_si256();
+    __m256i ones = _mm256_setzero_si256();
+    __m256i twos = _mm256_setzero_si256();
+    __m256i fours = _mm256_setzero_si256();
+    __m256i eights = _mm256_setzero_si256();
+    __m256i sixteens, twos_a, twos_b, fours_a, fours_b, eights_a, eights_b;
+    size_t i = 0;
+
+#define LOAD(k) _mm256_loadu_si256(v + i + (k))
+    for (; i + 16 <= vec_count; i += 16) {
+        CSA(twos_a, ones, ones, LOAD(0), LOAD(1));
+        CSA(twos_b, ones, ones, LOAD(2), LOAD(3));
+        CSA(fours_a, twos, twos, twos_a, twos_b);
+        CSA(twos_a, ones, ones, LOAD(4), LOAD(5));
+        CSA(twos_b, ones, ones, LOAD(6), LOAD(7));
+        CSA(fours_b, twos, twos, twos_a, twos_b);
+        CSA(eights_a, fours, fours, fours_a, fours_b);
+        CSA(twos_a, ones, ones, LOAD(8), LOAD(9));
+        CSA(twos_b, ones, ones, LOAD(10), LOAD(11));
+        CSA(fours_a, twos, twos, twos_a, twos_b);
+        CSA(twos_a, ones, ones, LOAD(12), LOAD(13));
+        CSA(twos_b, ones, ones, LOAD(14), LOAD(15));
+        CSA(fours_b, twos, twos, twos_a, twos_b);
+        CSA(eights_b, fours, fours, fours_a, fours_b);
+        CSA(sixteens, eights, eights, eights_a, eights_b);
+        total = _mm256_add_epi64(total, popcount256(sixteens));
+    }
+#undef LOAD
+    
+    total = _mm256_slli_epi64(total, 4);
+    total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount256(eights), 3));
+    total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount256(fours), 2));
+    total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount256(twos), 1));
+    total = _mm256_add_epi64(total, popcount256(ones));
+    for (; i < vec_count; i++) {
+        total = _mm256_add_epi64(total, popcount256(_mm256_loadu_si256(v + i)));
+    }
+    
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)(void *)lanes, total);
+    size_t count = (size_t)(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+    
+    return count + popcount_scalar(bytes + vec_count * 32, byte_count - vec_count * 32);
+}
+
+#undef CSA
+
+// AVX-512 VPOPCNTQ: native 64-bit lane popcount; the tail is a masked load
+__attribute__((target("avx512f,avx512bw,avx512vpopcntdq")))
+static size_t popcount_avx512(const uint8_t *bytes, size_t byte_count) {
+    __m512i total = _mm512_setzero_si512();
+    size_t i = 0;
+    
+    for (; i + 64 <= byte_count; i += 64) {
+        __m512i v = _mm512_loadu_si512((const void *)(bytes + i));
+        total = _mm512_add_epi64(total, _mm512_popcnt_epi64(v));
+    }
+    if (i < byte_count) {
+        __mmask64 tail = (__mmask64)(~0ULL >> (64 - (byte_count - i)));
+        __m512i v = _mm512_maskz_loadu_epi8(tail, bytes + i);
+        total = _mm512_add_epi64(total, _mm512_popcnt_epi64(v));
+    }
+    
+    return (size_t)_mm512_reduce_add_epi64(total);
+}
+
+#endif /* POPCOUNT_X86 */
+
+static popcount_kernel popcount_impl = popcount_scalar;
+static pthread_once_t popcount_once = PTHREAD_ONCE_INIT;
+
+static void popcount_select(void) {
+#ifdef POPCOUNT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512vpopcntdq") && __builtin_cpu_supports("avx512bw")) {
+        popcount_impl = popcount_avx512;
+    } else if (__builtin_cpu_supports("avx2")) {
+        popcount_impl = popcount_avx2;
+    }
+#endif
+}
+
+size_t popcount_bits(const uint8_t *bits, size_t bit_count) {
+    pthread_once(&popcount_once, popcount_select);
+    
+    size_t full_bytes = bit_count / 8;
+    size_t count = popcount_impl(bits, full_bytes);
+    
+    // Mask off bits past bit_count in the final partial byte
+    if (bit_count % 8 != 0) {
+        uint8_t last = bits[full_bytes] & (uint8_t)((1u << (bit_count % 8)) - 1);
+        count += (size_t)__builtin_popcount(last);
+    }
+    
+    return count;
+}
+
+// ============================================================================
+// KERNEL ISA LEVEL: which SIEVE_KERNEL clone the loader picked
+// ============================================================================
+//
+// The predicates match the ones target_clones resolves with, so the answer
+// names the variant actually running.
+
+const char *sieve_kernel_isa(void) {
+#if defined(SIEVE_KERNEL_CLONES) && defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("x86-64-v4")) {
+        return "x86-64-v4";
+    }
+    return __builtin_cpu_supports("x86-64-v3") ? "x86-64-v3" : "x86-64-v2";
+#elif defined(SIEVE_KERNEL_CLONES) && defined(__aarch64__)
+    return (getauxval(AT_HWCAP) & HWCAP_SVE) ? "sve" : "armv8-a";
+#elif defined(SIEVE_PORTABLE) && defined(__aarch64__)
+    return "armv8-a";                       // Compiler too old for clones
+#else
+    return "native";
+#endif
+}
@@ -0,0 +1,187 @@
+#include "sieve.h"
+#include "sieve_internal.h"
+#include <pthread.h>
+#include <string.h>
+
+// ============================================================================
+// BATCHED PRIMALITY TESTS: bitmap below PRIME_TEST_SMALL, Miller-Rabin above
+// ============================================================================
+//
+// Each input takes the first of these that decides it:
+//   1. x < PRIME_TEST_SMALL: one bit of an odd-only bitmap sieved on first use
+//   2. divisibility by the odd primes up to 53, as a multiply by the inverse
+//      and a compare (no division); this removes ~80% of odd composites
+//   3. deterministic Miller-Rabin in Montgomery form: bases 2, 7, 61 below
+//      4759123141, otherwise the seven bases of Sinclair, exact for 2^64
+//
+// Each Montgomery squaring depends on the previous one, so a single test
+// runs at the latency of the 64x64->128 multiply and the reduction. Four
+// tests run in lockstep instead, one witness base each, with the exponent
+// bits applied by selects rather than branches. A lane that finishes (a
+// witness, or every base passed) is refilled from the input straight away,
+// so a composite that dies on its first base does not hold up a prime.
+
+#define PRIME_TEST_SMALL (1u << 24)         // Bitmap: 1MB of odd numbers
+#ifndef PRIME_TEST_LANES
+#define PRIME_TEST_LANES 4                  // Independent tests in flight
+#endif
+
+typedef unsigned __int128 u128;
+
+static uint8_t small_bitmap[PRIME_TEST_SMALL / 16];
+static pthread_once_t small_once = PTHREAD_ONCE_INIT;
+
+static void small_visit(const uint8_t *seg_sieve, uint64_t first_odd, size_t odd_count,
+                        void *ctx) {
+    (void)ctx;
+    for (size_t k = 0; 64 * k < odd_count; k++) {
+        uint64_t bits = segment_word(seg_sieve, odd_count, k);
+        uint64_t bit = (first_odd - 1) / 2 + 64 * k;
+        while (bits != 0) {
+            SET_BIT(small_bitmap, bit + (uint64_t)__builtin_ctzll(bits));
+            bits &= bits - 1;
+        }
+    }
+}
+
+// ---- Trial division by multiplication ---------------------------------------
+//
+// For odd p, x is a multiple of p iff x * p^-1 (mod 2^64) <= (2^64 - 1) / p
+
+static const uint8_t trial_primes[] = { 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53 };
+#define TRIAL_COUNT (sizeof(trial_primes) / sizeof(trial_primes[0]))
+
+static uint64_t trial_inverse[TRIAL_COUNT];
+static uint64_t trial_limit[TRIAL_COUNT];
+
+static void small_build(void) {
+    sieve_window(3, PRIME_TEST_SMALL - 1, small_visit, NULL);
+    for (size_t i = 0; i < TRIAL_COUNT; i++) {
+        trial_inverse[i] = inverse_mod_2_64(trial_primes[i]);
+        trial_limit[i] = UINT64_MAX / trial_primes[i];
+    }
+}
+
+// 1 prime, 0 composite, -1 undecided (odd, >= PRIME_TEST_SMALL, no factor <= 53)
+static int quick_test(uint64_t x) {
+    if (x < PRIME_TEST_SMALL) {
+        return (x == 2) || ((x & 1) && GET_BIT(small_bitmap, x / 2) != 0);
+    }
+    if ((x & 1) == 0) {
+        return 0;
+    }
+    for (size_t i = 0; i < TRIAL_COUNT; i++) {
+        if (x * trial_inverse[i] <= trial_limit[i]) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// ---- Montgomery arithmetic mod an odd n < 2^64 ------------------------------
+
+// a * b / 2^64 mod n, for a, b < n
+static inline uint64_t mont_mul(uint64_t a, uint64_t b, uint64_t n, uint64_t inv) {
+    u128 t = (u128)a * b;
+    uint64_t m = (uint64_t)t * inv;
+    uint64_t mn = (uint64_t)(((u128)m * n) >> 64);
+    uint64_t hi = (uint64_t)(t >> 64);
+    uint64_t r = hi - mn;
+    return (hi < mn) ? r + n : r;            // The low halves cancel exactly
+}
+
+static const uint64_t bases_small[] = { 2, 7, 61 };
+static const uint64_t bases_full[] = { 2, 325, 9375, 28178, 450775, 9780504, 1795265022 };
+
+typedef struct {
+    uint64_t n, inv, one, minus_one, r2;
+    uint64_t d;                              // n - 1 = d * 2^s, d odd
+    unsigned s;
+    unsigned base, base_count;
+    const uint64_t *bases;
+    size_t slot;                             // Index into the caller's arrays
+} mr_lane;
+
+static void lane_setup(mr_lane *l, uint64_t n, size_t slot) {
+    l->n = n;
+    l->inv = inverse_mod_2_64(n);
+    l->one = ((uint64_t)0 - n) % n;          // 2^64 mod n
+    l->minus_one = n - l->one;
+    l->r2 = (uint64_t)(((u128)l->one * l->one) % n);
+    l->s = (unsigned)__builtin_ctzll(n - 1);
+    l->d = (n - 1) >> l->s;
+    l->base = 0;
+    if (n < 4759123141ULL) {
+        l->bases = bases_small;
+        l->base_count = sizeof(bases_small) / sizeof(bases_small[0]);
+    } else {
+        l->bases = bases_full;
+        l->base_count = sizeof(bases_full) / sizeof(bases_full[0]);
+    }
+    l->slot = slot;
+}
+
+// One base on every lane; returns per lane 0 (composite), 1 (prime: last
+// base passed) or 2 (passed, more bases to go)
+static void mr_round(mr_lane *lanes, size_t count, int *verdict) {
+    uint64_t x[PRIME_TEST_LANES], a[PRIME_TEST_LANES];
+    int top = 0;
+    for (size_t l = 0; l < count; l++) {
+        uint64_t b = lanes[l].bases[lanes[l].base] % lanes[l].n;
+        a[l] = mont_mul(b, lanes[l].r2, lanes[l].n, lanes[l].inv);
+        x[l] = lanes[l].one;
+        int bits = 64 - __builtin_clzll(lanes[l].d);
+        top = (bits > top) ? bits : top;
+    }
+
+    // a^d, left to right, all lanes per exponent bit
+    for (int bit = top - 1; bit >= 0; bit--) {
+        for (size_t l = 0; l < count; l++) {
+            uint64_t sq = mont_mul(x[l], x[l], lanes[l].n, lanes[l].inv);
+            uint64_t mul = mont_mul(sq, a[l], lanes[l].n, lanes[l].inv);
+            x[l] = ((lanes[l].d >> bit) & 1) ? mul : sq;
+        }
+    }
+
+    for (size_t l = 0; l < count; l++) {
+        mr_lane *ln = &lanes[l];
+        int pass = (a[l] == 0) || x[l] == ln->one || x[l] == ln->minus_one;
+        for (unsigned r = 1; !pass && r < ln->s; r++) {
+            x[l] = mont_mul(x[l], x[l], ln->n, ln->inv);
+            if (x[l] == ln->one) {
+                break;                       // Nontrivial square root of 1
+            }
+            pass = (x[l] == ln->minus_one);
+        }
+        verdict[l] = !pass ? 0 : (++ln->base == ln->base_count) ? 1 : 2;
+    }
+}
+
+void is_prime_batch(const uint64_t *xs, size_t n, uint8_t *out) {
+    pthread_once(&small_once, small_build);
+    mr_lane lanes[PRIME_TEST_LANES];
+    int verdict[PRIME_TEST_LANES];
+    size_t active = 0, next = 0;
+
+    for (;;) {
+        while (active < PRIME_TEST_LANES && next < n) {
+            int r = quick_test(xs[next]);
+            if (r >= 0) {
+                out[next] = (uint8_t)r;
+            } else {
+                lane_setup(&lanes[active++], xs[next], next);
+            }
+            next++;
+        }
+        if (active == 0) {
+            break;
+        }
+        mr_round(lanes, active, verdict);
+        for (size_t l = active; l-- > 0; ) {
+            if (verdict[l] != 2) {
+                out[lanes[l].slot] = (uint8_t)verdict[l];
+                lanes[l] = lanes[--active];  // From above l: already judged
+            }
+        }
+    }
+}
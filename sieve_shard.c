@@ -0,0 +1,319 @@
+#include "sieve.h"
+#include "sieve_internal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// ============================================================================
+// SHARDED COUNTING: [lo, hi] split across independent runs, merged later
+// ============================================================================
+//
+// Shards are balanced by estimated sieving work, not by width. Per number,
+// the windowed sieve (sieve_range) pays roughly
+//
+//     w(x) = 0.25                                 fill + popcount
+//          + (ln ln sqrt(x) - ln ln 61) / 2       crossing off p in (61, sqrt(x)]
+//          + pi(sqrt(x)) / 524288                 one check per large prime
+//                                                 per (nominal) segment
+//
+// so a shard near 10^13 costs about twice a shard of the same width near
+// 10^9. Boundary i is the smallest x with W(lo, x) >= i/N of the total,
+// found by bisection. Every node must get the same boundaries, and libm's
+// log() and sqrt() are not bit-identical across CPUs, compilers and glibc
+// versions, so w(x) is not evaluated at run time: it is tabulated below at
+// x = 2^k in 16.16 fixed point, interpolated linearly within each octave,
+// and integrated in 128-bit integers. The split is then the same on every
+// host whatever its cache, tuning file or floating-point unit;
+// sieve_shard_merge() still checks that the shards it is given tile
+// [lo, hi] exactly, so a mismatch cannot go unnoticed.
+
+#define SHARD_MAGIC     "SIEVESH1"
+#define SHARD_VERSION   3                   // 1, 2: bounds from floating-point work estimates
+
+typedef unsigned __int128 shard_cost;
+
+// round(65536 * w(2^k)) for k = 0 .. 64
+static const uint32_t shard_density[65] = {
+    16384, 16384, 16384, 16384, 16384, 16384, 16384, 16385,
+    16385, 16385, 16385, 16385, 16766, 19390, 21819, 24081,
+    26197, 28185, 30061, 31836, 33522, 35127, 36660, 38128,
+    39539, 40899, 42214, 43492, 44740, 45967, 47183, 48403,
+    49643, 50926, 52281, 53751, 55390, 57275, 59512, 62244,
+    65671, 70070, 75824, 83463, 93721, 107618, 126569, 152538,
+    188255, 237510, 305572, 399767, 530283, 711290, 962510, 1311386,
+    1796128, 2469941, 3406930, 4710335, 6524011, 9048457, 12563174, 17457869,
+    24276024,
+};
+
+// Work of the first t numbers of octave k, [2^k, 2^k + t): the integral of
+// the line from shard_density[k] to shard_density[k + 1], rounded down. At
+// most 2^63 * 2^25 per octave, so sums over all 64 fit easily
+static shard_cost octave_work(int k, uint64_t t) {
+    uint64_t length = 1ULL << k;
+    uint64_t rise = shard_density[k + 1] - shard_density[k];
+    uint64_t slope_t = (uint64_t)((shard_cost)t * rise / length);  // Density gained over t
+    return (shard_cost)t * shard_density[k] + (shard_cost)slope_t * t / 2;
+}
+
+// Estimated work of [0, x); nondecreasing in x
+static shard_cost shard_work_below(uint64_t x) {
+    if (x == 0) {
+        return 0;
+    }
+    shard_cost work = shard_density[0];      // [0, 1)
+    int k = 63 - __builtin_clzll(x);
+    for (int i = 0; i < k; i++) {
+        work += octave_work(i, 1ULL << i);
+    }
+    return work + octave_work(k, x - (1ULL << k));
+}
+
+// First number of shard `index` (0 < index < count). Never below lo + index,
+// so boundaries are nondecreasing and the one after shard 0 is above lo.
+static uint64_t shard_boundary(uint64_t lo, uint64_t hi, uint32_t index, uint32_t count) {
+    shard_cost base = shard_work_below(lo);
+    shard_cost target = (shard_work_below(hi) - base) * index / count;
+    uint64_t a = lo, b = hi;                 // Answer in (a, b]; b meets the target
+    while (b - a > 1) {
+        uint64_t mid = a + (b - a) / 2;
+        if (shard_work_below(mid) - base >= target) {
+            b = mid;
+        } else {
+            a = mid;
+        }
+    }
+    return (b > lo + index) ? b : lo + index;
+}
+
+int sieve_shard_range(uint64_t lo, uint64_t hi, uint32_t index, uint32_t count,
+                      uint64_t *shard_lo, uint64_t *shard_hi) {
+    if (lo > hi || count == 0 || index >= count || hi - lo < count - 1) {
+        fprintf(stderr, "Error: Shard %u/%u of [%llu, %llu] does not exist\n", index, count,
+                (unsigned long long)lo, (unsigned long long)hi);
+        return -1;
+    }
+    uint64_t first = (index == 0) ? lo : shard_boundary(lo, hi, index, count);
+    if (index + 1 == count) {
+        *shard_lo = first;
+        *shard_hi = hi;
+        return 0;
+    }
+    uint64_t next = shard_boundary(lo, hi, index + 1, count);
+    *shard_lo = first;
+    *shard_hi = next - 1;                    // next > lo: no wrap; empty if next == first
+    return 0;
+}
+
+// ---- Result records ---------------------------------------------------------
+
+// FNV-1a over the record up to its checksum field
+static uint64_t shard_checksum(const sieve_shard_result *r) {
+    const uint8_t *bytes = (const uint8_t *)r;
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < offsetof(sieve_shard_result, checksum); i++) {
+        h = (h ^ bytes[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+int sieve_shard_run(uint64_t lo, uint64_t hi, uint32_t index, uint32_t count,
+                    sieve_shard_result *result) {
+    memset(result, 0, sizeof(*result));
+    if (sieve_shard_range(lo, hi, index, count, &result->shard_lo, &result->shard_hi) != 0) {
+        return -1;
+    }
+    memcpy(result->magic, SHARD_MAGIC, sizeof(result->magic));
+    result->version = SHARD_VERSION;
+    result->index = index;
+    result->count = count;
+    result->lo = lo;
+    result->hi = hi;
+    result->prime_count = (result->shard_lo <= result->shard_hi)
+                        ? sieve_range(result->shard_lo, result->shard_hi, NULL, NULL) : 0;
+    if (result->prime_count == SIEVE_ERROR) {
+        return -1;                           // Out of memory, already reported
+    }
+    result->checksum = shard_checksum(result);
+    return 0;
+}
+
+// ---- Checkpointed shards: count-only sieve_window() with periodic saves ---
+
+typedef struct {
+    segment_checkpoint *cp;
+    uint64_t last_odd;
+    uint64_t count;
+} shard_counter;
+
+static void shard_count_segment(const uint8_t *seg_sieve, uint64_t first_odd,
+                                size_t odd_count, void *ctx) {
+    shard_counter *sc = ctx;
+    sc->count += popcount_bits(seg_sieve, odd_count);
+    uint64_t last = first_odd + 2 * (uint64_t)(odd_count - 1);
+    if (last != sc->last_odd) {              // The next start would wrap at 2^64
+        checkpoint_segment(sc->cp, NULL, last + 2, sc->count);
+    }
+}
+
+int sieve_shard_run_checkpointed(uint64_t lo, uint64_t hi, uint32_t index, uint32_t count,
+                                 const char *state_file, unsigned interval, int resume,
+                                 sieve_shard_result *result) {
+    memset(result, 0, sizeof(*result));
+    if (sieve_shard_range(lo, hi, index, count, &result->shard_lo, &result->shard_hi) != 0) {
+        return -1;
+    }
+    uint64_t shard_lo = result->shard_lo, shard_hi = result->shard_hi;
+    
+    segment_checkpoint cp = { .path = state_file, .interval = interval, .next_due = 0 };
+    int resumed = resume && checkpoint_load(state_file, &cp.state) == 0;
+    if (resumed && (cp.state.n != shard_hi || cp.state.lo != shard_lo || cp.state.has_output)) {
+        fprintf(stderr, "Error: Checkpoint '%s' belongs to a different run\n", state_file);
+        return -1;
+    }
+    if (!resumed) {
+        memset(&cp.state, 0, sizeof(cp.state));
+        cp.state.n = shard_hi;
+        cp.state.lo = shard_lo;
+    }
+    
+    // As in sieve_range(): 2 apart, then the odd numbers of the shard
+    uint64_t first_odd = (shard_lo <= 3) ? 3 : (shard_lo | 1);
+    uint64_t last_odd = (shard_hi % 2 == 0) ? shard_hi - 1 : shard_hi;
+    shard_counter sc = { .cp = &cp, .last_odd = last_odd, .count = cp.state.prime_count };
+    if (!resumed && shard_lo <= 2 && shard_hi >= 2) {
+        sc.count = 1;
+    }
+    if (resumed && cp.state.next_low != 0) {
+        first_odd = cp.state.next_low;
+    }
+    if (shard_hi >= 3 && first_odd <= last_odd
+            && sieve_window(first_odd, last_odd, shard_count_segment, &sc) != 0) {
+        fprintf(stderr, "Error: Could not allocate the sieving tables for shard %u/%u\n",
+                index, count);
+        return -1;                           // The last save stands
+    }
+    
+    memcpy(result->magic, SHARD_MAGIC, sizeof(result->magic));
+    result->version = SHARD_VERSION;
+    result->index = index;
+    result->count = count;
+    result->lo = lo;
+    result->hi = hi;
+    result->prime_count = (shard_lo <= shard_hi) ? sc.count : 0;
+    result->checksum = shard_checksum(result);
+    unlink(state_file);
+    return 0;
+}
+
+int sieve_shard_write(const char *path, const sieve_shard_result *result) {
+    char tmp_path[4096];
+    if ((size_t)snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%ld", path, (long)getpid())
+            >= sizeof(tmp_path)) {
+        fprintf(stderr, "Error: Shard path '%s' is too long\n", path);
+        return -1;
+    }
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Could not create shard file '%s': %s\n", tmp_path, strerror(errno));
+        return -1;
+    }
+    int ok = write(fd, result, sizeof(*result)) == (ssize_t)sizeof(*result) && fsync(fd) == 0;
+    ok = (close(fd) == 0) && ok;
+    if (!ok || rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Error: Writing shard file '%s' failed: %s\n", path, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+int sieve_shard_read(const char *path, sieve_shard_result *result) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Could not open shard file '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+    ssize_t r = read(fd, result, sizeof(*result));
+    close(fd);
+    if (r != (ssize_t)sizeof(*result)
+            || memcmp(result->magic, SHARD_MAGIC, sizeof(result->magic)) != 0
+            || result->version != SHARD_VERSION
+            || result->checksum != shard_checksum(result)) {
+        fprintf(stderr, "Error: '%s' is not a valid shard result\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// ---- Merging ----------------------------------------------------------------
+
+static int shard_check(const sieve_shard_result *results, size_t n_results, uint64_t *total) {
+    const sieve_shard_result *first = &results[0];
+    uint32_t count = first->count;
+    if (n_results != count) {
+        fprintf(stderr, "Error: Got %zu shard results for a %u-way split\n", n_results, count);
+        return -1;
+    }
+
+    // Order by index with a scan per slot: count is small and this leaves
+    // the caller's array alone
+    uint64_t expect_lo = first->lo;
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const sieve_shard_result *r = NULL;
+        for (size_t k = 0; k < n_results; k++) {
+            if (results[k].index == i) {
+                if (r != NULL) {
+                    fprintf(stderr, "Error: Shard %u/%u appears twice\n", i, count);
+                    return -1;
+                }
+                r = &results[k];
+            }
+        }
+        if (r == NULL) {
+            fprintf(stderr, "Error: Shard %u/%u is missing\n", i, count);
+            return -1;
+        }
+        if (r->count != count || r->lo != first->lo || r->hi != first->hi) {
+            fprintf(stderr, "Error: Shard %u/%u belongs to a different split\n", i, count);
+            return -1;
+        }
+        int empty = (r->shard_lo > r->shard_hi);
+        if (r->shard_lo != expect_lo || (empty && r->prime_count != 0)) {
+            fprintf(stderr, "Error: Shard %u/%u does not continue the previous one\n", i, count);
+            return -1;
+        }
+        if (!empty) {
+            expect_lo = r->shard_hi + 1;
+        }
+        sum += r->prime_count;
+    }
+    // The last shard ends at hi; expect_lo wraps to 0 when hi == 2^64 - 1
+    if (expect_lo != first->hi + 1) {
+        fprintf(stderr, "Error: Shards end before %llu\n", (unsigned long long)first->hi);
+        return -1;
+    }
+    *total = sum;
+    return 0;
+}
+
+int sieve_shard_merge(const char *const *paths, size_t n_paths, uint64_t *total) {
+    if (n_paths == 0) {
+        fprintf(stderr, "Error: No shard results to merge\n");
+        return -1;
+    }
+    sieve_arena *arena = arena_current();
+    arena_mark mark = arena_save(arena);
+    sieve_shard_result *results = arena_alloc(arena, n_paths * sizeof(sieve_shard_result));
+    int status = (results != NULL) ? 0 : -1;
+    for (size_t k = 0; status == 0 && k < n_paths; k++) {
+        status = sieve_shard_read(paths[k], &results[k]);
+    }
+    if (status == 0) {
+        status = shard_check(results, n_paths, total);
+    }
+    arena_restore(arena, mark);
+    return status;
+}
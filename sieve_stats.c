@@ -0,0 +1,196 @@
+#define _GNU_SOURCE  // syscall()
+#include "sieve.h"
+#include "sieve_internal.h"
+#include <string.h>
+
+// ============================================================================
+// PER-PHASE INSTRUMENTATION (built with -DSIEVE_STATS)
+// ============================================================================
+//
+// STATS_BEGIN/STATS_END bracket the phases of the single-threaded engines.
+// Without SIEVE_STATS they expand to nothing and only stubs are built here.
+// With it, each bracket reads the monotonic clock and, where the kernel
+// allows, one perf_event_open counter group (instructions retired, branch
+// misses, L1d read misses, last-level cache misses) with a single read().
+// Brackets sit at segment granularity, never inside the marking loops.
+
+static const char *const phase_names[SIEVE_PHASES] = {
+    "base_primes", "segment_init", "mark", "count", "output", "lucy"
+};
+
+const char *sieve_phase_name(sieve_phase phase) {
+    return ((unsigned)phase < SIEVE_PHASES) ? phase_names[phase] : "unknown";
+}
+
+#ifndef SIEVE_STATS
+
+int sieve_stats_enable(int on) {
+    return on ? -1 : 0;
+}
+
+void sieve_stats_reset(void) {
+}
+
+void sieve_stats_get(sieve_phase_stats stats[SIEVE_PHASES]) {
+    for (unsigned p = 0; p < SIEVE_PHASES; p++) {
+        memset(&stats[p], 0, sizeof(stats[p]));
+        stats[p].instructions = stats[p].branch_misses = -1;
+        stats[p].l1d_misses = stats[p].llc_misses = -1;
+    }
+}
+
+#else
+
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#define STATS_COUNTERS 4                    // Fixed order: see counter_configs
+
+typedef struct {
+    uint64_t nr;                            // PERF_FORMAT_GROUP layout
+    uint64_t values[STATS_COUNTERS];
+} counter_read;
+
+static int stats_enabled;
+static int group_fd = -1;
+static int counter_slot[STATS_COUNTERS];   // Position in the group read, -1 = absent
+static sieve_phase_stats totals[SIEVE_PHASES];
+static struct {
+    double start;
+    int64_t counters[STATS_COUNTERS];
+} open_phase[SIEVE_PHASES];
+
+static double stats_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+#ifdef __linux__
+static const struct { uint32_t type; uint64_t config; } counter_configs[STATS_COUNTERS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                          (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+};
+
+static int perf_open(uint32_t type, uint64_t config, int group) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = (group < 0);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+// Counters the kernel refuses (no PMU, perf_event_paranoid) stay absent
+static void counters_open(void) {
+    unsigned group_size = 0;
+    for (unsigned c = 0; c < STATS_COUNTERS; c++) {
+        counter_slot[c] = -1;
+        int fd = perf_open(counter_configs[c].type, counter_configs[c].config, group_fd);
+        if (fd < 0) {
+            continue;
+        }
+        if (group_fd < 0) {
+            group_fd = fd;
+        }
+        counter_slot[c] = (int)group_size++;
+    }
+    if (group_fd >= 0) {
+        ioctl(group_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+static void counters_read(int64_t out[STATS_COUNTERS]) {
+    counter_read r = { 0 };
+    int ok = (group_fd >= 0 && read(group_fd, &r, sizeof(r)) > 0);
+    for (unsigned c = 0; c < STATS_COUNTERS; c++) {
+        out[c] = (ok && counter_slot[c] >= 0) ? (int64_t)r.values[counter_slot[c]] : -1;
+    }
+}
+#else
+// No perf_event_open: wall time only
+static void counters_open(void) {
+    for (unsigned c = 0; c < STATS_COUNTERS; c++) {
+        counter_slot[c] = -1;
+    }
+}
+
+static void counters_read(int64_t out[STATS_COUNTERS]) {
+    for (unsigned c = 0; c < STATS_COUNTERS; c++) {
+        out[c] = -1;
+    }
+}
+#endif
+
+int sieve_stats_enable(int on) {
+    if (on && group_fd < 0) {
+        counters_open();
+    }
+    stats_enabled = on;
+    return 0;
+}
+
+void sieve_stats_reset(void) {
+    memset(totals, 0, sizeof(totals));
+}
+
+void sieve_stats_get(sieve_phase_stats stats[SIEVE_PHASES]) {
+    for (unsigned p = 0; p < SIEVE_PHASES; p++) {
+        stats[p] = totals[p];
+        int64_t *fields[STATS_COUNTERS] = {
+            &stats[p].instructions, &stats[p].branch_misses,
+            &stats[p].l1d_misses, &stats[p].llc_misses
+        };
+        for (unsigned c = 0; c < STATS_COUNTERS; c++) {
+            if (counter_slot[c] < 0 || group_fd < 0) {
+                *fields[c] = -1;
+            }
+        }
+    }
+}
+
+void stats_begin(sieve_phase phase) {
+    if (!stats_enabled) {
+        return;
+    }
+    counters_read(open_phase[phase].counters);
+    open_phase[phase].start = stats_clock();
+}
+
+void stats_end(sieve_phase phase) {
+    if (!stats_enabled) {
+        return;
+    }
+    double end = stats_clock();
+    int64_t now[STATS_COUNTERS];
+    counters_read(now);
+
+    sieve_phase_stats *t = &totals[phase];
+    t->seconds += end - open_phase[phase].start;
+    t->calls++;
+    int64_t *fields[STATS_COUNTERS] = {
+        &t->instructions, &t->branch_misses, &t->l1d_misses, &t->llc_misses
+    };
+    for (unsigned c = 0; c < STATS_COUNTERS; c++) {
+        if (now[c] >= 0 && open_phase[phase].counters[c] >= 0) {
+            *fields[c] += now[c] - open_phase[phase].counters[c];
+        }
+    }
+}
+
+#endif /* SIEVE_STATS */
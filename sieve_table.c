@@ -0,0 +1,360 @@
+#include "sieve.h"
+#include "sieve_internal.h"
+#include <stdio.h>
+#include <string.h>
+
+// ============================================================================
+// COMPRESSED RESIDENT PRIME TABLE: mod-30 wheel + per-block Elias-Fano
+// ============================================================================
+//
+// Numbers above 5 are addressed by wheel position: 8 * (x / 30) + the index
+// of x % 30 among the 8 residues coprime to 30, so composites divisible by
+// 2, 3 or 5 take no space at all. Positions are split into blocks of
+// TABLE_BLOCK_POSITIONS (61440 numbers), and each block stores its primes
+// in whichever of two forms is smaller:
+//
+//   TABLE_BITMAP       one bit per wheel position (2KB), the dense form
+//                      used for small numbers
+//   TABLE_ELIAS_FANO   the sorted positions v_i split into L low bits,
+//                      packed, and a unary high part with bit
+//                      (v_i >> L) + i set; n * (2 + log2(U / n)) bits
+//
+// Near 10^11 a block holds about 2400 primes, which Elias-Fano stores in
+// about 4.7 bits each, against 6.7 for the wheel bitmap and 12.7 for the
+// odd-only one. A query decodes one block only: the high part is walked
+// word by word (about 75 words), then the low bits of the one or two
+// elements in the matching bucket are compared.
+
+#define TABLE_BLOCK_BYTES     2048          // Wheel bytes (of 30 numbers) per block
+#define TABLE_BLOCK_POSITIONS (8u * TABLE_BLOCK_BYTES)
+#define TABLE_BLOCK_SPAN      (30ULL * TABLE_BLOCK_BYTES)
+#define TABLE_CHUNK           (1u << 20)    // Encoded blocks are packed into chunks
+#define TABLE_SLACK           8             // Readable bytes past a block's data
+
+enum { TABLE_BITMAP, TABLE_ELIAS_FANO };
+
+typedef struct {
+    const uint8_t *data;
+    uint32_t count;                         // Primes in the block
+    uint8_t kind;
+    uint8_t low_bits;                       // Elias-Fano L
+    uint16_t high_words;                    // Elias-Fano: 64-bit words of the high part
+} table_block;
+
+struct sieve_table {
+    sieve_arena *arena;
+    uint64_t limit;
+    uint64_t block_count;
+    table_block *blocks;
+    uint64_t bytes;                         // Directory plus encoded blocks
+    uint8_t *chunk;                         // Build: space left in the current chunk
+    size_t chunk_left;
+};
+
+static const uint8_t wheel_residues[8] = { 1, 7, 11, 13, 17, 19, 23, 29 };
+
+// Index of x % 30 among wheel_residues, or -1 when it shares a factor with 30
+static const int8_t wheel_index[30] = {
+    -1, 0, -1, -1, -1, -1, -1, 1, -1, -1, -1, 2, -1, 3, -1,
+    -1, -1, 4, -1, 5, -1, -1, -1, 6, -1, -1, -1, -1, -1, 7,
+};
+
+static uint64_t position_value(uint64_t block, unsigned pos) {
+    return 30 * (block * TABLE_BLOCK_BYTES + pos / 8) + wheel_residues[pos % 8];
+}
+
+// Bits bit .. bit + width - 1 of p (width < 32; TABLE_SLACK makes it safe)
+static inline unsigned read_bits(const uint8_t *p, uint64_t bit, unsigned width) {
+    uint64_t word;
+    memcpy(&word, p + bit / 8, sizeof(word));
+    return (unsigned)((word >> (bit % 8)) & ((1u << width) - 1));
+}
+
+static inline uint64_t load_word(const uint8_t *p, size_t k) {
+    uint64_t word;
+    memcpy(&word, p + 8 * k, sizeof(word));
+    return word;
+}
+
+// ---- Building ---------------------------------------------------------------
+
+typedef struct {
+    sieve_table *t;
+    uint16_t *positions;                    // Primes of the block being collected
+    uint32_t count;
+    uint64_t block;
+    int failed;
+} table_builder;
+
+static uint8_t *table_reserve(sieve_table *t, size_t bytes) {
+    if (t->chunk_left < bytes + TABLE_SLACK) {
+        size_t size = (bytes + TABLE_SLACK > TABLE_CHUNK) ? bytes + TABLE_SLACK : TABLE_CHUNK;
+        t->chunk = arena_alloc(t->arena, size);
+        if (t->chunk == NULL) {
+            return NULL;
+        }
+        memset(t->chunk, 0, size);
+        t->chunk_left = size;
+        t->bytes += size;
+    }
+    uint8_t *p = t->chunk;
+    t->chunk += bytes;
+    t->chunk_left -= bytes;
+    return p;
+}
+
+// Encode the collected positions of tb->block in the smaller form
+static void table_flush(table_builder *tb) {
+    table_block *b = &tb->t->blocks[tb->block];
+    uint32_t n = tb->count;
+    b->count = n;
+    b->kind = TABLE_BITMAP;
+    b->low_bits = 0;
+    b->high_words = 0;
+    tb->count = 0;
+    if (n == 0) {
+        b->data = NULL;
+        return;
+    }
+
+    unsigned low_bits = 0;
+    while ((TABLE_BLOCK_POSITIONS >> (low_bits + 1)) >= n) {
+        low_bits++;                          // floor(log2(U / n))
+    }
+    size_t high_bits = n + (TABLE_BLOCK_POSITIONS >> low_bits) + 1;
+    size_t low_bytes = ((size_t)n * low_bits + 7) / 8;
+    size_t high_words = (high_bits + 63) / 64;
+    size_t ef_bytes = low_bytes + 8 * high_words;
+
+    if (ef_bytes >= TABLE_BLOCK_BYTES) {
+        uint8_t *bitmap = table_reserve(tb->t, TABLE_BLOCK_BYTES);
+        if (bitmap == NULL) {
+            tb->failed = 1;
+            return;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            SET_BIT(bitmap, tb->positions[i]);
+        }
+        b->data = bitmap;
+        return;
+    }
+
+    // High part first, word-aligned; low bits after it
+    uint8_t *data = table_reserve(tb->t, ef_bytes);
+    if (data == NULL) {
+        tb->failed = 1;
+        return;
+    }
+    uint8_t *low = data + 8 * high_words;
+    for (uint32_t i = 0; i < n; i++) {
+        unsigned v = tb->positions[i];
+        SET_BIT(data, (v >> low_bits) + i);
+        uint64_t bit = (uint64_t)i * low_bits;
+        unsigned value = v & ((1u << low_bits) - 1);
+        for (unsigned k = 0; k < low_bits; k++, bit++) {
+            if (value & (1u << k)) {
+                SET_BIT(low, bit);
+            }
+        }
+    }
+    b->data = data;
+    b->kind = TABLE_ELIAS_FANO;
+    b->low_bits = (uint8_t)low_bits;
+    b->high_words = (uint16_t)high_words;
+}
+
+static void table_visit_segment(const uint8_t *seg_sieve, uint64_t first_odd,
+                                size_t odd_count, void *ctx) {
+    table_builder *tb = ctx;
+    for (size_t k = 0; 64 * k < odd_count; k++) {
+        uint64_t bits = segment_word(seg_sieve, odd_count, k);
+        uint64_t word_first = first_odd + 128 * k;
+        while (bits != 0) {
+            uint64_t p = word_first + 2 * (uint64_t)__builtin_ctzll(bits);
+            bits &= bits - 1;
+            uint64_t q = p / 30;
+            uint64_t block = q / TABLE_BLOCK_BYTES;
+            while (tb->block < block) {
+                table_flush(tb);
+                tb->block++;
+            }
+            tb->positions[tb->count++] = (uint16_t)(8 * (q % TABLE_BLOCK_BYTES)
+                                                    + wheel_index[p % 30]);
+        }
+    }
+}
+
+sieve_table *sieve_table_build(uint64_t limit) {
+    sieve_arena *arena = sieve_arena_create(0, 0);
+    sieve_table *t = (arena != NULL) ? arena_alloc(arena, sizeof(sieve_table)) : NULL;
+    if (t == NULL) {
+        sieve_arena_destroy(arena);
+        return NULL;
+    }
+    memset(t, 0, sizeof(*t));
+    t->arena = arena;
+    t->limit = limit;
+    t->block_count = limit / TABLE_BLOCK_SPAN + 1;
+    t->blocks = arena_alloc(arena, t->block_count * sizeof(table_block));
+    t->bytes = sizeof(*t) + t->block_count * sizeof(table_block);
+
+    sieve_arena *scratch = arena_current();
+    arena_mark mark = arena_save(scratch);
+    table_builder tb = {
+        .t = t,
+        .positions = arena_alloc(scratch, TABLE_BLOCK_POSITIONS * sizeof(uint16_t)),
+    };
+    if (t->blocks == NULL || tb.positions == NULL) {
+        arena_restore(scratch, mark);
+        sieve_arena_destroy(arena);
+        return NULL;
+    }
+    if (limit >= 7 && sieve_window(7, (limit % 2 == 0) ? limit - 1 : limit,
+                                   table_visit_segment, &tb) != 0) {
+        tb.failed = 1;
+    }
+    while (tb.block < t->block_count) {
+        table_flush(&tb);
+        tb.block++;
+    }
+    arena_restore(scratch, mark);
+    if (tb.failed) {
+        fprintf(stderr, "Error: Out of memory building a prime table up to %llu\n",
+                (unsigned long long)limit);
+        sieve_arena_destroy(arena);
+        return NULL;
+    }
+    return t;
+}
+
+void sieve_table_free(sieve_table *t) {
+    if (t != NULL) {
+        sieve_arena_destroy(t->arena);
+    }
+}
+
+uint64_t sieve_table_limit(const sieve_table *t) {
+    return t->limit;
+}
+
+uint64_t sieve_table_bytes(const sieve_table *t) {
+    return t->bytes;
+}
+
+// ---- Queries ----------------------------------------------------------------
+
+// Elias-Fano: the first element of the block at or after position v, or -1
+static int ef_lower_bound(const table_block *b, unsigned v) {
+    const uint8_t *high = b->data;
+    const uint8_t *low = high + 8 * (size_t)b->high_words;
+    unsigned low_bits = b->low_bits;
+    unsigned bucket = v >> low_bits;
+    uint64_t high_size = 64 * (uint64_t)b->high_words;
+
+    // Bucket h starts right after the h-th zero of the high part
+    uint64_t bit = 0;
+    if (bucket > 0) {
+        unsigned zeros = 0;
+        size_t k = 0;
+        for (;; k++) {
+            if (k == b->high_words) {
+                return -1;
+            }
+            unsigned in_word = 64 - (unsigned)__builtin_popcountll(load_word(high, k));
+            if (zeros + in_word >= bucket) {
+                break;
+            }
+            zeros += in_word;
+        }
+        uint64_t inverse = ~load_word(high, k);
+        for (; zeros + 1 < bucket; zeros++) {
+            inverse &= inverse - 1;
+        }
+        bit = 64 * k + (uint64_t)__builtin_ctzll(inverse) + 1;
+    }
+
+    // Walk the bucket, then on to the first element of a later one
+    uint32_t i = (uint32_t)(bit - bucket);
+    for (unsigned h = bucket; i < b->count && bit < high_size; bit++) {
+        if (GET_BIT(high, bit)) {
+            unsigned value = (h << low_bits) | read_bits(low, (uint64_t)i * low_bits, low_bits);
+            if (value >= v) {
+                return (int)value;
+            }
+            i++;
+        } else {
+            h++;
+        }
+    }
+    return -1;
+}
+
+// The first set position of a bitmap block at or after v, or -1
+static int bitmap_lower_bound(const table_block *b, unsigned v) {
+    size_t k = v / 64;
+    uint64_t word = load_word(b->data, k) & (~0ULL << (v % 64));
+    while (word == 0) {
+        if (++k == TABLE_BLOCK_POSITIONS / 64) {
+            return -1;
+        }
+        word = load_word(b->data, k);
+    }
+    return (int)(64 * k + (unsigned)__builtin_ctzll(word));
+}
+
+static int block_lower_bound(const table_block *b, unsigned v) {
+    if (b->count == 0) {
+        return -1;
+    }
+    return (b->kind == TABLE_BITMAP) ? bitmap_lower_bound(b, v) : ef_lower_bound(b, v);
+}
+
+int sieve_table_is_prime(const sieve_table *t, uint64_t x) {
+    if (x > t->limit) {
+        return -1;
+    }
+    if (x < 7) {
+        return x == 2 || x == 3 || x == 5;
+    }
+    int index = wheel_index[x % 30];
+    if (index < 0) {
+        return 0;
+    }
+    uint64_t q = x / 30;
+    unsigned pos = (unsigned)(8 * (q % TABLE_BLOCK_BYTES) + (unsigned)index);
+    const table_block *b = &t->blocks[q / TABLE_BLOCK_BYTES];
+    if (b->kind == TABLE_BITMAP) {
+        return b->count != 0 && GET_BIT(b->data, pos) != 0;
+    }
+    return ef_lower_bound(b, pos) == (int)pos;
+}
+
+uint64_t sieve_table_next_prime(const sieve_table *t, uint64_t x) {
+    if (x >= t->limit) {
+        return 0;
+    }
+    if (x < 5) {
+        uint64_t p = (x < 2) ? 2 : (x < 3) ? 3 : 5;
+        return (p <= t->limit) ? p : 0;
+    }
+
+    // First wheel position above x
+    uint64_t y = x + 1;
+    uint64_t q = y / 30;
+    unsigned r = (unsigned)(y % 30), j = 0;
+    while (j < 8 && wheel_residues[j] < r) {
+        j++;
+    }
+    if (j == 8) {
+        q++;
+        j = 0;
+    }
+    unsigned pos = (unsigned)(8 * (q % TABLE_BLOCK_BYTES) + j);
+    for (uint64_t block = q / TABLE_BLOCK_BYTES; block < t->block_count; block++, pos = 0) {
+        int found = block_lower_bound(&t->blocks[block], pos);
+        if (found >= 0) {
+            return position_value(block, (unsigned)found);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include "sieve.h"
+#include "sieve_internal.h"
+#include <stdio.h>
+#include <string.h>
+
+// ============================================================================
+// PRIME K-TUPLE COUNTING on the segment bitmaps
+// ============================================================================
+//
+// A tuple (0, d1, ..., dk-1) occurs at the odd p when bits g, g + d1/2, ...
+// of the odd-only bitmap are all set. For 64 consecutive starts at once that
+// is the AND of k 64-bit words read at bit offsets s + dj/2, then a popcount:
+// no prime is ever decoded.
+//
+// A tuple starting near the end of a segment finishes in the next one, so
+// the scan works on a staging buffer: the last span/2 bits of the previous
+// segment (starts not yet decided) followed by the new segment. Starts whose
+// last member is in the buffer are counted; the rest carry over. This costs
+// one shifted copy of each segment, which is small next to sieving it.
+
+typedef struct {
+    unsigned shifts[SIEVE_TUPLE_MAX];       // Member offsets in bits (d / 2)
+    size_t k;
+    size_t span;                            // shifts[k - 1]
+    uint64_t *buf;                          // Carry, then one segment; zero past `bits`
+    size_t bits;
+    uint64_t count;
+} tuple_scan;
+
+// 64 bits of buf starting at bit `pos`; the word past the end must exist
+static inline uint64_t bits_at(const uint64_t *buf, size_t pos) {
+    size_t word = pos / 64;
+    unsigned shift = (unsigned)(pos % 64);
+    uint64_t value = buf[word] >> shift;
+    if (shift != 0) {
+        value |= buf[word + 1] << (64 - shift);
+    }
+    return value;
+}
+
+// Append the first odd_count bits of seg_sieve at bit ts->bits
+static void tuple_append(tuple_scan *ts, const uint8_t *seg_sieve, size_t odd_count) {
+    uint64_t *dst = ts->buf + ts->bits / 64;
+    unsigned shift = (unsigned)(ts->bits % 64);
+    size_t words = (odd_count + 63) / 64;
+
+    for (size_t k = 0; k < words; k++) {
+        uint64_t w = 0;
+        size_t left = odd_count - 64 * k;
+        memcpy(&w, seg_sieve + 8 * k, (left >= 64) ? 8 : (left + 7) / 8);
+        if (left < 64) {
+            w &= ((uint64_t)1 << left) - 1;  // Bits past the segment are stale
+        }
+        dst[k] |= w << shift;
+        dst[k + 1] = (shift != 0) ? w >> (64 - shift) : 0;
+    }
+    ts->bits += odd_count;
+}
+
+SIEVE_KERNEL
+static void tuple_visit_segment(const uint8_t *seg_sieve, uint64_t first_odd,
+                                size_t odd_count, void *ctx) {
+    (void)first_odd;
+    tuple_scan *ts = ctx;
+    tuple_append(ts, seg_sieve, odd_count);
+    if (ts->bits <= ts->span) {
+        return;                              // No start has all its members yet
+    }
+
+    // Starts [0, starts) have their last member inside the buffer
+    size_t starts = ts->bits - ts->span;
+    for (size_t s = 0; s < starts; s += 64) {
+        uint64_t acc = ts->buf[s / 64];
+        for (size_t j = 1; j < ts->k; j++) {
+            acc &= bits_at(ts->buf, s + ts->shifts[j]);
+        }
+        if (starts - s < 64) {
+            acc &= ((uint64_t)1 << (starts - s)) - 1;
+        }
+        ts->count += (uint64_t)__builtin_popcountll(acc);
+    }
+
+    // Carry the undecided starts (the last span bits) to the front
+    size_t old_words = (ts->bits + 63) / 64;
+    size_t carry_words = (ts->span + 63) / 64;
+    for (size_t w = 0; w < carry_words; w++) {
+        ts->buf[w] = bits_at(ts->buf, starts + 64 * w);  // Reads at or past w
+    }
+    if (ts->span % 64 != 0) {
+        ts->buf[carry_words - 1] &= ((uint64_t)1 << (ts->span % 64)) - 1;
+    }
+    memset(ts->buf + carry_words, 0, (old_words + 1 - carry_words) * sizeof(uint64_t));
+    ts->bits = ts->span;
+}
+
+uint64_t sieve_count_tuples(uint64_t lo, uint64_t hi, const unsigned *offsets, size_t k) {
+    if (k < 2 || k > SIEVE_TUPLE_MAX || offsets[0] != 0) {
+        fprintf(stderr, "Error: A tuple needs 2 to %d offsets, starting at 0\n", SIEVE_TUPLE_MAX);
+        return 0;
+    }
+    tuple_scan ts = { .k = k, .count = 0 };
+    for (size_t j = 0; j < k; j++) {
+        if (offsets[j] % 2 != 0 || (j > 0 && offsets[j] <= offsets[j - 1])
+                || offsets[j] > SIEVE_TUPLE_MAX_SPAN) {
+            fprintf(stderr, "Error: Tuple offsets must be even, increasing and at most %d\n",
+                    SIEVE_TUPLE_MAX_SPAN);
+            return 0;
+        }
+        ts.shifts[j] = offsets[j] / 2;
+    }
+    ts.span = ts.shifts[k - 1];
+
+    // Odd p from max(lo, 3); every member, so the last one, at most hi
+    uint64_t first_odd = (lo <= 3) ? 3 : (lo | 1);
+    uint64_t last_odd = (hi % 2 == 0) ? hi - 1 : hi;
+    if (hi < 3 || first_odd > last_odd || (last_odd - first_odd) / 2 < ts.span) {
+        return 0;
+    }
+
+    sieve_arena *arena = arena_current();
+    arena_mark mark = arena_save(arena);
+    size_t segment_bits = sieve_get_config()->segment_size / 2;
+    size_t buf_words = (ts.span + segment_bits + 63) / 64 + 2;
+    ts.buf = arena_alloc(arena, buf_words * sizeof(uint64_t));
+    if (ts.buf == NULL) {
+        arena_restore(arena, mark);
+        return 0;
+    }
+    memset(ts.buf, 0, buf_words * sizeof(uint64_t));
+    ts.bits = 0;
+
+    sieve_window(first_odd, last_odd, tuple_visit_segment, &ts);
+
+    arena_restore(arena, mark);
+    return ts.count;
+}
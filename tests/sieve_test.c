@@ -0,0 +1,1061 @@
+#include "sieve.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// ============================================================================
+// DIFFERENTIAL TESTS AND PERFORMANCE REGRESSION CHECKS
+// ============================================================================
+//
+// Correctness: every engine, the parallel counter and writer in every
+// output format, sieve_range(), the batch and iterator interfaces, tuples,
+// is_prime_batch(), shards, checkpoints, the cache file, the compressed
+// table and the factor sieve are compared with a reference that shares no
+// code with the library: a plain byte-per-number Eratosthenes up to
+// REF_LIMIT and a textbook Miller-Rabin (mulmod by 128-bit %) above it. Limits are picked at the places engines
+// switch behaviour: segment edges, the AUTO thresholds +- 1, powers of ten,
+// and random values; each runs at several segment sizes.
+//
+// Performance: a fixed set of cases is timed (best of PERF_RUNS) and
+// compared with a baseline file of "name = seconds" lines. A case fails
+// when it is slower than its baseline by more than the allowed fraction,
+// and so does a case with no baseline. Baselines belong to a host:
+// --update-baseline appends the cases the file lacks and leaves the rest.
+
+#define REF_LIMIT      (1u << 24)
+#define REF_BLOCK      4096                  // Numbers per cumulative count
+#define PERF_RUNS      3
+#define MAX_FAILURES   20                    // Reported individually
+#define WINDOW_MAX     20000
+
+static uint8_t *ref_prime;                   // ref_prime[x] for x <= REF_LIMIT
+static uint32_t *ref_pi_block;               // pi(b * REF_BLOCK - 1)
+static unsigned failures;
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static const struct { const char *name; sieve_engine engine; } engines[] = {
+    { "auto",      SIEVE_ENGINE_AUTO },
+    { "simple",    SIEVE_ENGINE_SIMPLE },
+    { "segmented", SIEVE_ENGINE_SEGMENTED },
+    { "bucket",    SIEVE_ENGINE_BUCKET },
+    { "wheel",     SIEVE_ENGINE_WHEEL },
+    { "lucy",      SIEVE_ENGINE_LUCY },
+    { "gpu",       SIEVE_ENGINE_GPU },
+};
+#define ENGINE_COUNT (sizeof(engines) / sizeof(engines[0]))
+
+static void check(int ok, const char *fmt, ...) {
+    if (ok) {
+        return;
+    }
+    if (++failures <= MAX_FAILURES) {
+        va_list ap;
+        va_start(ap, fmt);
+        fprintf(stderr, "FAIL: ");
+        vfprintf(stderr, fmt, ap);
+        fputc('\n', stderr);
+        va_end(ap);
+    }
+}
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// ---- Reference ---------------------------------------------------------------
+
+static int ref_build(void) {
+    ref_prime = malloc(REF_LIMIT + 1);
+    ref_pi_block = malloc((REF_LIMIT / REF_BLOCK + 2) * sizeof(uint32_t));
+    if (ref_prime == NULL || ref_pi_block == NULL) {
+        fprintf(stderr, "Error: Could not allocate the reference sieve\n");
+        return -1;
+    }
+    memset(ref_prime, 1, REF_LIMIT + 1);
+    ref_prime[0] = ref_prime[1] = 0;
+    for (uint64_t p = 2; p * p <= REF_LIMIT; p++) {
+        if (ref_prime[p]) {
+            for (uint64_t m = p * p; m <= REF_LIMIT; m += p) {
+                ref_prime[m] = 0;
+            }
+        }
+    }
+    uint32_t count = 0;
+    for (uint64_t x = 0; x <= REF_LIMIT; x++) {
+        if (x % REF_BLOCK == 0) {
+            ref_pi_block[x / REF_BLOCK] = count;
+        }
+        count += ref_prime[x];
+    }
+    return 0;
+}
+
+static uint64_t ref_pi(uint64_t n) {
+    uint64_t count = ref_pi_block[n / REF_BLOCK];
+    for (uint64_t x = n / REF_BLOCK * REF_BLOCK; x <= n; x++) {
+        count += ref_prime[x];
+    }
+    return count;
+}
+
+static uint64_t mulmod(uint64_t a, uint64_t b, uint64_t m) {
+    return (uint64_t)((unsigned __int128)a * b % m);
+}
+
+// Deterministic for all 64-bit x with the first twelve prime bases
+static int ref_is_prime(uint64_t x) {
+    if (x <= REF_LIMIT) {
+        return ref_prime[x];
+    }
+    static const uint64_t bases[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37 };
+    for (size_t i = 0; i < sizeof(bases) / sizeof(bases[0]); i++) {
+        if (x % bases[i] == 0) {
+            return 0;
+        }
+    }
+    uint64_t d = x - 1;
+    unsigned s = 0;
+    while (d % 2 == 0) {
+        d /= 2;
+        s++;
+    }
+    for (size_t i = 0; i < sizeof(bases) / sizeof(bases[0]); i++) {
+        uint64_t y = 1, b = bases[i];
+        for (uint64_t e = d; e != 0; e >>= 1) {
+            if (e & 1) {
+                y = mulmod(y, b, x);
+            }
+            b = mulmod(b, b, x);
+        }
+        if (y == 1 || y == x - 1) {
+            continue;
+        }
+        unsigned r = 1;
+        for (; r < s; r++) {
+            y = mulmod(y, y, x);
+            if (y == x - 1) {
+                break;
+            }
+        }
+        if (r == s) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// ---- Helpers -----------------------------------------------------------------
+
+typedef struct {
+    uint64_t *primes;
+    size_t count;
+    size_t capacity;
+    size_t largest;                         // Longest batch handed over
+} prime_list;
+
+static void list_push(uint64_t prime, void *ctx) {
+    prime_list *l = ctx;
+    if (l->count < l->capacity) {
+        l->primes[l->count] = prime;
+    }
+    l->count++;
+}
+
+static void list_push_batch(const uint64_t *primes, size_t count, void *ctx) {
+    prime_list *l = ctx;
+    if (count > l->largest) {
+        l->largest = count;
+    }
+    for (size_t i = 0; i < count; i++) {
+        list_push(primes[i], ctx);
+    }
+}
+
+// The primes of [lo, hi] in order, as the reference sees them
+static size_t ref_window(uint64_t lo, uint64_t hi, uint64_t *out, size_t capacity) {
+    size_t count = 0;
+    for (uint64_t x = lo; ; x++) {
+        if (ref_is_prime(x) && count < capacity) {
+            out[count++] = x;
+        }
+        if (x == hi) {
+            break;
+        }
+    }
+    return count;
+}
+
+static char temp_path[4096];
+
+static const struct { const char *name; sieve_format format; } formats[] = {
+    { "text",   SIEVE_FORMAT_TEXT },
+    { "u32",    SIEVE_FORMAT_U32 },
+    { "u64",    SIEVE_FORMAT_U64 },
+    { "varint", SIEVE_FORMAT_VARINT },
+    { "bitmap", SIEVE_FORMAT_BITMAP },
+};
+#define FORMAT_COUNT (sizeof(formats) / sizeof(formats[0]))
+
+// The smallest reference prime above x, or 0 if there is none up to n
+static uint64_t ref_next(uint64_t x, uint64_t n) {
+    while (x < n) {
+        if (ref_is_prime(++x)) {
+            return x;
+        }
+    }
+    return 0;
+}
+
+// Primes in [lo, hi]
+static uint64_t ref_count(uint64_t lo, uint64_t hi) {
+    if (hi <= REF_LIMIT) {
+        return ref_pi(hi) - ((lo == 0) ? 0 : ref_pi(lo - 1));
+    }
+    uint64_t count = 0;
+    for (uint64_t x = lo; x <= hi && x >= lo; x++) {
+        count += ref_is_prime(x);
+    }
+    return count;
+}
+
+// Next prime of a non-bitmap output file: 1, 0 at the end, -1 if malformed.
+// For varint, *prime holds the previous prime on entry
+static int read_prime(FILE *f, sieve_format format, uint64_t *prime) {
+    switch (format) {
+    case SIEVE_FORMAT_U32: {
+        uint32_t v;
+        size_t got = fread(&v, 1, sizeof(v), f);
+        *prime = v;
+        return (got == sizeof(v)) ? 1 : (got == 0) ? 0 : -1;
+    }
+    case SIEVE_FORMAT_U64: {
+        size_t got = fread(prime, 1, sizeof(*prime), f);
+        return (got == sizeof(*prime)) ? 1 : (got == 0) ? 0 : -1;
+    }
+    case SIEVE_FORMAT_VARINT: {
+        uint64_t gap = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            int c = fgetc(f);
+            if (c == EOF) {
+                return (shift == 0) ? 0 : -1;
+            }
+            gap |= (uint64_t)(c & 0x7f) << shift;
+            if ((c & 0x80) == 0) {
+                *prime += gap;
+                return 1;
+            }
+        }
+        return -1;
+    }
+    case SIEVE_FORMAT_TEXT:
+    default: {
+        uint64_t v = 0;
+        int c, digits = 0;
+        while ((c = fgetc(f)) >= '0' && c <= '9') {
+            v = v * 10 + (uint64_t)(c - '0');
+            digits++;
+        }
+        *prime = v;
+        return (c == EOF && digits == 0) ? 0 : (c == '\n' && digits != 0) ? 1 : -1;
+    }
+    }
+}
+
+// Read back an output file and compare it with the reference primes <= n
+static void check_output_file(const char *what, uint64_t n, sieve_format format) {
+    FILE *f = fopen(temp_path, "rb");
+    if (f == NULL) {
+        check(n < 2, "%s n=%llu: no output file", what, (unsigned long long)n);
+        return;
+    }
+    uint64_t expect = ref_next(0, n), prime = 0;
+    size_t index = 0;
+    int ok = 1;
+    if (format == SIEVE_FORMAT_BITMAP) {
+        // 2 is implied; bit i is 2i + 1 for i < (n + 1) / 2, then zero padding
+        if (expect == 2) {
+            expect = ref_next(2, n);
+            index++;
+        }
+        uint64_t bit_count = (n + 1) / 2, i = 0;
+        int c;
+        while (ok && (c = fgetc(f)) != EOF) {
+            for (int b = 0; b < 8 && ok; b++, i++) {
+                if ((c >> b) & 1) {
+                    ok = (i < bit_count && 2 * i + 1 == expect);
+                    expect = ref_next(expect, n);
+                    index += ok;
+                }
+            }
+        }
+        ok = ok && expect == 0 && i == (bit_count + 7) / 8 * 8;
+    } else {
+        int r;
+        while ((r = read_prime(f, format, &prime)) == 1 && prime == expect && expect != 0) {
+            expect = ref_next(expect, n);
+            index++;
+        }
+        ok = (r == 0 && expect == 0);
+    }
+    fclose(f);
+    check(ok, "%s n=%llu: output differs at prime #%zu", what, (unsigned long long)n, index + 1);
+    unlink(temp_path);
+}
+
+// ---- Correctness -------------------------------------------------------------
+
+static void test_counts(uint64_t n) {
+    uint64_t expect = ref_pi(n);
+    for (size_t e = 0; e < ENGINE_COUNT; e++) {
+        uint64_t got = sieve_with_engine((size_t)n, NULL, engines[e].engine);
+        check(got == expect, "%s count n=%llu: %llu, expected %llu", engines[e].name,
+              (unsigned long long)n, (unsigned long long)got, (unsigned long long)expect);
+    }
+    for (size_t threads = 1; threads <= 3; threads++) {
+        uint64_t got = sieve_count_parallel((size_t)n, threads);
+        check(got == expect, "parallel(%zu) count n=%llu: %llu, expected %llu", threads,
+              (unsigned long long)n, (unsigned long long)got, (unsigned long long)expect);
+    }
+}
+
+static void test_outputs(uint64_t n) {
+    char what[64];
+    uint64_t expect = ref_pi(n);
+    for (size_t e = 0; e < ENGINE_COUNT; e++) {
+        sieve_write_primes((size_t)n, temp_path, SIEVE_FORMAT_U64, engines[e].engine);
+        snprintf(what, sizeof(what), "%s output", engines[e].name);
+        check_output_file(what, n, SIEVE_FORMAT_U64);
+    }
+    // Every format serially and in parallel: with 3 threads, text and varint
+    // go through the ordered pwritev ring, the rest through offset pwrites
+    for (size_t f = 0; f < FORMAT_COUNT; f++) {
+        uint64_t got = sieve_write_primes((size_t)n, temp_path, formats[f].format,
+                                          SIEVE_ENGINE_AUTO);
+        snprintf(what, sizeof(what), "%s output (%llu primes)", formats[f].name,
+                 (unsigned long long)got);
+        check(got == expect, "%s n=%llu: expected %llu primes", what, (unsigned long long)n,
+              (unsigned long long)expect);
+        check_output_file(what, n, formats[f].format);
+        for (size_t threads = 1; threads <= 3; threads += 2) {
+            got = sieve_write_parallel((size_t)n, temp_path, formats[f].format, threads);
+            snprintf(what, sizeof(what), "parallel(%zu) %s output (%llu primes)", threads,
+                     formats[f].name, (unsigned long long)got);
+            check(got == expect, "%s n=%llu: expected %llu primes", what, (unsigned long long)n,
+                  (unsigned long long)expect);
+            check_output_file(what, n, formats[f].format);
+        }
+    }
+}
+
+// Limits where engines change behaviour, for the configuration in effect
+static size_t boundary_limits(uint64_t *out, size_t capacity) {
+    const sieve_config *config = sieve_get_config();
+    size_t count = 0;
+    uint64_t edges[] = { config->simple_threshold, config->bucket_threshold,
+                         config->count_threshold, 1000, 10000, 100000, 1000000, 10000000 };
+    for (size_t k = 1; k <= 3; k++) {
+        for (int d = -3; d <= 3; d++) {
+            if (count < capacity) {
+                out[count++] = k * config->segment_size + (uint64_t)(int64_t)d;
+            }
+        }
+    }
+    for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); i++) {
+        for (int d = -1; d <= 1; d++) {
+            if (count < capacity) {
+                out[count++] = edges[i] + (uint64_t)(int64_t)d;
+            }
+        }
+    }
+    for (size_t i = 0; i < 6 && count < capacity; i++) {
+        out[count++] = rng_next() % REF_LIMIT;
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (out[i] <= REF_LIMIT) {
+            out[kept++] = out[i];
+        }
+    }
+    return kept;
+}
+
+static void test_engines(size_t segment_size) {
+    sieve_config config = *sieve_get_config();
+    sieve_config saved = config;
+    config.segment_size = segment_size;
+    // Bring the AUTO switch points into the reference range
+    config.simple_threshold = 3 * segment_size + 1;
+    config.bucket_threshold = 8 * segment_size + 5;
+    config.count_threshold = 2 * segment_size - 1;
+    sieve_set_config(&config);
+
+    for (uint64_t n = 0; n <= 300; n++) {
+        test_counts(n);
+    }
+    uint64_t limits[64];
+    size_t count = boundary_limits(limits, sizeof(limits) / sizeof(limits[0]));
+    for (size_t i = 0; i < count; i++) {
+        test_counts(limits[i]);
+    }
+    uint64_t outputs[] = { 0, 1, 2, 3, 4, 100, limits[3], limits[4], limits[5] };
+    for (size_t i = 0; i < sizeof(outputs) / sizeof(outputs[0]); i++) {
+        test_outputs(outputs[i]);
+    }
+    test_outputs(config.simple_threshold + 1);
+    test_outputs(config.bucket_threshold + 1);
+
+    sieve_set_config(&saved);
+}
+
+// Windows high up need base primes to 2^32: `full` = 0 checks only
+// sieve_range() and is_prime_batch() there
+static void test_window(uint64_t lo, uint64_t hi, uint64_t *expect, uint64_t *buf, int full) {
+    size_t count = ref_window(lo, hi, expect, WINDOW_MAX);
+    prime_list got = { .primes = buf, .count = 0, .capacity = WINDOW_MAX };
+
+    uint64_t n = sieve_range(lo, hi, list_push, &got);
+    int same = (n == count && got.count == count
+                && memcmp(buf, expect, count * sizeof(uint64_t)) == 0);
+    check(same, "sieve_range [%llu, %llu]: %llu primes, expected %zu",
+          (unsigned long long)lo, (unsigned long long)hi, (unsigned long long)n, count);
+
+    // Every number of the window through is_prime_batch
+    size_t width = (size_t)(hi - lo) + 1;
+    uint8_t flags[WINDOW_MAX];
+    for (size_t i = 0; i < width; i++) {
+        buf[i] = lo + i;
+    }
+    is_prime_batch(buf, width, flags);
+    size_t k = 0, wrong = 0;
+    for (size_t i = 0; i < width; i++) {
+        int prime = (k < count && expect[k] == lo + i);
+        k += prime;
+        wrong += (flags[i] != prime);
+    }
+    check(wrong == 0, "is_prime_batch [%llu, %llu]: %zu wrong",
+          (unsigned long long)lo, (unsigned long long)hi, wrong);
+    if (!full) {
+        return;
+    }
+
+    n = sieve_range(lo, hi, NULL, NULL);
+    check(n == count, "sieve_range count [%llu, %llu]: %llu, expected %zu",
+          (unsigned long long)lo, (unsigned long long)hi, (unsigned long long)n, count);
+
+    // Batches below one bitmap word's worth of primes, and above it
+    const size_t batches[] = { 1, 7, 100 };
+    for (size_t b = 0; b < sizeof(batches) / sizeof(batches[0]); b++) {
+        got.count = 0;
+        got.largest = 0;
+        n = sieve_for_each_batch(lo, hi, batches[b], list_push_batch, &got);
+        same = (n == count && got.count == count && got.largest <= batches[b]
+                && memcmp(buf, expect, count * sizeof(uint64_t)) == 0);
+        check(same, "sieve_for_each_batch(%zu) [%llu, %llu]: %llu primes in batches of "
+              "up to %zu, expected %zu", batches[b], (unsigned long long)lo,
+              (unsigned long long)hi, (unsigned long long)n, got.largest, count);
+    }
+
+    // Twin pairs p, p + 2 with both members in the window
+    uint64_t twins = 0;
+    for (size_t i = 0; i + 1 < count; i++) {
+        twins += (expect[i + 1] - expect[i] == 2);
+    }
+    const unsigned twin[] = { 0, 2 };
+    n = sieve_count_tuples(lo, hi, twin, 2);
+    check(n == twins, "sieve_count_tuples(0,2) [%llu, %llu]: %llu, expected %llu",
+          (unsigned long long)lo, (unsigned long long)hi, (unsigned long long)n,
+          (unsigned long long)twins);
+}
+
+static void test_windows(size_t segment_size) {
+    uint64_t *expect = malloc(WINDOW_MAX * sizeof(uint64_t));
+    uint64_t *buf = malloc(WINDOW_MAX * sizeof(uint64_t));
+    if (expect == NULL || buf == NULL) {
+        check(0, "window buffers could not be allocated");
+        free(expect);
+        free(buf);
+        return;
+    }
+    sieve_config config = *sieve_get_config();
+    sieve_config saved = config;
+    config.segment_size = segment_size;
+    sieve_set_config(&config);
+
+    for (uint64_t lo = 0; lo <= 5; lo++) {
+        test_window(lo, lo + 200, expect, buf, 1);
+    }
+    // Segment edges and a random window per decade up to 10^15
+    for (uint64_t k = 1; k <= 3; k++) {
+        test_window(k * segment_size - 7, k * segment_size + 7, expect, buf, 1);
+    }
+    uint64_t magnitude = 100;
+    for (int decade = 2; decade <= 15; decade++, magnitude *= 10) {
+        uint64_t width = (decade <= 8) ? 19000 : 2000;
+        uint64_t lo = magnitude + rng_next() % (magnitude / 2);
+        test_window(lo, lo + width, expect, buf, 1);
+    }
+
+    sieve_set_config(&saved);
+    free(expect);
+    free(buf);
+}
+
+static void test_iterator(void) {
+    for (int round = 0; round < 4; round++) {
+        uint64_t start = (round == 0) ? 0 : rng_next() % (REF_LIMIT - 100000);
+        prime_iterator it;
+        prime_iterator_init(&it, start);
+        uint64_t expect = start;
+        int ok = 1;
+        for (int i = 0; i < 2000 && ok; i++) {
+            while (!ref_prime[expect]) {
+                expect++;
+            }
+            ok = (prime_iterator_next(&it) == expect);
+            expect++;
+        }
+        check(ok, "prime_iterator_next from %llu", (unsigned long long)start);
+
+        expect = (start + 50000) & ~(uint64_t)1;   // Even: not itself a prime
+        prime_iterator_skipto(&it, expect);
+        for (int i = 0; i < 1000 && ok && expect > 2; i++) {
+            do {
+                expect--;
+            } while (expect > 1 && !ref_prime[expect]);
+            ok = (prime_iterator_prev(&it) == expect);
+        }
+        check(ok, "prime_iterator_prev below %llu", (unsigned long long)((start + 50000) & ~(uint64_t)1));
+        prime_iterator_free(&it);
+    }
+}
+
+// ---- Subsystems --------------------------------------------------------------
+
+// Send the library's expected error reports to /dev/null while on
+static void quiet(int on) {
+    static int saved = -1;
+    fflush(stderr);
+    if (on) {
+        int fd = open("/dev/null", O_WRONLY);
+        saved = dup(STDERR_FILENO);
+        if (fd >= 0) {
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+    } else if (saved >= 0) {
+        dup2(saved, STDERR_FILENO);
+        close(saved);
+        saved = -1;
+    }
+}
+
+#define SHARD_MAX 8
+
+// Shards tile the range, each record survives a write and read and is the
+// same when checkpointed, and the merge sums the reference count; a missing
+// or duplicated shard fails it
+static void test_shards(void) {
+    static const struct { uint64_t lo, hi; uint32_t count; } splits[] = {
+        { 0, REF_LIMIT, 7 },
+        { 1000000000000ULL, 1000000000000ULL + 300000, 5 },
+        { 100, 104, 5 },                     // One number per shard
+    };
+    char paths[SHARD_MAX][sizeof(temp_path) + 16];
+    char state_path[sizeof(temp_path) + 16];
+    const char *list[SHARD_MAX];
+    snprintf(state_path, sizeof(state_path), "%s.state", temp_path);
+    for (size_t s = 0; s < sizeof(splits) / sizeof(splits[0]); s++) {
+        uint64_t lo = splits[s].lo, hi = splits[s].hi;
+        uint32_t count = splits[s].count;
+        uint64_t next = lo;
+        int tiled = 1, stored = 1;
+        for (uint32_t i = 0; i < count; i++) {
+            snprintf(paths[i], sizeof(paths[i]), "%s.%u.res", temp_path, i);
+            list[i] = paths[i];
+            uint64_t shard_lo, shard_hi;
+            sieve_shard_result result, back, saved;
+            if (sieve_shard_range(lo, hi, i, count, &shard_lo, &shard_hi) != 0
+                    || shard_lo != next || shard_hi + 1 < shard_lo) {
+                tiled = 0;
+                break;
+            }
+            next = shard_hi + 1;
+            stored = stored && sieve_shard_run(lo, hi, i, count, &result) == 0
+                     && result.shard_lo == shard_lo && result.shard_hi == shard_hi
+                     && sieve_shard_write(paths[i], &result) == 0
+                     && sieve_shard_read(paths[i], &back) == 0
+                     && memcmp(&result, &back, sizeof(result)) == 0
+                     && sieve_shard_run_checkpointed(lo, hi, i, count, state_path, 0, 1, &saved) == 0
+                     && memcmp(&result, &saved, sizeof(result)) == 0
+                     && access(state_path, F_OK) != 0;
+        }
+        check(tiled && next - 1 == hi, "shards of [%llu, %llu]: do not tile the range",
+              (unsigned long long)lo, (unsigned long long)hi);
+        check(stored, "shards of [%llu, %llu]: a record did not round-trip or changed when checkpointed",
+              (unsigned long long)lo, (unsigned long long)hi);
+        if (!tiled) {
+            continue;
+        }
+
+        uint64_t total = 0, expect = ref_count(lo, hi);
+        int merged = sieve_shard_merge(list, count, &total);
+        check(merged == 0 && total == expect, "shard merge [%llu, %llu]: %llu, expected %llu",
+              (unsigned long long)lo, (unsigned long long)hi, (unsigned long long)total,
+              (unsigned long long)expect);
+        quiet(1);
+        int missing = sieve_shard_merge(list, count - 1, &total);
+        list[count - 1] = list[0];
+        int duplicated = sieve_shard_merge(list, count, &total);
+        int beyond = sieve_shard_range(lo, hi, count, count, &total, &total);
+        quiet(0);
+        check(missing != 0 && duplicated != 0 && beyond != 0,
+              "shards of [%llu, %llu]: a missing, duplicated or extra shard was accepted",
+              (unsigned long long)lo, (unsigned long long)hi);
+        for (uint32_t i = 0; i < count; i++) {
+            unlink(paths[i]);
+        }
+    }
+}
+
+static long file_size(const char *path) {
+    struct stat st;
+    return (stat(path, &st) == 0) ? (long)st.st_size : -1;
+}
+
+// A checkpointed run writes the same file as sieve_write_primes; one cut
+// short (a file size limit fails a write partway through) keeps its last
+// save, and resuming from it finishes the same file
+static void test_checkpoint(void) {
+    const uint64_t n = REF_LIMIT;
+    const uint64_t expect = ref_pi(n);
+    char state_path[sizeof(temp_path) + 16];
+    char what[64];
+    snprintf(state_path, sizeof(state_path), "%s.state", temp_path);
+    for (size_t f = 0; f < FORMAT_COUNT; f++) {
+        sieve_format format = formats[f].format;
+        size_t count = 0;
+        int status = sieve_write_checkpointed((size_t)n, temp_path, format, state_path, 0, 0, &count);
+        long size = file_size(temp_path);
+        check(status == 0 && count == expect && access(state_path, F_OK) != 0,
+              "checkpointed %s n=%llu: status %d, %zu primes, expected %llu", formats[f].name,
+              (unsigned long long)n, status, count, (unsigned long long)expect);
+        snprintf(what, sizeof(what), "checkpointed %s output", formats[f].name);
+        check_output_file(what, n, format);
+
+        struct rlimit saved, limit;
+        if (size <= 0 || getrlimit(RLIMIT_FSIZE, &saved) != 0
+                || (saved.rlim_cur != RLIM_INFINITY && saved.rlim_cur < (rlim_t)size)) {
+            continue;                        // Cannot cut the run short here
+        }
+        limit = saved;
+        limit.rlim_cur = (rlim_t)(size / 3);
+        void (*handler)(int) = signal(SIGXFSZ, SIG_IGN);
+        quiet(1);
+        setrlimit(RLIMIT_FSIZE, &limit);
+        status = sieve_write_checkpointed((size_t)n, temp_path, format, state_path, 0, 0, &count);
+        setrlimit(RLIMIT_FSIZE, &saved);
+        quiet(0);
+        signal(SIGXFSZ, handler);
+        check(status != 0 && access(state_path, F_OK) == 0,
+              "checkpointed %s n=%llu: a cut-short run left no state", formats[f].name,
+              (unsigned long long)n);
+
+        status = sieve_write_checkpointed((size_t)n, temp_path, format, state_path, 0, 1, &count);
+        check(status == 0 && count == expect && access(state_path, F_OK) != 0,
+              "resumed %s n=%llu: status %d, %zu primes, expected %llu", formats[f].name,
+              (unsigned long long)n, status, count, (unsigned long long)expect);
+        snprintf(what, sizeof(what), "resumed %s output", formats[f].name);
+        check_output_file(what, n, format);
+        unlink(state_path);
+    }
+}
+
+// Counts (also past the cached limit), nth prime and batched primality
+// from a cache file, against the reference
+static void test_cache(void) {
+    const uint64_t limit = REF_LIMIT - 12345;  // Ends inside a block
+    char path[sizeof(temp_path) + 16];
+    snprintf(path, sizeof(path), "%s.cache", temp_path);
+    sieve_cache *cache = (sieve_cache_build(limit, path) == 0) ? sieve_cache_open(path) : NULL;
+    check(cache != NULL && sieve_cache_limit(cache) == limit, "cache build/open, limit %llu",
+          (unsigned long long)limit);
+    if (cache == NULL) {
+        unlink(path);
+        return;
+    }
+
+    uint64_t ranges[][2] = {
+        { 0, 0 }, { 0, 1 }, { 0, 2 }, { 2, 2 }, { 3, 3 }, { 0, limit }, { limit, limit },
+        { limit - 100, limit + 100 }, { limit + 1, REF_LIMIT }, { 1000, 999 },
+    };
+    for (size_t i = 0; i < sizeof(ranges) / sizeof(ranges[0]) + 200; i++) {
+        uint64_t lo, hi;
+        if (i < sizeof(ranges) / sizeof(ranges[0])) {
+            lo = ranges[i][0];
+            hi = ranges[i][1];
+        } else {
+            lo = rng_next() % REF_LIMIT;
+            hi = lo + rng_next() % (REF_LIMIT - lo + 1);
+        }
+        uint64_t got = sieve_cache_count(cache, lo, hi);
+        uint64_t expect = (lo > hi) ? 0 : ref_count(lo, hi);
+        check(got == expect, "sieve_cache_count [%llu, %llu]: %llu, expected %llu",
+              (unsigned long long)lo, (unsigned long long)hi, (unsigned long long)got,
+              (unsigned long long)expect);
+    }
+
+    // k-th prime: the first, the last cached one, past it, and random k
+    uint64_t cached = ref_pi(limit), largest = limit;
+    while (!ref_prime[largest]) {
+        largest--;
+    }
+    check(sieve_cache_nth_prime(cache, 0) == 0 && sieve_cache_nth_prime(cache, 1) == 2
+          && sieve_cache_nth_prime(cache, cached) == largest
+          && sieve_cache_nth_prime(cache, cached + 1) == 0,
+          "sieve_cache_nth_prime at k = 0, 1, %llu, %llu", (unsigned long long)cached,
+          (unsigned long long)cached + 1);
+    size_t wrong = 0;
+    for (int i = 0; i < 200; i++) {
+        uint64_t x = 2 + rng_next() % (limit - 1);
+        if (ref_prime[x]) {
+            wrong += (sieve_cache_nth_prime(cache, ref_pi(x)) != x);
+        }
+    }
+    check(wrong == 0, "sieve_cache_nth_prime: %zu wrong", wrong);
+
+    // Inputs below, at and above the limit, and full 64-bit ones
+    enum { BATCH = 4096 };
+    static uint64_t xs[BATCH];
+    static uint8_t flags[BATCH];
+    for (size_t i = 0; i < BATCH; i++) {
+        switch (i % 4) {
+        case 0:  xs[i] = rng_next() % (limit + 1); break;
+        case 1:  xs[i] = limit - 50 + i % 100; break;
+        case 2:  xs[i] = limit + rng_next() % (REF_LIMIT - limit + 1); break;
+        default: xs[i] = rng_next() | 1; break;
+        }
+    }
+    sieve_cache_is_prime_batch(cache, xs, BATCH, flags);
+    wrong = 0;
+    for (size_t i = 0; i < BATCH; i++) {
+        wrong += (flags[i] != ref_is_prime(xs[i]));
+    }
+    check(wrong == 0, "sieve_cache_is_prime_batch: %zu of %d wrong", wrong, BATCH);
+
+    sieve_cache_close(cache);
+    unlink(path);
+}
+
+// Every number up to the limit through the compressed table (both block
+// codes occur below 2^24), and next_prime from every prime and at random
+static void test_table(void) {
+    const uint64_t limit = REF_LIMIT;
+    sieve_table *table = sieve_table_build(limit);
+    check(table != NULL && sieve_table_limit(table) == limit, "sieve_table_build(%llu)",
+          (unsigned long long)limit);
+    if (table == NULL) {
+        return;
+    }
+    size_t wrong = 0;
+    for (uint64_t x = 0; x <= limit; x++) {
+        wrong += (sieve_table_is_prime(table, x) != ref_prime[x]);
+    }
+    check(wrong == 0 && sieve_table_is_prime(table, limit + 1) == -1,
+          "sieve_table_is_prime: %zu wrong", wrong);
+
+    wrong = (sieve_table_next_prime(table, 0) != 2);
+    for (uint64_t p = 1; p != 0; p = ref_next(p, limit)) {   // 1, then every prime
+        wrong += (sieve_table_next_prime(table, p) != ref_next(p, limit));
+    }
+    for (int i = 0; i < 10000; i++) {
+        uint64_t x = rng_next() % (limit + 1);
+        wrong += (sieve_table_next_prime(table, x) != ref_next(x, limit));
+    }
+    check(wrong == 0, "sieve_table_next_prime: %zu wrong", wrong);
+    sieve_table_free(table);
+}
+
+typedef struct {
+    uint64_t next;                           // The number expected next
+    size_t wrong;
+} factor_check;
+
+static void check_factors(uint64_t n, const sieve_factor *factors, size_t count, void *ctx) {
+    factor_check *fc = ctx;
+    unsigned __int128 product = 1;
+    uint64_t last = 1;
+    int ok = (n == fc->next && count <= SIEVE_FACTOR_MAX);
+    for (size_t i = 0; i < count && ok; i++) {
+        ok = (factors[i].prime > last && factors[i].exponent >= 1 && ref_is_prime(factors[i].prime));
+        last = factors[i].prime;
+        for (unsigned e = 0; e < factors[i].exponent && product <= n; e++) {
+            product *= factors[i].prime;
+        }
+    }
+    fc->wrong += !(ok && product == n);
+    fc->next = n + 1;
+}
+
+// Every number of a few windows comes back once, in order, as a product of
+// increasing prime powers
+static void test_factor(void) {
+    static const uint64_t windows[][2] = {
+        { 0, 5000 },
+        { 999999999000ULL, 1000000003000ULL },
+        { 1000000000000000ULL - 1000, 1000000000000000ULL + 1000 },
+    };
+    for (size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); w++) {
+        uint64_t lo = windows[w][0], hi = windows[w][1];
+        uint64_t first = (lo == 0) ? 1 : lo;  // 0 is skipped
+        factor_check fc = { .next = first, .wrong = 0 };
+        uint64_t numbers = sieve_factor_range(lo, hi, check_factors, &fc);
+        check(numbers == hi - first + 1 && fc.next == hi + 1 && fc.wrong == 0,
+              "sieve_factor_range [%llu, %llu]: %llu numbers, %zu wrong",
+              (unsigned long long)lo, (unsigned long long)hi, (unsigned long long)numbers,
+              fc.wrong);
+    }
+}
+
+// ---- Performance -------------------------------------------------------------
+
+typedef enum {
+    PERF_ENGINE, PERF_PARALLEL, PERF_RANGE, PERF_WRITE, PERF_PRIMALITY
+} perf_kind;
+
+typedef struct {
+    const char *name;
+    perf_kind kind;
+    sieve_engine engine;
+    uint64_t n;
+} perf_case;
+
+static const perf_case perf_cases[] = {
+    { "simple_1e8",         PERF_ENGINE,    SIEVE_ENGINE_SIMPLE,    100000000ULL },
+    { "segmented_1e9",      PERF_ENGINE,    SIEVE_ENGINE_SEGMENTED, 1000000000ULL },
+    { "bucket_1e9",         PERF_ENGINE,    SIEVE_ENGINE_BUCKET,    1000000000ULL },
+    { "wheel_1e9",          PERF_ENGINE,    SIEVE_ENGINE_WHEEL,     1000000000ULL },
+    { "lucy_1e12",          PERF_ENGINE,    SIEVE_ENGINE_LUCY,      1000000000000ULL },
+    { "parallel_1e9",       PERF_PARALLEL,  SIEVE_ENGINE_AUTO,      1000000000ULL },
+    { "range_1e12_1e8",     PERF_RANGE,     SIEVE_ENGINE_AUTO,      100000000ULL },
+    { "write_u64_1e8",      PERF_WRITE,     SIEVE_ENGINE_SEGMENTED, 100000000ULL },
+    { "is_prime_batch_1e6", PERF_PRIMALITY, SIEVE_ENGINE_AUTO,      1000000ULL },
+};
+#define PERF_CASE_COUNT (sizeof(perf_cases) / sizeof(perf_cases[0]))
+
+static double perf_run(const perf_case *pc, uint64_t *xs, uint8_t *flags) {
+    double start = now_seconds();
+    switch (pc->kind) {
+    case PERF_ENGINE:
+        sieve_with_engine((size_t)pc->n, NULL, pc->engine);
+        break;
+    case PERF_PARALLEL:
+        sieve_count_parallel((size_t)pc->n, 0);
+        break;
+    case PERF_RANGE:
+        sieve_range(1000000000000ULL, 1000000000000ULL + pc->n, NULL, NULL);
+        break;
+    case PERF_WRITE:
+        sieve_write_primes((size_t)pc->n, temp_path, SIEVE_FORMAT_U64, pc->engine);
+        break;
+    case PERF_PRIMALITY:
+        is_prime_batch(xs, (size_t)pc->n, flags);
+        break;
+    }
+    double elapsed = now_seconds() - start;
+    if (pc->kind == PERF_WRITE) {
+        unlink(temp_path);
+    }
+    return elapsed;
+}
+
+static int baseline_lookup(const char *path, const char *name, double *seconds) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    char line[256], key[128];
+    double value;
+    int found = -1;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (line[0] != '#' && sscanf(line, "%127s = %lf", key, &value) == 2
+                && strcmp(key, name) == 0) {
+            *seconds = value;
+            found = 0;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+// 0 if every case has a baseline and is within the allowed slowdown, 1
+// otherwise. With update, cases that have no baseline yet are appended to
+// the file; existing entries are kept and still compared, so re-recording
+// one case means deleting its line (or the file)
+static int test_performance(const char *baseline_path, double max_slowdown, int update) {
+    uint64_t *xs = malloc(perf_cases[PERF_CASE_COUNT - 1].n * sizeof(uint64_t));
+    uint8_t *flags = malloc(perf_cases[PERF_CASE_COUNT - 1].n);
+    if (xs == NULL || flags == NULL) {
+        fprintf(stderr, "Error: Could not allocate the benchmark inputs\n");
+        free(xs);
+        free(flags);
+        return 1;
+    }
+    for (uint64_t i = 0; i < perf_cases[PERF_CASE_COUNT - 1].n; i++) {
+        xs[i] = rng_next() | 1;
+    }
+
+    double best[PERF_CASE_COUNT];
+    int missing[PERF_CASE_COUNT];
+    int missing_count = 0, regressions = 0;
+    printf("%-20s %10s %10s %8s\n", "case", "best_s", "baseline_s", "ratio");
+    for (size_t c = 0; c < PERF_CASE_COUNT; c++) {
+        perf_run(&perf_cases[c], xs, flags);  // Warm-up: page faults, lazy tables
+        best[c] = 0;
+        for (int r = 0; r < PERF_RUNS; r++) {
+            double t = perf_run(&perf_cases[c], xs, flags);
+            best[c] = (r == 0 || t < best[c]) ? t : best[c];
+        }
+        double base;
+        missing[c] = (baseline_lookup(baseline_path, perf_cases[c].name, &base) != 0);
+        if (missing[c]) {
+            printf("%-20s %10.4f %10s %8s  NO BASELINE\n", perf_cases[c].name, best[c], "-", "-");
+            missing_count++;
+            continue;
+        }
+        double ratio = best[c] / base;
+        int slow = ratio > 1.0 + max_slowdown;
+        regressions += slow;
+        printf("%-20s %10.4f %10.4f %7.2fx%s\n", perf_cases[c].name, best[c], base, ratio,
+               slow ? "  SLOWER" : "");
+    }
+    free(xs);
+    free(flags);
+
+    int status = 0;
+    if (missing_count != 0 && update) {
+        int fresh = (access(baseline_path, F_OK) != 0);
+        FILE *f = fopen(baseline_path, "a");
+        if (f == NULL) {
+            fprintf(stderr, "Error: Could not write baseline '%s'\n", baseline_path);
+            return 1;
+        }
+        if (fresh) {
+            fprintf(f, "# Best of %d seconds per case on this host (%s kernels)\n",
+                    PERF_RUNS, sieve_kernel_isa());
+        }
+        for (size_t c = 0; c < PERF_CASE_COUNT; c++) {
+            if (missing[c]) {
+                fprintf(f, "%s = %.6f\n", perf_cases[c].name, best[c]);
+            }
+        }
+        if (fclose(f) != 0) {
+            fprintf(stderr, "Error: Could not write baseline '%s'\n", baseline_path);
+            return 1;
+        }
+        printf("Baseline recorded for %d case(s): %s\n", missing_count, baseline_path);
+    } else if (missing_count != 0) {
+        fprintf(stderr, "FAIL: %d case(s) have no baseline in '%s'; record them with "
+                "--update-baseline (make test-baseline)\n", missing_count, baseline_path);
+        status = 1;
+    }
+    if (regressions != 0) {
+        fprintf(stderr, "FAIL: %d case(s) more than %.0f%% slower than the baseline\n",
+                regressions, max_slowdown * 100);
+        status = 1;
+    }
+    return status;
+}
+
+// ---- Driver ------------------------------------------------------------------
+
+static void print_usage(const char *program_name) {
+    fprintf(stderr, "Usage: %s [--seed s] [--no-perf] [--baseline file] [--max-slowdown f]\n", program_name);
+    fprintf(stderr, "          [--update-baseline]\n");
+    fprintf(stderr, "  --seed s          - Seed for the random limits and windows\n");
+    fprintf(stderr, "  --no-perf         - Correctness only\n");
+    fprintf(stderr, "  --baseline file   - Timings to compare with (default: tests/perf_baseline.txt)\n");
+    fprintf(stderr, "  --max-slowdown f  - Fail a case slower than baseline * (1 + f) (default: 0.25)\n");
+    fprintf(stderr, "  --update-baseline - Record timings for the cases the baseline lacks\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *baseline_path = "tests/perf_baseline.txt";
+    double max_slowdown = 0.25;
+    int perf = 1, update = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            rng_state = strtoull(argv[++i], NULL, 10) | 1;
+        } else if (strcmp(argv[i], "--no-perf") == 0) {
+            perf = 0;
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baseline_path = argv[++i];
+        } else if (strcmp(argv[i], "--max-slowdown") == 0 && i + 1 < argc) {
+            max_slowdown = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--update-baseline") == 0) {
+            update = 1;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    const char *tmp = getenv("TMPDIR");
+    snprintf(temp_path, sizeof(temp_path), "%s/sieve_test.%ld.bin",
+             (tmp != NULL) ? tmp : "/tmp", (long)getpid());
+
+    if (ref_build() != 0) {
+        return 1;
+    }
+    double start = now_seconds();
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    printf("Seed: %llu\n", (unsigned long long)rng_state);
+    const size_t segment_sizes[] = { 1024, 4096 + 2, 1u << 16, sieve_get_config()->segment_size };
+    for (size_t s = 0; s < sizeof(segment_sizes) / sizeof(segment_sizes[0]); s++) {
+        test_engines(segment_sizes[s]);
+        test_windows(segment_sizes[s]);
+        printf("Segment size %zu: %s\n", segment_sizes[s], failures ? "FAILED" : "ok");
+    }
+    // Up to 2^64 once: these sieve with 2 * 10^8 base primes
+    uint64_t *expect = malloc(WINDOW_MAX * sizeof(uint64_t));
+    uint64_t *buf = malloc(WINDOW_MAX * sizeof(uint64_t));
+    if (expect != NULL && buf != NULL) {
+        uint64_t lo = 10000000000000000000ULL + rng_next() % 1000000000000000000ULL;
+        test_window(lo, lo + 2000, expect, buf, 0);
+        test_window(UINT64_MAX - 3000, UINT64_MAX, expect, buf, 0);
+    }
+    free(expect);
+    free(buf);
+    test_iterator();
+    test_shards();
+    test_checkpoint();
+    test_cache();
+    test_table();
+    test_factor();
+    printf("Subsystems (shards, checkpoints, cache, table, factor): %s\n",
+           failures ? "FAILED" : "ok");
+    printf("Correctness: %s (%u failure%s, %.1f s)\n", failures ? "FAILED" : "ok", failures,
+           failures == 1 ? "" : "s", now_seconds() - start);
+
+    int status = (failures != 0);
+    if (perf && status == 0) {
+        status = test_performance(baseline_path, max_slowdown, update);
+    }
+    free(ref_prime);
+    free(ref_pi_block);
+    return status;
+}